@@ -11,14 +11,35 @@
 #include "atomic.h"
 #include "alloc.h"
 #include "utils.h"
+#include "lock.h"
 
-/* TODO: current allocator is too simple */
+/*
+ * Bump allocation, plus recycling of freed extents by size class: sizes up to
+ * ALLOC_MAX_RECYCLE are rounded up to ALLOC_GRAIN, and a freed extent is handed out again for
+ * the next allocation of its class. Larger extents are not recycled.
+ */
+
+#define ALLOC_GRAIN         64
+#define ALLOC_NR_CLASSES    1024
+#define ALLOC_MAX_RECYCLE   (ALLOC_GRAIN * ALLOC_NR_CLASSES)
+
+struct free_ext {
+    size_t off;
+    struct free_ext *next;
+};
 
 struct allocator {
     size_t size;
     size_t used;
+
+    spinlock_t lock;
+    struct free_ext *free[ALLOC_NR_CLASSES];
 };
 
+static inline int size_class(size_t size) {
+    return (int) ((size + ALLOC_GRAIN - 1) / ALLOC_GRAIN) - 1;
+}
+
 allocator_t *allocator_create(size_t size) {
     allocator_t *allocator;
 
@@ -31,6 +52,7 @@ allocator_t *allocator_create(size_t size) {
 
     allocator->size = size;
     allocator->used = 0;
+    spin_lock_init(&allocator->lock);
 
     pr_debug(10, "init allocator, size=%.2fMB", (double) size / (1 << 20));
 
@@ -39,14 +61,83 @@ out:
 }
 
 void allocator_destroy(allocator_t *allocator) {
+    struct free_ext *ext, *next;
+    int i;
+
+    for (i = 0; i < ALLOC_NR_CLASSES; i++) {
+        for (ext = allocator->free[i]; ext; ext = next) {
+            next = ext->next;
+            free(ext);
+        }
+    }
     free(allocator);
 }
 
 size_t allocator_alloc(allocator_t *allocator, size_t size) {
-    size_t off = xadd2(&allocator->used, size);
+    struct free_ext *ext = NULL;
+    size_t off;
+    int cls;
+
+    if (size && size <= ALLOC_MAX_RECYCLE) {
+        cls = size_class(size);
+        size = (size_t) (cls + 1) * ALLOC_GRAIN;
+
+        if (READ_ONCE(allocator->free[cls])) {
+            spin_lock(&allocator->lock);
+            ext = allocator->free[cls];
+            if (ext) {
+                allocator->free[cls] = ext->next;
+            }
+            spin_unlock(&allocator->lock);
+        }
+
+        if (ext) {
+            off = ext->off;
+            free(ext);
+            return off;
+        }
+    }
+
+    off = xadd2(&allocator->used, size);
     return off + size <= allocator->size ? off : -ENOMEM;
 }
 
+/*
+ * Mark an extent allocated by a previous run (of @size passed to allocator_alloc) as in use, for
+ * recovery. Only the bump pointer is moved past it, free space below it is not recycled.
+ */
+void allocator_mark_used(allocator_t *allocator, size_t off, size_t size) {
+    size_t end;
+
+    if (size && size <= ALLOC_MAX_RECYCLE) {
+        size = (size_t) (size_class(size) + 1) * ALLOC_GRAIN;
+    }
+
+    end = off + size;
+    spin_lock(&allocator->lock);
+    allocator->used = max(allocator->used, end);
+    spin_unlock(&allocator->lock);
+}
+
+/* @size must be the size passed to allocator_alloc (or less) */
 void allocator_free(allocator_t *allocator, size_t off, size_t size) {
-    /* FIXME: */
+    struct free_ext *ext;
+    int cls;
+
+    if (unlikely(!size || size > ALLOC_MAX_RECYCLE)) {
+        return;
+    }
+    cls = size_class(size);
+
+    ext = malloc(sizeof(*ext));
+    if (unlikely(!ext)) {
+        /* not recycled, no harm */
+        return;
+    }
+    ext->off = off;
+
+    spin_lock(&allocator->lock);
+    ext->next = allocator->free[cls];
+    allocator->free[cls] = ext;
+    spin_unlock(&allocator->lock);
 }
@@ -16,5 +16,6 @@ void allocator_destroy(allocator_t *allocator);
 
 size_t allocator_alloc(allocator_t *allocator, size_t size);
 void allocator_free(allocator_t *allocator, size_t off, size_t size);
+void allocator_mark_used(allocator_t *allocator, size_t off, size_t size);
 
 #endif //ALLOC_H
@@ -13,6 +13,7 @@
 #include <stddef.h>
 
 #include "k.h"
+#include "oplog.h"
 
 struct rpma_conf;
 
@@ -24,6 +25,9 @@ struct kv_conf {
     /* key class */
     kc_t *kc;
 
+    /* bring back the logs and data of the last run instead of starting empty */
+    bool recover;
+
     /* RPMA */
     const char *rpma_host;
     const char *rpma_dev_ip;
@@ -34,11 +38,21 @@ struct kv_conf {
     int logger_nr_shards;
     const char **logger_shard_devs;
 
+    /* shim layer */
+    /* index backend ("masstree" or "art"), NULL for the default (masstree) */
+    const char *index_backend;
+    /* max keys per inode, 0 for the compile-time maximum (INODE_FANOUT) */
+    int shim_inode_fanout;
+    /* sampled accesses per GC round that make an inode hot (0 disables hot split/cold merge) */
+    int shim_hot_inode_hits;
+
     /* data layer */
     size_t dset_bnode_size;
     size_t dset_dnode_size;
     const char *dset_bdev;
     int dset_max_gc_prefetch;
+    /* nr of dnode fingerprint arrays cached in DRAM (0 disables the cache) */
+    int dset_dnode_cache_size;
 
     /* gc config */
     bool auto_gc_logs;
@@ -46,6 +60,8 @@ struct kv_conf {
     size_t min_gc_size;
     size_t pm_high_watermark;
     size_t pm_gc_size;
+    /* nr of threads ingesting logs and GCing the shim layer in parallel (0 or 1 for the gc thread alone) */
+    int gc_nr_workers;
 };
 
 struct kv_cli_conf {
@@ -54,6 +70,15 @@ struct kv_cli_conf {
 
     /* log region size */
     size_t logger_region_size;
+
+    /* when puts are persisted, LOG_BUFFERED (0) by default */
+    log_durability_t durability;
+    /* for LOG_GROUP_COMMIT: max delay before puts are persisted, and max bytes of unpersisted logs */
+    int group_commit_us;
+    size_t group_commit_size;
+
+    /* max in-flight lookups in kv_get_batch (inter-request parallelism) */
+    int get_depth;
 };
 
 struct kv_rm_conf {
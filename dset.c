@@ -17,15 +17,27 @@
 #include <urcu.h>
 
 #include "atomic.h"
+#include "lock.h"
 #include "alloc.h"
 #include "dset.h"
 #include "shim.h"
+#include "fgprt.h"
+#include "reclaim.h"
 #include "pm.h"
 #include "k.h"
 
 #define BNULL           (-1ul)
 #define TOMBSTONE       (-1ul)
 
+#define DSET_MAGIC      0x5445534453ul
+
+/* at the start of the bnode device, roots of the bnode and dnode lists for recovery */
+struct dset_super {
+    uint64_t magic;
+    size_t sentinel_bnode;
+    rpma_ptr_t sentinel_dnode;
+};
+
 /*
  * bnode/dnode = mnode(meta node) + enode(entry node) + fnode(fence node)
  */
@@ -65,24 +77,54 @@ struct fnode {
     char fences[0];
 };
 
+/*
+ * DRAM cache of dnode fingerprint arrays, direct-mapped by dnode address. A hit lets a dnode
+ * lookup skip the mnode read and fetch the candidate entries right away (1 RTT instead of 2).
+ *
+ * Each slot has a sequence counter, odd while the slot is being written and bumped on every
+ * fill and invalidation. A lookup validates the copied fingerprints against it, and validates
+ * once more after the entries arrive, so that a dnode modified in between is detected.
+ */
+struct fcache_slot {
+    unsigned seq;
+    rpma_ptr_t dnode;
+    int nr_ents;
+    uint8_t fgprt[];
+};
+
+struct fcache {
+    int bits;
+    size_t slot_size;
+    char slots[];
+};
+
 struct dset {
     kc_t *kc;
 
     size_t sentinel_bnode;
     rpma_ptr_t sentinel_dnode;
     bool sentinel_created;
+    /* nodes of the last run are to be brought back by dset_recover */
+    bool recovering;
 
     size_t bnode_size, dnode_size;
 
     struct pm_dev *bdev;
+    struct dset_super *super;
     allocator_t *ba;
     rpma_t *rpma;
 
     size_t pm_utilization;
 
+    /* bnode splits relink neighbouring bnodes, which may be ingested by other gc workers */
+    spinlock_t split_lock;
+
     size_t pivot_bnode;
 
     int max_gc_prefetch;
+
+    int dnode_cache_size;
+    struct fcache *fcache;
 };
 
 struct dcli {
@@ -99,13 +141,34 @@ struct dcli {
 
     unsigned seed;
 
+    /* state for synchronous dset_lookup */
+    dlookup_t dl;
+
+    /* double-buffered dnode reads of range scans, see dset_scan_prefetch */
+    struct {
+        struct mnode *bufs[2];
+        rpma_ptr_t dnodes[2];
+        rpma_ticket_t tickets[2];
+        int last;
+    } scan;
+
     shim_cli_t *shim_cli;
 };
 
+enum {
+    DL_IDLE = 0,
+    DL_MNODE,
+    DL_ENTRY
+};
+
+/* max candidate entries read by a single dnode lookup round trip */
+#define DL_MAX_CANDS    4
+
 dset_t *dset_create(kc_t *kc,
                     size_t bnode_size, size_t dnode_size,
                     const char *bdev, rpma_t *rpma,
-                    int max_gc_prefetch) {
+                    int max_gc_prefetch, int dnode_cache_size, bool recover) {
+    size_t super_off;
     dset_t *dset;
 
     dset = calloc(1, sizeof(*dset));
@@ -133,10 +196,35 @@ dset_t *dset_create(kc_t *kc,
         goto out;
     }
 
+    /* the superblock comes first */
+    super_off = allocator_alloc(dset->ba, sizeof(struct dset_super));
+    bonsai_assert(super_off == 0);
+    dset->super = dset->bdev->start + super_off;
+
+    if (recover && dset->super->magic == DSET_MAGIC) {
+        /* the sentinels exist already, dset_recover brings the nodes back */
+        dset->sentinel_bnode = dset->super->sentinel_bnode;
+        dset->sentinel_dnode = dset->super->sentinel_dnode;
+        dset->sentinel_created = true;
+        dset->recovering = true;
+    } else {
+        if (recover) {
+            pr_warn("no bnodes to recover on PM device %s", bdev);
+        }
+        memset(dset->super, 0, sizeof(struct dset_super));
+        flush_range(dset->super, sizeof(struct dset_super));
+        memory_sfence();
+    }
+
     dset->rpma = rpma;
 
     dset->max_gc_prefetch = max_gc_prefetch;
 
+    spin_lock_init(&dset->split_lock);
+
+    /* dnode cache is created by the first dcli, when the dnode fanout is known */
+    dset->dnode_cache_size = dnode_cache_size;
+
     pr_debug(5, "dset created, bnode size: %lu, dnode size: %lu", bnode_size, dnode_size);
 
 out:
@@ -144,9 +232,19 @@ out:
 }
 
 void dset_destroy(dset_t *dset) {
+    free(dset->fcache);
     free(dset);
 }
 
+/* persist new list heads, the magic makes the superblock valid once there are ones */
+static inline void persist_sentinels(dset_t *dset) {
+    dset->super->sentinel_bnode = dset->sentinel_bnode;
+    dset->super->sentinel_dnode = dset->sentinel_dnode;
+    dset->super->magic = DSET_MAGIC;
+    flush_range(dset->super, sizeof(*dset->super));
+    memory_sfence();
+}
+
 static inline uint8_t get_fgprt(dcli_t *dcli, k_t k) {
     return k_hash(dcli->kc, k) & 0xff;
 }
@@ -183,6 +281,16 @@ static inline void bfree(dcli_t *dcli, void *ptr, size_t size) {
     allocator_free(dcli->dset->ba, bptr2off(dcli, ptr), size);
 }
 
+static void reclaim_bnode(void *ctx, uint64_t off, uint64_t size) {
+    dset_t *dset = ctx;
+    allocator_free(dset->ba, off, size);
+}
+
+static void reclaim_dnode(void *ctx, uint64_t off, uint64_t size) {
+    rpma_cli_t *rpma_cli = ctx;
+    rpma_free(rpma_cli, (rpma_ptr_t) { .off = off }, size);
+}
+
 static inline k_t e_key(dcli_t *dcli, const struct entry *de) {
     return (k_t) { .key = de->key, .len = de->k_len };
 }
@@ -256,7 +364,7 @@ static inline int create_sentinel(dcli_t *dcli) {
         ret = PTR_ERR(mnode);
         goto out;
     }
-    dset->sentinel_bnode = bptr2off(dcli, mnode);
+    dset->sentinel_bnode = dset->pivot_bnode = bptr2off(dcli, mnode);
 
     /* init bnode sentinel */
     fnode = get_bfnode(dcli, mnode);
@@ -270,6 +378,7 @@ static inline int create_sentinel(dcli_t *dcli) {
     flush_range(mnode, msize);
     flush_range(fnode, fsize);
     memory_sfence();
+    pm_persist_delay(dcli->bdev, msize + fsize);
 
     /* init dnode sentinel */
     ret = rpma_alloc(dcli->rpma_cli, &dset->sentinel_dnode, dcli->dnode_size + fsize);
@@ -306,6 +415,8 @@ static inline int create_sentinel(dcli_t *dcli) {
 
     rpma_buf_free(dcli->rpma_cli, mnode, msize);
 
+    persist_sentinels(dset);
+
     /* init dgroup map */
     dgroup.bnode = dset->sentinel_bnode;
     dgroup.dnode = dset->sentinel_dnode;
@@ -322,8 +433,134 @@ out:
     return ret;
 }
 
+static int fcache_create(dcli_t *dcli) {
+    dset_t *dset = dcli->dset;
+    struct fcache *fcache;
+    size_t slot_size;
+    int bits = 0;
+
+    if (!dset->dnode_cache_size || READ_ONCE(dset->fcache)) {
+        return 0;
+    }
+
+    while ((1 << bits) < dset->dnode_cache_size) {
+        bits++;
+    }
+
+    slot_size = ALIGN_UP(sizeof(struct fcache_slot) + dcli->dfanout * sizeof(uint8_t), CACHELINE_SIZE);
+
+    fcache = calloc(1, sizeof(*fcache) + (slot_size << bits));
+    if (unlikely(!fcache)) {
+        pr_err("failed to allocate memory for dnode cache");
+        return -ENOMEM;
+    }
+    fcache->bits = bits;
+    fcache->slot_size = slot_size;
+
+    if (!cmpxchg2(&dset->fcache, NULL, fcache)) {
+        /* created by another dcli */
+        free(fcache);
+    }
+
+    pr_debug(5, "dnode cache created, %d slots of %lu bytes", 1 << bits, slot_size);
+
+    return 0;
+}
+
+static inline struct fcache_slot *fcache_slot(dcli_t *dcli, rpma_ptr_t dnode) {
+    struct fcache *fcache = dcli->dset->fcache;
+    uint64_t h;
+
+    if (!fcache) {
+        return NULL;
+    }
+
+    h = fcache->bits ? (dnode.rawp * 0x9e3779b97f4a7c15ul) >> (64 - fcache->bits) : 0;
+    return (void *) fcache->slots + h * fcache->slot_size;
+}
+
+static inline bool fcache_lock_slot(struct fcache_slot *slot, unsigned seq) {
+    if ((seq & 1) || !cmpxchg2(&slot->seq, seq, seq + 1)) {
+        return false;
+    }
+    smp_wmb();
+    return true;
+}
+
+static inline void fcache_unlock_slot(struct fcache_slot *slot) {
+    smp_wmb();
+    WRITE_ONCE(slot->seq, slot->seq + 1);
+}
+
+/* copy cached fingerprints of @dl->dnode into @dl->mnode, remember slot version in @dl->fc_seq */
+static bool fcache_get(dcli_t *dcli, dlookup_t *dl) {
+    struct fcache_slot *slot = fcache_slot(dcli, dl->dnode);
+    struct mnode *mnode = dl->mnode;
+    int nr_ents;
+
+    dl->fc_seq = 1;
+    if (!slot) {
+        return false;
+    }
+
+    dl->fc_seq = READ_ONCE(slot->seq);
+    smp_rmb();
+    if ((dl->fc_seq & 1) || slot->dnode.rawp != dl->dnode.rawp) {
+        return false;
+    }
+
+    nr_ents = min(READ_ONCE(slot->nr_ents), dcli->dfanout);
+    memcpy(mnode->fgprt, slot->fgprt, nr_ents * sizeof(uint8_t));
+    mnode->nr_ents = nr_ents;
+
+    smp_rmb();
+    return READ_ONCE(slot->seq) == dl->fc_seq;
+}
+
+/* whether the slot @dl got fingerprints from (or will fill) has not changed since */
+static inline bool fcache_valid(dcli_t *dcli, dlookup_t *dl) {
+    struct fcache_slot *slot = fcache_slot(dcli, dl->dnode);
+    smp_rmb();
+    return slot && READ_ONCE(slot->seq) == dl->fc_seq;
+}
+
+/* fill with the mnode just read, unless the slot changed since the read was issued */
+static void fcache_fill(dcli_t *dcli, dlookup_t *dl) {
+    struct fcache_slot *slot = fcache_slot(dcli, dl->dnode);
+    struct mnode *mnode = dl->mnode;
+
+    if (!slot || !fcache_lock_slot(slot, dl->fc_seq)) {
+        return;
+    }
+
+    slot->dnode = dl->dnode;
+    slot->nr_ents = min(mnode->nr_ents, dcli->dfanout);
+    memcpy(slot->fgprt, mnode->fgprt, slot->nr_ents * sizeof(uint8_t));
+
+    fcache_unlock_slot(slot);
+}
+
+/* drop @dnode, and fail in-flight lookups and fills that use its slot */
+static void fcache_invalidate(dcli_t *dcli, rpma_ptr_t dnode) {
+    struct fcache_slot *slot = fcache_slot(dcli, dnode);
+
+    if (!slot) {
+        return;
+    }
+
+    while (!fcache_lock_slot(slot, READ_ONCE(slot->seq))) {
+        cpu_relax();
+    }
+
+    if (slot->dnode.rawp == dnode.rawp) {
+        slot->dnode = RPMA_NULL;
+    }
+
+    fcache_unlock_slot(slot);
+}
+
 dcli_t *dcli_create(dset_t *dset, shim_cli_t *shim_cli) {
-    size_t dstripe_size = UINT64_MAX;
+    size_t dstripe_size;
     dcli_t *dcli;
     int ret, i;
 
@@ -345,6 +582,8 @@ dcli_t *dcli_create(dset_t *dset, shim_cli_t *shim_cli) {
 
     dcli->kc = dset->kc;
 
+    /* mnode (with fingerprints) occupies the first strip of a dnode */
+    dstripe_size = rpma_get_strip_size(dcli->rpma_cli);
     dcli->dstrip_size = dstripe_size;
 
     if (unlikely(dset->dnode_size < dstripe_size)) {
@@ -377,6 +616,32 @@ dcli_t *dcli_create(dset_t *dset, shim_cli_t *shim_cli) {
 
     dcli->shim_cli = shim_cli;
 
+    ret = fcache_create(dcli);
+    if (unlikely(ret)) {
+        free(dcli);
+        dcli = ERR_PTR(ret);
+        goto out;
+    }
+
+    ret = dset_lookup_init(dcli, &dcli->dl);
+    if (unlikely(ret)) {
+        free(dcli);
+        dcli = ERR_PTR(ret);
+        goto out;
+    }
+
+    for (i = 0; i < 2; i++) {
+        dcli->scan.bufs[i] = rpma_buf_alloc(dcli->rpma_cli, dcli->dnode_size);
+        if (unlikely(IS_ERR(dcli->scan.bufs[i]))) {
+            ret = PTR_ERR(dcli->scan.bufs[i]);
+            pr_err("failed to allocate memory for scan buffer: %s", strerror(-ret));
+            free(dcli);
+            dcli = ERR_PTR(ret);
+            goto out;
+        }
+        dcli->scan.dnodes[i] = RPMA_NULL;
+    }
+
     /* create sentinel bnode and dnode if necessary */
     if (cmpxchg2(&dset->sentinel_created, false, true)) {
         ret = create_sentinel(dcli);
@@ -392,45 +657,13 @@ out:
 }
 
 void dcli_destroy(dcli_t *dcli) {
+    rpma_sync(dcli->rpma_cli);
+    rpma_buf_free(dcli->rpma_cli, dcli->scan.bufs[0], dcli->dnode_size);
+    rpma_buf_free(dcli->rpma_cli, dcli->scan.bufs[1], dcli->dnode_size);
+    dset_lookup_fini(dcli, &dcli->dl);
     free(dcli);
 }
 
-/* get mnode and enode */
-static inline struct mnode *dnode_get_mnode_enode(dcli_t *dcli, rpma_ptr_t dnode) {
-    struct mnode *mnode;
-    size_t size;
-    int ret;
-
-    size = dcli->dnode_size;
-
-    mnode = rpma_buf_alloc(dcli->rpma_cli, size);
-    if (unlikely(IS_ERR(mnode))) {
-        pr_err("failed to allocate memory for mnode: %s", strerror(-PTR_ERR(mnode)));
-        goto out;
-    }
-
-    ret = rpma_rd(dcli->rpma_cli, dnode, 0, mnode, size);
-    if (unlikely(ret < 0)) {
-        pr_err("failed to read mnode: %s", strerror(-ret));
-        rpma_buf_free(dcli->rpma_cli, mnode, size);
-        mnode = ERR_PTR(ret);
-    }
-
-    ret = rpma_commit_sync(dcli->rpma_cli);
-    if (unlikely(ret < 0)) {
-        pr_err("failed to commit mnode read: %s", strerror(-ret));
-        rpma_buf_free(dcli->rpma_cli, mnode, dcli->dstrip_size);
-        mnode = ERR_PTR(ret);
-    }
-
-out:
-    return mnode;
-}
-
-static inline void dnode_put_mnode_enode(dcli_t *dcli, struct mnode *mnode) {
-    rpma_buf_free(dcli->rpma_cli, mnode, dcli->dnode_size);
-}
-
 static inline struct mnode *dnode_get_mnode(dcli_t *dcli, rpma_ptr_t dnode) {
     struct mnode *mnode;
     size_t msize;
@@ -449,12 +682,13 @@ static inline struct mnode *dnode_get_mnode(dcli_t *dcli, rpma_ptr_t dnode) {
         pr_err("failed to read mnode: %s", strerror(-ret));
         rpma_buf_free(dcli->rpma_cli, mnode, msize);
         mnode = ERR_PTR(ret);
+        goto out;
     }
 
     ret = rpma_commit_sync(dcli->rpma_cli);
     if (unlikely(ret < 0)) {
         pr_err("failed to commit mnode read: %s", strerror(-ret));
-        rpma_buf_free(dcli->rpma_cli, mnode, dcli->dstrip_size);
+        rpma_buf_free(dcli->rpma_cli, mnode, msize);
         mnode = ERR_PTR(ret);
     }
 
@@ -486,14 +720,14 @@ static inline int dnode_get_enode_fnode(dcli_t *dcli, rpma_ptr_t dnode, struct m
     if (unlikely(ret < 0)) {
         pr_err("failed to read enode: %s", strerror(-ret));
         rpma_buf_free(dcli->rpma_cli, enode, size);
-        enode = ERR_PTR(ret);
+        goto out;
     }
 
     ret = rpma_commit_sync(dcli->rpma_cli);
     if (unlikely(ret < 0)) {
         pr_err("failed to commit enode read: %s", strerror(-ret));
-        rpma_buf_free(dcli->rpma_cli, enode, dcli->dstrip_size);
-        enode = ERR_PTR(ret);
+        rpma_buf_free(dcli->rpma_cli, enode, size);
+        goto out;
     }
 
     *enodep = enode;
@@ -520,12 +754,12 @@ static int bnode_delete(dcli_t *dcli, size_t bnode, k_t key) {
 
     /* if key exists */
     fgprt = get_fgprt(dcli, key);
-    for (idx = 0; idx < mnode->nr_ents; idx++) {
-        if (mnode->fgprt[idx] == fgprt) {
-            /* then do update */
-            get_entry(dcli, enode, idx)->valp = TOMBSTONE;
-            goto out;
-        }
+    idx = fgprt_find_first(mnode->fgprt, mnode->nr_ents, fgprt);
+    if (idx >= 0) {
+        /* then do update */
+        get_entry(dcli, enode, idx)->valp = TOMBSTONE;
+        flush_range(&get_entry(dcli, enode, idx)->valp, sizeof(uint64_t));
+        goto out;
     }
 
     ret = -ENOENT;
@@ -534,75 +768,110 @@ out:
     return ret;
 }
 
-static int dnode_lookup(dcli_t *dcli, rpma_ptr_t dnode, uint64_t fgprt, k_t key, uint64_t *valp) {
-    struct entry *entry;
-    struct mnode *mnode;
-    size_t msize;
-    int ret, i;
+/*
+ * Remote dnode lookup, as a state machine so that lookups of multiple requests can be in flight:
+ *
+ *   DL_MNODE: wait for mnode (with fingerprints), skipped if they are in the dnode cache
+ *   DL_ENTRY: wait for the next (up to DL_MAX_CANDS) candidate entries below @pos, all read
+ *             with one doorbell; candidates are tried from the latest one
+ */
+/* queue reads of the next candidate entries, return the number of them */
+static int dnode_post_cands(dcli_t *dcli, dlookup_t *dl) {
+    struct mnode *mnode = dl->mnode;
+    void *entry;
+    int ret, pos;
+
+    dl->nr_cands = 0;
+    while (dl->nr_cands < DL_MAX_CANDS) {
+        pos = fgprt_find_last(mnode->fgprt, dl->pos, dl->fgprt);
+        if (pos < 0) {
+            dl->pos = 0;
+            break;
+        }
+        dl->pos = pos;
 
-    msize = sizeof(struct mnode) + dcli->dfanout * sizeof(uint8_t);
+        entry = dl->entries + dl->nr_cands * sizeof_entry(dcli);
+        ret = rpma_rd(dcli->rpma_cli, get_dentryp(dcli, dl->dnode, dl->pos), 0, entry, sizeof_entry(dcli));
+        if (unlikely(ret < 0)) {
+            pr_err("failed to read entry: %s", strerror(-ret));
+            return ret;
+        }
+        dl->nr_cands++;
+    }
 
-    mnode = rpma_buf_alloc(dcli->rpma_cli, msize);
-    if (unlikely(IS_ERR(mnode))) {
-        pr_err("failed to allocate memory for mnode: %s", strerror(-PTR_ERR(mnode)));
-        ret = -ENOMEM;
-        goto out;
+    return dl->nr_cands;
+}
+
+static int dnode_lookup_next(dcli_t *dcli, dlookup_t *dl) {
+    rpma_ticket_t ticket;
+    int ret;
+
+    ret = dnode_post_cands(dcli, dl);
+    if (ret <= 0) {
+        return ret ? : -ENOENT;
     }
 
-    ret = rpma_rd(dcli->rpma_cli, dnode, 0, mnode, msize);
+    ticket = rpma_commit(dcli->rpma_cli);
+    if (unlikely(IS_ERR(ticket))) {
+        pr_err("failed to commit entry read: %s", strerror(-PTR_ERR(ticket)));
+        return PTR_ERR(ticket);
+    }
+
+    dl->ticket = ticket;
+    dl->state = DL_ENTRY;
+    return -EINPROGRESS;
+}
+
+/* queue the mnode read */
+static int dnode_post_mnode(dcli_t *dcli, dlookup_t *dl) {
+    size_t msize = sizeof(struct mnode) + dcli->dfanout * sizeof(uint8_t);
+    struct fcache_slot *slot;
+    int ret;
+
+    /* the fill after this read is only allowed if the slot stays unchanged */
+    slot = fcache_slot(dcli, dl->dnode);
+    dl->cached = false;
+    dl->fc_seq = slot ? READ_ONCE(slot->seq) : 1;
+    smp_rmb();
+
+    ret = rpma_rd(dcli->rpma_cli, dl->dnode, 0, dl->mnode, msize);
     if (unlikely(ret < 0)) {
         pr_err("failed to read mnode: %s", strerror(-ret));
-        rpma_buf_free(dcli->rpma_cli, mnode, msize);
-        mnode = ERR_PTR(ret);
     }
 
-    ret = rpma_commit_sync(dcli->rpma_cli);
+    return ret;
+}
+
+static int dnode_lookup_mnode(dcli_t *dcli, dlookup_t *dl) {
+    rpma_ticket_t ticket;
+    int ret;
+
+    ret = dnode_post_mnode(dcli, dl);
     if (unlikely(ret < 0)) {
-        pr_err("failed to commit mnode read: %s", strerror(-ret));
-        rpma_buf_free(dcli->rpma_cli, mnode, dcli->dstrip_size);
-        mnode = ERR_PTR(ret);
+        return ret;
     }
 
-    entry = rpma_buf_alloc(dcli->rpma_cli, sizeof_entry(dcli));
-    if (unlikely(IS_ERR(entry))) {
-        pr_err("failed to allocate memory for entry: %s", strerror(-PTR_ERR(entry)));
-        ret = -ENOMEM;
-        goto out;
+    ticket = rpma_commit(dcli->rpma_cli);
+    if (unlikely(IS_ERR(ticket))) {
+        pr_err("failed to commit mnode read: %s", strerror(-PTR_ERR(ticket)));
+        return PTR_ERR(ticket);
     }
 
-    /* lookup in reversed order to catch latest data */
-    *valp = TOMBSTONE;
+    dl->ticket = ticket;
+    dl->state = DL_MNODE;
+    return -EINPROGRESS;
+}
 
-    for (i = mnode->nr_ents - 1; i >= 0; i--) {
-        if (fgprt == mnode->fgprt[i]) {
-            ret = rpma_rd(dcli->rpma_cli, get_dentryp(dcli, dnode, i), 0, entry, sizeof_entry(dcli));
-            if (unlikely(ret < 0)) {
-                pr_err("failed to read entry: %s", strerror(-ret));
-                rpma_buf_free(dcli->rpma_cli, entry, sizeof_entry(dcli));
-                goto out;
-            }
+static int dnode_lookup_start(dcli_t *dcli, dlookup_t *dl) {
+    struct mnode *mnode = dl->mnode;
 
-            ret = rpma_commit_sync(dcli->rpma_cli);
-            if (unlikely(ret < 0)) {
-                pr_err("failed to commit entry read: %s", strerror(-ret));
-                rpma_buf_free(dcli->rpma_cli, entry, sizeof_entry(dcli));
-                goto out;
-            }
-
-            *valp = entry->valp;
-            break;
-        }
-    }
-
-    if (unlikely(*valp == TOMBSTONE)) {
-        ret = -ENOENT;
+    if (!fcache_get(dcli, dl)) {
+        return dnode_lookup_mnode(dcli, dl);
     }
 
-    rpma_buf_free(dcli->rpma_cli, entry, sizeof_entry(dcli));
-    rpma_buf_free(dcli->rpma_cli, mnode, msize);
-
-out:
-    return ret;
+    dl->cached = true;
+    dl->pos = mnode->nr_ents;
+    return dnode_lookup_next(dcli, dl);
 }
 
 static int bnode_lookup(dcli_t *dcli, size_t bnode, uint64_t fgprt, k_t key, uint64_t *valp) {
@@ -615,14 +884,13 @@ static int bnode_lookup(dcli_t *dcli, size_t bnode, uint64_t fgprt, k_t key, uin
     enode = get_benode(dcli, mnode);
 
     /* if key exists */
-    for (idx = 0; idx < mnode->nr_ents; idx++) {
-        if (mnode->fgprt[idx] == fgprt) {
-            *valp = get_entry(dcli, enode, idx)->valp;
-            if (*valp == TOMBSTONE) {
-                ret = -ENOENT;
-            }
-            goto out;
+    idx = fgprt_find_first(mnode->fgprt, min(READ_ONCE(mnode->nr_ents), dcli->bfanout), fgprt);
+    if (idx >= 0) {
+        *valp = get_entry(dcli, enode, idx)->valp;
+        if (*valp == TOMBSTONE) {
+            ret = -ENOENT;
         }
+        goto out;
     }
 
     ret = -ERANGE;
@@ -644,13 +912,13 @@ static int bnode_upsert(dcli_t *dcli, size_t bnode, k_t key, uint64_t valp) {
 
     /* if key exists */
     fgprt = get_fgprt(dcli, key);
-    for (idx = 0; idx < mnode->nr_ents; idx++) {
-        if (mnode->fgprt[idx] == fgprt) {
-            /* then do update, and set @ref flag */
-            get_entry(dcli, enode, idx)->valp = valp;
-            mnode->ref = true;
-            goto out;
-        }
+    idx = fgprt_find_first(mnode->fgprt, mnode->nr_ents, fgprt);
+    if (idx >= 0) {
+        /* then do update, and set @ref flag */
+        get_entry(dcli, enode, idx)->valp = valp;
+        flush_range(&get_entry(dcli, enode, idx)->valp, sizeof(uint64_t));
+        mnode->ref = true;
+        goto out;
     }
 
     /* find valid index */
@@ -667,9 +935,15 @@ static int bnode_upsert(dcli_t *dcli, size_t bnode, k_t key, uint64_t valp) {
     entry->k_len = key.len;
     memcpy(entry->key, key.key, key.len);
     mnode->fgprt[idx] = fgprt;
+    flush_range(entry, sizeof(*entry) + key.len);
+    flush_range(&mnode->fgprt[idx], sizeof(uint8_t));
 
-    /* make the insertion visible */
+    /*
+     * make the insertion visible, log GC fences the flushes before the heads of the ingested
+     * logs get persisted
+     */
     WRITE_ONCE(mnode->nr_ents, mnode->nr_ents + 1);
+    flush_range(&mnode->nr_ents, sizeof(mnode->nr_ents));
 
 out:
     return ret;
@@ -846,6 +1120,7 @@ static int bnode_split(dcli_t *dcli, dgroup_t dgroup, size_t *new_bnode, k_t key
     flush_range(mleft, dcli->bnode_size);
     flush_range(mright, dcli->bnode_size);
     memory_sfence();
+    pm_persist_delay(dcli->bdev, 2 * dcli->bnode_size);
 
     /* changes to next->prev can be volatile, because prev pointers can be recovered */
     if (next) {
@@ -858,8 +1133,10 @@ static int bnode_split(dcli_t *dcli, dgroup_t dgroup, size_t *new_bnode, k_t key
         flush_range(&prev->bnext, sizeof(prev->bnext));
     } else {
         dcli->dset->sentinel_bnode = bptr2off(dcli, mleft);
+        persist_sentinels(dcli->dset);
     }
     memory_sfence();
+    pm_persist_delay(dcli->bdev, sizeof(prev->bnext));
 
     /* change clock hand */
     if (dcli->dset->pivot_bnode == dgroup.bnode) {
@@ -887,7 +1164,9 @@ static int bnode_split(dcli_t *dcli, dgroup_t dgroup, size_t *new_bnode, k_t key
         *new_bnode = bptr2off(dcli, mleft);
     }
 
-    /* TODO: GC old bnode */
+    /* the old bnode is unlinked, recycle it once lock-free readers are done with it */
+    reclaim_defer(reclaim_bnode, dcli->dset, bptr2off(dcli, mnode),
+                  dcli->bnode_size + sizeof(struct fnode) + mnode->lfence_len + mnode->rfence_len);
 
     /* update statistics */
     dcli->dset->pm_utilization += 2 * (dcli->bnode_size + sizeof(struct fnode) + split_key.len);
@@ -1097,8 +1376,16 @@ static int dnode_split(dcli_t *dcli, rpma_ptr_t dnode, struct mnode *mnode) {
         }
     } else {
         dcli->dset->sentinel_dnode = left;
+        persist_sentinels(dcli->dset);
     }
 
+    /*
+     * Offsets of dnodes are recycled. A reader of the dnode that had one before may have filled
+     * its slot after that dnode was invalidated, drop it before the new dnode becomes visible.
+     */
+    fcache_invalidate(dcli, left);
+    fcache_invalidate(dcli, right);
+
     /* make new dnode visible to upper layer */
     ret = prop_update_dnode(dcli, lfence, split_key, left, dnode);
     if (unlikely(ret)) {
@@ -1111,7 +1398,11 @@ static int dnode_split(dcli_t *dcli, rpma_ptr_t dnode, struct mnode *mnode) {
         goto out;
     }
 
-    /* TODO: GC old dnode */
+    fcache_invalidate(dcli, dnode);
+
+    /* likewise for the old dnode */
+    reclaim_defer(reclaim_dnode, dcli->rpma_cli, dnode.off,
+                  dcli->dnode_size + sizeof(struct fnode) + mnode->lfence_len + mnode->rfence_len);
 
     put_order_arr(order);
 
@@ -1126,7 +1417,9 @@ int dset_upsert(dcli_t *dcli, dgroup_t dgroup, k_t key, uint64_t valp) {
     ret = bnode_upsert(dcli, bnode, key, valp);
     if (unlikely(ret == -ENOMEM)) {
         /* bnode full, split and retry */
+        spin_lock(&dcli->dset->split_lock);
         ret = bnode_split(dcli, dgroup, &bnode, key, (k_t) { });
+        spin_unlock(&dcli->dset->split_lock);
         if (unlikely(ret)) {
             pr_err("bnode split failed: %s", strerror(-ret));
             goto out;
@@ -1146,16 +1439,246 @@ int dset_delete(dcli_t *dcli, dgroup_t dgroup, k_t key) {
     return bnode_delete(dcli, dgroup.bnode, key);
 }
 
-int dset_lookup(dcli_t *dcli, dgroup_t dgroup, k_t key, uint64_t *valp) {
+int dset_lookup_init(dcli_t *dcli, dlookup_t *dl) {
+    size_t msize = sizeof(struct mnode) + dcli->dfanout * sizeof(uint8_t);
+
+    dl->state = DL_IDLE;
+
+    dl->mnode = rpma_buf_alloc(dcli->rpma_cli, msize);
+    if (unlikely(IS_ERR(dl->mnode))) {
+        pr_err("failed to allocate memory for mnode: %s", strerror(-PTR_ERR(dl->mnode)));
+        return PTR_ERR(dl->mnode);
+    }
+
+    dl->entries = rpma_buf_alloc(dcli->rpma_cli, DL_MAX_CANDS * sizeof_entry(dcli));
+    if (unlikely(IS_ERR(dl->entries))) {
+        pr_err("failed to allocate memory for entries: %s", strerror(-PTR_ERR(dl->entries)));
+        rpma_buf_free(dcli->rpma_cli, dl->mnode, msize);
+        return PTR_ERR(dl->entries);
+    }
+
+    return 0;
+}
+
+void dset_lookup_fini(dcli_t *dcli, dlookup_t *dl) {
+    size_t msize = sizeof(struct mnode) + dcli->dfanout * sizeof(uint8_t);
+
+    bonsai_assert(dl->state == DL_IDLE);
+
+    rpma_buf_free(dcli->rpma_cli, dl->entries, DL_MAX_CANDS * sizeof_entry(dcli));
+    rpma_buf_free(dcli->rpma_cli, dl->mnode, msize);
+}
+
+int dset_lookup_start(dcli_t *dcli, dgroup_t dgroup, k_t key, uint64_t *valp, dlookup_t *dl) {
     uint64_t fgprt = get_fgprt(dcli, key);
     int ret;
 
+    bonsai_assert(dl->state == DL_IDLE);
+
     ret = bnode_lookup(dcli, dgroup.bnode, fgprt, key, valp);
     if (ret == -ERANGE) {
-        ret = dnode_lookup(dcli, dgroup.dnode, fgprt, key, valp);
+        dl->key = key;
+        dl->fgprt = fgprt;
+        dl->dnode = dgroup.dnode;
+        ret = dnode_lookup_start(dcli, dl);
+    }
+
+    if (ret != -EINPROGRESS) {
+        dl->state = DL_IDLE;
+    }
+
+    return ret;
+}
+
+int dset_lookup_resume(dcli_t *dcli, dlookup_t *dl, uint64_t *valp) {
+    struct mnode *mnode = dl->mnode;
+    struct entry *entry;
+    int ret, i;
+
+    ret = rpma_poll(dcli->rpma_cli, dl->ticket);
+    if (!ret) {
+        return -EINPROGRESS;
+    }
+    if (unlikely(ret < 0)) {
+        pr_err("dnode read failed: %s", strerror(-ret));
+        goto out;
+    }
+
+    switch (dl->state) {
+        case DL_MNODE:
+            fcache_fill(dcli, dl);
+            dl->pos = min(mnode->nr_ents, dcli->dfanout);
+            ret = dnode_lookup_next(dcli, dl);
+            break;
+
+        case DL_ENTRY:
+            if (dl->cached && !fcache_valid(dcli, dl)) {
+                /* dnode changed since we got its fingerprints, read them again */
+                ret = dnode_lookup_mnode(dcli, dl);
+                break;
+            }
+            for (i = 0; i < dl->nr_cands; i++) {
+                entry = dl->entries + i * sizeof_entry(dcli);
+                if (!k_cmp(dcli->kc, dl->key, e_key(dcli, entry))) {
+                    *valp = entry->valp;
+                    ret = *valp == TOMBSTONE ? -ENOENT : 0;
+                    goto out;
+                }
+            }
+            /* fingerprint collisions, try older candidates */
+            ret = dnode_lookup_next(dcli, dl);
+            break;
+
+        default:
+            bonsai_assert(0);
+    }
+
+out:
+    if (ret != -EINPROGRESS) {
+        dl->state = DL_IDLE;
+    }
+    return ret;
+}
+
+int dset_lookup(dcli_t *dcli, dgroup_t dgroup, k_t key, uint64_t *valp) {
+    dlookup_t *dl = &dcli->dl;
+    int ret;
+
+    ret = dset_lookup_start(dcli, dgroup, key, valp, dl);
+    while (ret == -EINPROGRESS) {
+        rpma_wait(dcli->rpma_cli, dl->ticket);
+        ret = dset_lookup_resume(dcli, dl, valp);
+    }
+
+    return ret;
+}
+
+/*
+ * Batched lookup: candidates of all keys are read in one chain. Keys sharing a dnode read its
+ * mnode only once, and all mnodes that miss the dnode cache are read in one chain beforehand.
+ */
+int dset_multi_lookup(dcli_t *dcli, const dgroup_t *dgroups, const k_t *keys, int n,
+                      uint64_t *vals, int *rets, dlookup_t *dls) {
+    size_t msize = sizeof(struct mnode) + dcli->dfanout * sizeof(uint8_t);
+    int i, ret = 0, lead = -1, nr_mnodes = 0, nr_ents = 0;
+    rpma_ticket_t ticket;
+    dlookup_t *dl;
+
+    /* bnode lookups, then find fingerprints of each dnode to search */
+    for (i = 0; i < n; i++) {
+        if (rets[i] != -ERANGE) {
+            continue;
+        }
+
+        dl = &dls[i];
+        dl->state = DL_IDLE;
+        dl->key = keys[i];
+        dl->fgprt = get_fgprt(dcli, keys[i]);
+        dl->dnode = dgroups[i].dnode;
+
+        rets[i] = bnode_lookup(dcli, dgroups[i].bnode, dl->fgprt, keys[i], &vals[i]);
+        if (rets[i] != -ERANGE) {
+            continue;
+        }
+
+        if (lead >= 0 && dls[lead].dnode.rawp == dl->dnode.rawp) {
+            /* fingerprints are copied from the lead once known */
+            continue;
+        }
+        lead = i;
+
+        if (fcache_get(dcli, dl)) {
+            dl->cached = true;
+            continue;
+        }
+
+        ret = dnode_post_mnode(dcli, dl);
+        if (unlikely(ret < 0)) {
+            goto out;
+        }
+        dl->state = DL_MNODE;
+        nr_mnodes++;
+    }
+
+    if (nr_mnodes) {
+        ret = rpma_commit_sync(dcli->rpma_cli);
+        if (unlikely(ret < 0)) {
+            pr_err("failed to commit mnode reads: %s", strerror(-ret));
+            goto out;
+        }
+    }
+
+    /* read candidate entries of all keys */
+    lead = -1;
+    for (i = 0; i < n; i++) {
+        if (rets[i] != -ERANGE) {
+            continue;
+        }
+
+        dl = &dls[i];
+        if (lead >= 0 && dls[lead].dnode.rawp == dl->dnode.rawp) {
+            memcpy(dl->mnode, dls[lead].mnode, msize);
+            dl->cached = dls[lead].cached;
+            dl->fc_seq = dls[lead].fc_seq;
+        } else {
+            lead = i;
+            if (dl->state == DL_MNODE) {
+                fcache_fill(dcli, dl);
+            }
+        }
+
+        dl->pos = min(((struct mnode *) dl->mnode)->nr_ents, dcli->dfanout);
+        ret = dnode_post_cands(dcli, dl);
+        if (unlikely(ret < 0)) {
+            goto out;
+        }
+        if (!ret) {
+            dl->state = DL_IDLE;
+            rets[i] = -ENOENT;
+            continue;
+        }
+        dl->state = DL_ENTRY;
+        nr_ents++;
+    }
+
+    if (!nr_ents) {
+        goto out;
+    }
+
+    ticket = rpma_commit(dcli->rpma_cli);
+    if (unlikely(IS_ERR(ticket))) {
+        ret = PTR_ERR(ticket);
+        pr_err("failed to commit entry reads: %s", strerror(-ret));
+        goto out;
+    }
+
+    /* match the entries, rare cases (collisions, changed dnodes) continue one key at a time */
+    for (i = 0; i < n; i++) {
+        dl = &dls[i];
+        if (dl->state != DL_ENTRY) {
+            continue;
+        }
+
+        dl->ticket = ticket;
+        do {
+            rpma_wait(dcli->rpma_cli, dl->ticket);
+            rets[i] = dset_lookup_resume(dcli, dl, &vals[i]);
+        } while (rets[i] == -EINPROGRESS);
     }
 
+    ret = 0;
+
 out:
+    if (unlikely(ret < 0)) {
+        /* drain what has been posted, and fail the keys still pending */
+        rpma_sync(dcli->rpma_cli);
+        for (i = 0; i < n; i++) {
+            if (rets[i] == -ERANGE || dls[i].state != DL_IDLE) {
+                dls[i].state = DL_IDLE;
+                rets[i] = ret;
+            }
+        }
+    }
     return ret;
 }
 
@@ -1267,6 +1790,9 @@ retry:
         goto retry;
     }
 
+    /* lookups that start from now on will not trust cached fingerprints of this dnode */
+    fcache_invalidate(dcli, dnode);
+
     /* write dnode data */
     ret = rpma_wr_(dcli->rpma_cli, de_tail, bufs, 0);
     if (unlikely(ret < 0)) {
@@ -1293,6 +1819,9 @@ retry:
         goto out;
     }
 
+    /* drop fingerprints cached by lookups that raced with the write */
+    fcache_invalidate(dcli, dnode);
+
     free(bufs);
 
 out:
@@ -1318,6 +1847,123 @@ out:
     return ret;
 }
 
+/*
+ * Move on to the dnode after *@dmnode (the sentinel one if NULL), and take its extent out of the
+ * RPMA allocator, which starts empty. Returns -ENOENT past the last dnode.
+ */
+static int recover_next_dnode(dcli_t *dcli, rpma_ptr_t *dnode, struct mnode **dmnode,
+                              struct enode **denode, struct fnode **dfnode) {
+    rpma_ptr_t next = *dmnode ? (*dmnode)->dnext : dcli->dset->sentinel_dnode;
+    int ret;
+
+    if (*dmnode) {
+        dnode_put_enode_fnode(dcli, *dmnode, *denode);
+        dnode_put_mnode(dcli, *dmnode);
+        *dmnode = NULL;
+    }
+
+    if (next.rawp == RPMA_NULL.rawp) {
+        return -ENOENT;
+    }
+
+    *dmnode = dnode_get_mnode(dcli, next);
+    if (unlikely(IS_ERR(*dmnode))) {
+        ret = PTR_ERR(*dmnode);
+        *dmnode = NULL;
+        pr_err("failed to get mnode: %s", strerror(-ret));
+        return ret;
+    }
+    ret = dnode_get_enode_fnode(dcli, next, *dmnode, denode, dfnode);
+    if (unlikely(ret)) {
+        dnode_put_mnode(dcli, *dmnode);
+        *dmnode = NULL;
+        pr_err("failed to get enode / fnode: %s", strerror(-ret));
+        return ret;
+    }
+
+    rpma_mark_used(dcli->rpma_cli, next,
+                   dcli->dnode_size + sizeof(struct fnode) + (*dmnode)->lfence_len + (*dmnode)->rfence_len);
+    *dnode = next;
+
+    return 0;
+}
+
+/*
+ * Bring back the bnodes of the last run: walk the bnode list from the sentinel, restoring the
+ * (volatile) prev links and the allocator, and map each bnode with the dnode covering it into
+ * the shim layer. Dnodes stay on the memory node, which is expected to outlive the crash, and
+ * are only taken out of the (volatile) RPMA allocator again.
+ */
+int dset_recover(dcli_t *dcli) {
+    struct mnode *mnode, *dmnode = NULL;
+    size_t bnode, prev = BNULL, size;
+    dset_t *dset = dcli->dset;
+    struct enode *denode = NULL;
+    struct fnode *fnode, *dfnode;
+    k_t lfence, rfence;
+    rpma_ptr_t dnode;
+    dgroup_t dgroup;
+    int ret = 0, nr = 0;
+
+    if (!dset->recovering) {
+        goto out;
+    }
+
+    for (bnode = dset->sentinel_bnode; bnode != BNULL; prev = bnode, bnode = mnode->bnext) {
+        mnode = boff2ptr(dcli, bnode);
+        fnode = get_bfnode(dcli, mnode);
+        lfence = get_lfence(dcli, mnode, fnode);
+        rfence = get_rfence(dcli, mnode, fnode);
+
+        mnode->bprev = prev;
+
+        size = dcli->bnode_size + sizeof(struct fnode) + mnode->lfence_len + mnode->rfence_len;
+        allocator_mark_used(dset->ba, bnode, size);
+        dset->pm_utilization += size;
+
+        /* dnodes split along bnode fences, find the one covering this bnode */
+        while (!dmnode || k_cmp(dcli->kc, lfence, get_rfence(dcli, dmnode, dfnode)) >= 0) {
+            ret = recover_next_dnode(dcli, &dnode, &dmnode, &denode, &dfnode);
+            if (unlikely(ret == -ENOENT)) {
+                ret = -EINVAL;
+                pr_err("bnode %s is beyond the last dnode", k_str(dcli->kc, lfence));
+            }
+            if (unlikely(ret)) {
+                goto out;
+            }
+        }
+
+        dgroup.bnode = bnode;
+        dgroup.dnode = dnode;
+        ret = shim_update_dgroup(dcli->shim_cli, lfence, rfence, dgroup);
+        if (unlikely(ret)) {
+            pr_err("failed to update dgroup map: %s", strerror(-ret));
+            goto out;
+        }
+
+        nr++;
+    }
+
+    /* dnodes past the last bnode (if any) are in use all the same */
+    while (!(ret = recover_next_dnode(dcli, &dnode, &dmnode, &denode, &dfnode)));
+    if (unlikely(ret != -ENOENT)) {
+        goto out;
+    }
+    ret = 0;
+
+    dset->pivot_bnode = dset->sentinel_bnode;
+    dset->recovering = false;
+
+    pr_debug(5, "recovered %d bnodes (%.2fMB)", nr, (double) dset->pm_utilization / (1 << 20));
+
+out:
+    if (dmnode) {
+        dnode_put_enode_fnode(dcli, dmnode, denode);
+        dnode_put_mnode(dcli, dmnode);
+    }
+    return ret;
+}
+
 static cJSON *bnode_dump(dcli_t *dcli, size_t bnode) {
     cJSON *out, *entries, *entry;
     struct mnode *mnode;
@@ -1432,14 +2078,122 @@ cJSON *dset_dump(dcli_t *dcli) {
     return out;
 }
 
-int dset_scan(dcli_t *dcli, dgroup_t dgroup) {
-    rpma_ptr_t dnode = dgroup.dnode;
+void dset_scan_begin(dcli_t *dcli) {
+    int i;
+
+    /* buffered dnodes of the last scan may be stale now */
+    for (i = 0; i < 2; i++) {
+        if (dcli->scan.dnodes[i].rawp != RPMA_NULL.rawp) {
+            rpma_wait(dcli->rpma_cli, dcli->scan.tickets[i]);
+            dcli->scan.dnodes[i] = RPMA_NULL;
+        }
+    }
+}
+
+static inline int scan_buf_of(dcli_t *dcli, rpma_ptr_t dnode) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (dcli->scan.dnodes[i].rawp == dnode.rawp) {
+            return i;
+        }
+    }
+
+    return -ENOENT;
+}
+
+int dset_scan_prefetch(dcli_t *dcli, dgroup_t dgroup) {
+    rpma_ticket_t ticket;
+    int b, ret;
+
+    if (scan_buf_of(dcli, dgroup.dnode) >= 0) {
+        return 0;
+    }
+
+    /* reuse the buffer not read most recently, which holds the dnode consumed already */
+    b = dcli->scan.last ^ 1;
+    if (dcli->scan.dnodes[b].rawp != RPMA_NULL.rawp) {
+        rpma_wait(dcli->rpma_cli, dcli->scan.tickets[b]);
+        dcli->scan.dnodes[b] = RPMA_NULL;
+    }
+
+    ret = rpma_rd(dcli->rpma_cli, dgroup.dnode, 0, dcli->scan.bufs[b], dcli->dnode_size);
+    if (unlikely(ret < 0)) {
+        pr_err("failed to read dnode: %s", strerror(-ret));
+        return ret;
+    }
+
+    ticket = rpma_commit(dcli->rpma_cli);
+    if (unlikely(IS_ERR(ticket))) {
+        pr_err("failed to commit dnode read: %s", strerror(-PTR_ERR(ticket)));
+        return PTR_ERR(ticket);
+    }
+
+    dcli->scan.dnodes[b] = dgroup.dnode;
+    dcli->scan.tickets[b] = ticket;
+    dcli->scan.last = b;
+
+    return 0;
+}
+
+static inline bool key_in_range(dcli_t *dcli, k_t key, k_t lo, const k_t *hi) {
+    return k_cmp(dcli->kc, key, lo) >= 0 && (!hi || k_cmp(dcli->kc, key, *hi) < 0);
+}
+
+/*
+ * Feed entries of @dgroup within [@lo, @hi) to @scanner (no upper bound if @hi is NULL), newer
+ * versions of a key come first: bnode entries, then dnode entries from the latest one.
+ */
+int dset_scan(dcli_t *dcli, dgroup_t dgroup, k_t lo, const k_t *hi, dset_scanner scanner, void *priv) {
     struct mnode *mnode;
-    int nr;
+    struct enode *enode;
+    struct entry *entry;
+    int idx, nr, b, ret;
 
-    mnode = dnode_get_mnode_enode(dcli, dnode);
-    nr = mnode->nr_ents;
-    dnode_put_mnode(dcli, mnode);
+    /* bnode entries */
+    mnode = boff2ptr(dcli, dgroup.bnode);
+    enode = get_benode(dcli, mnode);
+    nr = min(READ_ONCE(mnode->nr_ents), dcli->bfanout);
+    for (idx = 0; idx < nr; idx++) {
+        entry = get_entry(dcli, enode, idx);
+        if (!key_in_range(dcli, e_key(dcli, entry), lo, hi)) {
+            continue;
+        }
+        ret = scanner(e_key(dcli, entry), entry->valp, entry->valp == TOMBSTONE, priv);
+        if (ret) {
+            goto out;
+        }
+    }
 
-    return nr;
+    /* dnode entries, normally prefetched */
+    ret = dset_scan_prefetch(dcli, dgroup);
+    if (unlikely(ret)) {
+        goto out;
+    }
+    b = scan_buf_of(dcli, dgroup.dnode);
+    ret = rpma_wait(dcli->rpma_cli, dcli->scan.tickets[b]);
+    if (unlikely(ret < 0)) {
+        pr_err("dnode read failed: %s", strerror(-ret));
+        dcli->scan.dnodes[b] = RPMA_NULL;
+        goto out;
+    }
+
+    mnode = dcli->scan.bufs[b];
+    enode = get_denode(dcli, mnode);
+    nr = min(mnode->nr_ents, dcli->dfanout);
+    for (idx = nr - 1; idx >= 0; idx--) {
+        entry = get_entry(dcli, enode, idx);
+        if (!key_in_range(dcli, e_key(dcli, entry), lo, hi)) {
+            continue;
+        }
+        ret = scanner(e_key(dcli, entry), entry->valp, entry->valp == TOMBSTONE, priv);
+        if (ret) {
+            goto out;
+        }
+    }
+
+    ret = 0;
+
+out:
+    return ret;
 }
@@ -33,12 +33,26 @@ typedef struct dgroup dgroup_t;
 typedef struct dcli dcli_t;
 typedef struct dset dset_t;
 
+/* in-flight dset lookup, see dset_lookup_start */
+typedef struct dlookup {
+    int state;
+    k_t key;
+    uint8_t fgprt;
+    int pos, nr_cands;
+    rpma_ptr_t dnode;
+    rpma_ticket_t ticket;
+    /* fingerprints taken from the dnode cache, valid while its slot stays at @fc_seq */
+    bool cached;
+    unsigned fc_seq;
+    void *mnode, *entries;
+} dlookup_t;
+
 struct shim_cli;
 
 dset_t *dset_create(kc_t *kc,
                     size_t bnode_size, size_t dnode_size,
                     const char *bdev, rpma_t *rpma,
-                    int max_gc_prefetch);
+                    int max_gc_prefetch, int dnode_cache_size, bool recover);
 void dset_destroy(dset_t *dset);
 
 dcli_t *dcli_create(dset_t *dset, struct shim_cli *shim_cli);
@@ -47,12 +61,42 @@ void dcli_destroy(dcli_t *dcli);
 int dset_upsert(dcli_t *dcli, dgroup_t dgroup, k_t key, uint64_t valp);
 int dset_delete(dcli_t *dcli, dgroup_t dgroup, k_t key);
 int dset_lookup(dcli_t *dcli, dgroup_t dgroup, k_t key, uint64_t *valp);
-int dset_scan(dcli_t *dcli, dgroup_t dgroup);
+
+/*
+ * Pipelined lookup: dset_lookup_start returns -EINPROGRESS if @key has to be fetched from the
+ * remote dnode tier. The lookup then proceeds (without blocking) on each dset_lookup_resume,
+ * until it returns something other than -EINPROGRESS. @key must stay valid until then.
+ */
+int dset_lookup_init(dcli_t *dcli, dlookup_t *dl);
+void dset_lookup_fini(dcli_t *dcli, dlookup_t *dl);
+int dset_lookup_start(dcli_t *dcli, dgroup_t dgroup, k_t key, uint64_t *valp, dlookup_t *dl);
+int dset_lookup_resume(dcli_t *dcli, dlookup_t *dl, uint64_t *valp);
+
+/*
+ * Batched lookup of @n keys in key order, @dgroups[i] being the dgroup of @keys[i]. Only keys
+ * with @rets[i] == -ERANGE are looked up, using @dls[i] as their lookup state.
+ */
+int dset_multi_lookup(dcli_t *dcli, const dgroup_t *dgroups, const k_t *keys, int n,
+                      uint64_t *vals, int *rets, dlookup_t *dls);
+
+/*
+ * Range scan of a dgroup, @scanner returns non-zero to stop the scan. Keys passed to @scanner
+ * stay valid until the second next dset_scan_prefetch. dset_scan_prefetch starts reading the
+ * dnode of @dgroup in background, so that it is ready when its dset_scan comes.
+ */
+typedef int dset_scanner(k_t key, uint64_t valp, bool deleted, void *priv);
+
+void dset_scan_begin(dcli_t *dcli);
+int dset_scan_prefetch(dcli_t *dcli, dgroup_t dgroup);
+int dset_scan(dcli_t *dcli, dgroup_t dgroup, k_t lo, const k_t *hi, dset_scanner scanner, void *priv);
 
 size_t dset_get_pm_utilization(dcli_t *dcli);
 
 int dset_gc(dcli_t *dcli, size_t *gc_size);
 
+/* with dset created to recover, bring back the nodes of the last run into the shim layer */
+int dset_recover(dcli_t *dcli);
+
 cJSON *dset_dump(dcli_t *dcli);
 
 #ifndef DSET_SOURCE
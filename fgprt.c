@@ -0,0 +1,123 @@
+/*
+ * BonsaiKV+: Scaling persistent in-memory key-value store for modern tiered, heterogeneous memory systems
+ *
+ * Vectorized fingerprint probing
+ *
+ * Hohai University
+ */
+
+#define _GNU_SOURCE
+
+#include "utils.h"
+#include "fgprt.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static const char *probe_isa = "scalar";
+
+static uint64_t probe_scalar(const uint8_t *fgprts, int n, uint8_t fgprt) {
+    uint64_t mask = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        mask |= (uint64_t) (fgprts[i] == fgprt) << i;
+    }
+
+    return mask;
+}
+
+#if defined(__x86_64__)
+
+/*
+ * For SSE2/AVX2, a partial vector at the end is handled by one more load ending exactly at
+ * @fgprts[n - 1] (overlapping the previous one), so that nothing beyond the array is read.
+ */
+
+static uint64_t probe_sse2(const uint8_t *fgprts, int n, uint8_t fgprt) {
+    __m128i v = _mm_set1_epi8((char) fgprt);
+    uint64_t mask = 0;
+    int i;
+
+    if (unlikely(n < 16)) {
+        return probe_scalar(fgprts, n, fgprt);
+    }
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        mask |= (uint64_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const void *) (fgprts + i)), v)) << i;
+    }
+    if (i < n) {
+        i = n - 16;
+        mask |= (uint64_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const void *) (fgprts + i)), v)) << i;
+    }
+
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t probe_avx2(const uint8_t *fgprts, int n, uint8_t fgprt) {
+    __m256i v = _mm256_set1_epi8((char) fgprt);
+    uint64_t mask = 0;
+    int i;
+
+    if (unlikely(n < 32)) {
+        return probe_sse2(fgprts, n, fgprt);
+    }
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        mask |= (uint64_t) (uint32_t) _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const void *) (fgprts + i)), v)) << i;
+    }
+    if (i < n) {
+        i = n - 32;
+        mask |= (uint64_t) (uint32_t) _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const void *) (fgprts + i)), v)) << i;
+    }
+
+    return mask;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t probe_avx512(const uint8_t *fgprts, int n, uint8_t fgprt) {
+    /* masked load: bytes beyond @n are neither read nor compared */
+    __mmask64 valid = n == 64 ? ~0ull : (1ull << n) - 1;
+    __m512i f = _mm512_maskz_loadu_epi8(valid, fgprts);
+    return _mm512_mask_cmpeq_epi8_mask(valid, f, _mm512_set1_epi8((char) fgprt));
+}
+
+#endif
+
+static uint64_t probe_resolve(const uint8_t *fgprts, int n, uint8_t fgprt) {
+    fgprt_probe_t *impl = probe_scalar;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        impl = probe_avx512;
+        probe_isa = "avx512bw";
+    } else if (__builtin_cpu_supports("avx2")) {
+        impl = probe_avx2;
+        probe_isa = "avx2";
+    } else {
+        impl = probe_sse2;
+        probe_isa = "sse2";
+    }
+#endif
+
+    pr_debug(5, "fingerprint probe uses %s", probe_isa);
+
+    /* racing resolvers pick the same implementation */
+    WRITE_ONCE(fgprt_probe_impl, impl);
+
+    return impl(fgprts, n, fgprt);
+}
+
+fgprt_probe_t *fgprt_probe_impl = probe_resolve;
+
+const char *fgprt_probe_isa(void) {
+    if (fgprt_probe_impl == probe_resolve) {
+        fgprt_probe(NULL, 0, 0);
+    }
+    return probe_isa;
+}
@@ -0,0 +1,66 @@
+/*
+ * BonsaiKV+: Scaling persistent in-memory key-value store for modern tiered, heterogeneous memory systems
+ *
+ * Vectorized fingerprint probing
+ *
+ * Inodes, bnodes and dnodes keep one-byte key fingerprints in an array. A probe compares a whole
+ * run of them at once and returns a bitmap of the matching positions, which the caller masks with
+ * its valid bitmap (if any) and walks with ffs/fls. The implementation (AVX-512BW, AVX2, SSE2 or
+ * scalar) is picked at the first probe according to the running CPU.
+ *
+ * Hohai University
+ */
+
+#ifndef FGPRT_H
+#define FGPRT_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+/* max fingerprints per probe */
+#define FGPRT_PROBE_MAX     64
+
+typedef uint64_t fgprt_probe_t(const uint8_t *fgprts, int n, uint8_t fgprt);
+
+extern fgprt_probe_t *fgprt_probe_impl;
+
+/* bitmap of positions in @fgprts[0, @n) holding @fgprt, @n <= FGPRT_PROBE_MAX */
+static inline uint64_t fgprt_probe(const uint8_t *fgprts, int n, uint8_t fgprt) {
+    return fgprt_probe_impl(fgprts, n, fgprt);
+}
+
+/* first position in @fgprts[0, @n) holding @fgprt, -ENOENT if none */
+static inline int fgprt_find_first(const uint8_t *fgprts, int n, uint8_t fgprt) {
+    uint64_t mask;
+    int base;
+
+    for (base = 0; base < n; base += FGPRT_PROBE_MAX) {
+        mask = fgprt_probe(fgprts + base, min(n - base, FGPRT_PROBE_MAX), fgprt);
+        if (mask) {
+            return base + __builtin_ctzll(mask);
+        }
+    }
+
+    return -ENOENT;
+}
+
+/* last position in @fgprts[0, @n) holding @fgprt, -ENOENT if none */
+static inline int fgprt_find_last(const uint8_t *fgprts, int n, uint8_t fgprt) {
+    uint64_t mask;
+    int base;
+
+    for (; n > 0; n = base) {
+        base = max(n - FGPRT_PROBE_MAX, 0);
+        mask = fgprt_probe(fgprts + base, n - base, fgprt);
+        if (mask) {
+            return base + 63 - __builtin_clzll(mask);
+        }
+    }
+
+    return -ENOENT;
+}
+
+const char *fgprt_probe_isa(void);
+
+#endif //FGPRT_H
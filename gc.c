@@ -3,6 +3,11 @@
  *
  * BonsaiKV+ GC/Checkpoint
  *
+ * Log ingestion and shim GC are range-partitioned: the key space is cut into one range per gc
+ * worker, and each worker scans, ingests and GCs the inodes of its own range with its own
+ * clients. Cut points are picked from the inode fences sampled in the previous round, and then
+ * moved to a dgroup boundary, so that no bnode is ingested by two workers.
+ *
  * Hohai University
  */
 
@@ -10,11 +15,38 @@
 
 #include <urcu.h>
 
+#include "reclaim.h"
 #include "oplog.h"
 #include "shim.h"
 #include "dset.h"
 #include "gc.h"
 
+/* inode fences sampled per worker in each round */
+#define GC_NR_SAMPLES       1024
+
+enum gc_phase {
+    GC_INGEST = 0,
+    GC_SHIM,
+    GC_EXIT
+};
+
+struct gc_worker {
+    gc_cli_t *gc_cli;
+    int id;
+
+    pthread_t thread;
+
+    shim_cli_t *shim_cli;
+    logger_cli_t *logger_cli;
+    dcli_t *dcli;
+
+    /* every @every-th inode fence seen in the last shim GC */
+    k_t samples[GC_NR_SAMPLES];
+    char *sample_buf;
+    int nr_samples, every;
+    long nr_seen;
+};
+
 struct gc_cli {
     kc_t *kc;
 
@@ -31,20 +63,29 @@ struct gc_cli {
     size_t pm_high_watermark, pm_gc_size;
 
     bool gc_logs_invoked, gc_pm_invoked;
+
+    /* worker #i owns [bounds[i - 1], bounds[i]), with -inf and +inf at both ends */
+    int nr_workers, nr_ranges;
+    struct gc_worker *workers;
+    k_t bounds[GC_MAX_WORKERS];
+    char *bound_buf;
+
+    enum gc_phase phase;
+    pthread_barrier_t start, done;
 };
 
-static int ingest_log(gc_cli_t *gc_cli, op_t op, dgroup_t dgroup, k_t key, uint64_t valp) {
+static int ingest_log(struct gc_worker *w, op_t op, dgroup_t dgroup, k_t key, uint64_t valp) {
     int ret;
 
-    pr_debug(30, "start ingest log with op=%d, k=%s, v=%lx", op, k_str(gc_cli->kc, key), valp);
+    pr_debug(30, "start ingest log with op=%d, k=%s, v=%lx", op, k_str(w->gc_cli->kc, key), valp);
 
     switch (op) {
         case OP_PUT:
-            ret = dset_upsert(gc_cli->dcli, dgroup, key, valp);
+            ret = dset_upsert(w->dcli, dgroup, key, valp);
             break;
 
         case OP_DEL:
-            ret = dset_delete(gc_cli->dcli, dgroup, key);
+            ret = dset_delete(w->dcli, dgroup, key);
             break;
 
         default:
@@ -55,13 +96,13 @@ static int ingest_log(gc_cli_t *gc_cli, op_t op, dgroup_t dgroup, k_t key, uint6
 }
 
 static int scanner(uint64_t oplog, dgroup_t dgroup, void *priv) {
-    gc_cli_t *gc_cli = priv;
+    struct gc_worker *w = priv;
     uint64_t valp;
     k_t key;
     op_t op;
     int ret;
 
-    op = logger_get(gc_cli->logger_cli, oplog, &key, &valp);
+    op = logger_get(w->logger_cli, oplog, &key, &valp);
     if (unlikely(op < 0)) {
         ret = op;
         pr_err("logger_get failed with %d(%s)", ret, strerror(-ret));
@@ -73,7 +114,7 @@ static int scanner(uint64_t oplog, dgroup_t dgroup, void *priv) {
         goto out;
     }
 
-    ret = ingest_log(gc_cli, op, dgroup, key, valp);
+    ret = ingest_log(w, op, dgroup, key, valp);
     if (unlikely(ret)) {
         pr_err("ingest_log failed with %d(%s)", ret, strerror(-ret));
     }
@@ -82,12 +123,166 @@ out:
     return ret;
 }
 
+static void sample_fence(k_t fence, void *priv) {
+    struct gc_worker *w = priv;
+    int i;
+
+    if (w->nr_seen++ % w->every) {
+        return;
+    }
+
+    /* out of room, keep every other sample and halve the sample rate */
+    if (unlikely(w->nr_samples == GC_NR_SAMPLES)) {
+        for (i = 0; i < GC_NR_SAMPLES / 2; i++) {
+            memcpy(w->samples[i].key, w->samples[2 * i].key, w->samples[2 * i].len);
+            w->samples[i].len = w->samples[2 * i].len;
+        }
+        w->nr_samples = GC_NR_SAMPLES / 2;
+        w->every *= 2;
+
+        if ((w->nr_seen - 1) % w->every) {
+            return;
+        }
+    }
+
+    memcpy(w->samples[w->nr_samples].key, fence.key, fence.len);
+    w->samples[w->nr_samples].len = fence.len;
+    w->nr_samples++;
+}
+
+static inline const k_t *range_lo(gc_cli_t *gc_cli, int i) {
+    return i ? &gc_cli->bounds[i - 1] : NULL;
+}
+
+static inline const k_t *range_hi(gc_cli_t *gc_cli, int i) {
+    return i < gc_cli->nr_ranges - 1 ? &gc_cli->bounds[i] : NULL;
+}
+
+static void run_phase(struct gc_worker *w, enum gc_phase phase) {
+    gc_cli_t *gc_cli = w->gc_cli;
+    const k_t *lo, *hi;
+
+    if (w->id >= gc_cli->nr_ranges) {
+        w->nr_samples = 0;
+        return;
+    }
+
+    lo = range_lo(gc_cli, w->id);
+    hi = range_hi(gc_cli, w->id);
+
+    reclaim_read_lock();
+
+    switch (phase) {
+        case GC_INGEST:
+            /* scan the shim layer to fetch and ingest each op */
+            shim_scan_logs_range(w->shim_cli, lo, hi, scanner, w);
+            break;
+
+        case GC_SHIM:
+            w->nr_samples = 0;
+            w->nr_seen = 0;
+            w->every = 1;
+            shim_gc_range(w->shim_cli, lo, hi, sample_fence, w);
+            break;
+
+        default:
+            bonsai_assert(0);
+    }
+
+    reclaim_read_unlock();
+}
+
+static void *gc_worker_thread(void *arg) {
+    struct gc_worker *w = arg;
+    gc_cli_t *gc_cli = w->gc_cli;
+    enum gc_phase phase;
+
+    reclaim_thread_init();
+    shim_thread_init(w->shim_cli);
+
+    pr_debug(5, "gc worker #%d enter", w->id);
+
+    for (;;) {
+        pthread_barrier_wait(&gc_cli->start);
+
+        phase = READ_ONCE(gc_cli->phase);
+        if (phase == GC_EXIT) {
+            break;
+        }
+
+        run_phase(w, phase);
+
+        pthread_barrier_wait(&gc_cli->done);
+    }
+
+    pr_debug(5, "gc worker #%d exit", w->id);
+
+    return NULL;
+}
+
+static void run_workers(gc_cli_t *gc_cli, enum gc_phase phase) {
+    WRITE_ONCE(gc_cli->phase, phase);
+    pthread_barrier_wait(&gc_cli->start);
+    if (phase != GC_EXIT) {
+        pthread_barrier_wait(&gc_cli->done);
+    }
+}
+
+/* cut the key space at the weighted quantiles of the fences sampled by the workers */
+static void partition(gc_cli_t *gc_cli) {
+    uint64_t total = 0, acc = 0;
+    int i, j, nb = 0, ret;
+    struct gc_worker *w;
+    k_t *bound;
+
+    for (i = 0; i < gc_cli->nr_workers; i++) {
+        w = &gc_cli->workers[i];
+        total += (uint64_t) w->nr_samples * w->every;
+    }
+
+    reclaim_read_lock();
+
+    for (i = 0; i < gc_cli->nr_workers && nb < gc_cli->nr_workers - 1; i++) {
+        w = &gc_cli->workers[i];
+
+        for (j = 0; j < w->nr_samples && nb < gc_cli->nr_workers - 1; j++) {
+            acc += w->every;
+            if (acc * gc_cli->nr_workers < (nb + 1) * total) {
+                continue;
+            }
+
+            /* ranges must not share a dgroup */
+            bound = &gc_cli->bounds[nb];
+            ret = shim_next_dgroup_fence(gc_cli->shim_cli, w->samples[j],
+                                         gc_cli->bound_buf + nb * gc_cli->kc->max_len, bound);
+            if (ret == -ENOENT) {
+                goto out;
+            }
+            if (nb && k_cmp(gc_cli->kc, *bound, gc_cli->bounds[nb - 1]) <= 0) {
+                continue;
+            }
+            nb++;
+        }
+    }
+
+out:
+    reclaim_read_unlock();
+
+    gc_cli->nr_ranges = nb + 1;
+
+    pr_debug(20, "gc key space cut into %d ranges", gc_cli->nr_ranges);
+}
+
 static void ingest_until_barrier(gc_cli_t *gc_cli, logger_barrier_t *barrier) {
     /* prefetch logs into in-DRAM array */
     logger_prefetch_until_barrier(barrier);
 
-    /* scan the shim layer to fetch and ingest each op */
-    shim_scan_logs(gc_cli->shim_cli, scanner, gc_cli);
+    if (gc_cli->nr_workers > 1) {
+        partition(gc_cli);
+        run_workers(gc_cli, GC_INGEST);
+    } else {
+        run_phase(&gc_cli->workers[0], GC_INGEST);
+    }
 }
 
 static void *gc_thread(void *arg) {
@@ -96,6 +291,9 @@ static void *gc_thread(void *arg) {
     size_t total, gc_size;
     int ret;
 
+    reclaim_thread_init();
+    shim_thread_init(gc_cli->shim_cli);
+
     gc_cli->tid = current_tid();
 
     pr_debug(5, "gc thread enter");
@@ -103,11 +301,16 @@ static void *gc_thread(void *arg) {
     while (!READ_ONCE(gc_cli->exit)) {
         /* snapshot current log tail */
         barrier = logger_snap_barrier(gc_cli->logger_cli, &total);
+        if (unlikely(IS_ERR(barrier))) {
+            continue;
+        }
         if (unlikely(!total)) {
+            logger_destroy_barrier(barrier);
             continue;
         }
         if (likely(!gc_cli->gc_logs_invoked)) {
             if (gc_cli->auto_gc_logs && total < gc_cli->min_gc_size) {
+                logger_destroy_barrier(barrier);
                 continue;
             }
         } else {
@@ -125,10 +328,21 @@ static void *gc_thread(void *arg) {
 
         /* gc until current log tail */
         logger_gc_before_barrier(barrier);
-        logger_destroy_barrier(barrier);
 
-        /* GC shim layer */
-        shim_gc(gc_cli->shim_cli);
+        /* GC shim layer, which drops all references to stale logs */
+        if (gc_cli->nr_workers > 1) {
+            run_workers(gc_cli, GC_SHIM);
+        } else {
+            /* merged inodes are retired while we still walk them, as in run_phase */
+            reclaim_read_lock();
+            shim_gc(gc_cli->shim_cli);
+            reclaim_read_unlock();
+        }
+
+        /* wait for lock-free readers of stale logs, then let writers reuse their space */
+        synchronize_rcu();
+        logger_reclaim_before_barrier(barrier);
+        logger_destroy_barrier(barrier);
 
         /* invoke GC from LPM to RPM when LPM too large or manually invoked */
         if (unlikely(gc_cli->gc_pm_invoked ||
@@ -147,18 +361,91 @@ static void *gc_thread(void *arg) {
         }
     }
 
+    if (gc_cli->nr_workers > 1) {
+        run_workers(gc_cli, GC_EXIT);
+    }
+
     pr_debug(5, "gc thread exit");
 
     return NULL;
 }
 
-gc_cli_t *gc_cli_create(kc_t *kc,
-                        logger_cli_t *logger_cli, shim_cli_t *shim_cli, dcli_t *dcli,
+static int create_workers(gc_cli_t *gc_cli, logger_cli_t **logger_clis, shim_cli_t **shim_clis, dcli_t **dclis) {
+    int nr_workers = gc_cli->nr_workers, i, j, ret = 0;
+    /* a single worker runs in the gc thread with clients #0 */
+    int base = nr_workers > 1;
+    struct gc_worker *w;
+
+    gc_cli->workers = calloc(nr_workers, sizeof(*gc_cli->workers));
+    gc_cli->bound_buf = malloc(nr_workers * gc_cli->kc->max_len);
+    if (unlikely(!gc_cli->workers || !gc_cli->bound_buf)) {
+        ret = -ENOMEM;
+        pr_err("failed to allocate gc workers");
+        goto out;
+    }
+
+    for (i = 0; i < nr_workers; i++) {
+        w = &gc_cli->workers[i];
+
+        w->gc_cli = gc_cli;
+        w->id = i;
+        w->logger_cli = logger_clis[base + i];
+        w->shim_cli = shim_clis[base + i];
+        w->dcli = dclis[base + i];
+        w->every = 1;
+
+        if (!base) {
+            continue;
+        }
+
+        w->sample_buf = malloc(GC_NR_SAMPLES * gc_cli->kc->max_len);
+        if (unlikely(!w->sample_buf)) {
+            ret = -ENOMEM;
+            pr_err("failed to allocate gc worker samples");
+            goto out;
+        }
+        for (j = 0; j < GC_NR_SAMPLES; j++) {
+            w->samples[j].key = w->sample_buf + j * gc_cli->kc->max_len;
+        }
+    }
+
+    if (!base) {
+        goto out;
+    }
+
+    pthread_barrier_init(&gc_cli->start, NULL, nr_workers + 1);
+    pthread_barrier_init(&gc_cli->done, NULL, nr_workers + 1);
+
+    for (i = 0; i < nr_workers; i++) {
+        w = &gc_cli->workers[i];
+
+        ret = pthread_create(&w->thread, NULL, gc_worker_thread, w);
+        if (unlikely(ret)) {
+            ret = -ret;
+            pr_err("failed to create gc worker: %s", strerror(-ret));
+            goto out;
+        }
+
+        pthread_setname_np(w->thread, "bonsai-gc-worker");
+    }
+
+out:
+    return ret;
+}
+
+gc_cli_t *gc_cli_create(kc_t *kc, int nr_workers,
+                        logger_cli_t **logger_clis, shim_cli_t **shim_clis, dcli_t **dclis,
                         bool auto_gc_logs, bool auto_gc_pm,
                         size_t min_gc_size, size_t pm_high_watermark, size_t pm_gc_size) {
     gc_cli_t *gc_cli;
     int ret;
 
+    if (unlikely(nr_workers <= 0 || nr_workers > GC_MAX_WORKERS)) {
+        gc_cli = ERR_PTR(-EINVAL);
+        pr_err("invalid nr of gc workers: %d", nr_workers);
+        goto out;
+    }
+
     gc_cli = calloc(1, sizeof(gc_cli_t));
     if (unlikely(!gc_cli)) {
         gc_cli = ERR_PTR(-ENOMEM);
@@ -168,9 +455,9 @@ gc_cli_t *gc_cli_create(kc_t *kc,
 
     gc_cli->kc = kc;
 
-    gc_cli->logger_cli = logger_cli;
-    gc_cli->shim_cli = shim_cli;
-    gc_cli->dcli = dcli;
+    gc_cli->logger_cli = logger_clis[0];
+    gc_cli->shim_cli = shim_clis[0];
+    gc_cli->dcli = dclis[0];
 
     gc_cli->auto_gc_logs = auto_gc_logs;
     gc_cli->auto_gc_pm = auto_gc_pm;
@@ -178,6 +465,16 @@ gc_cli_t *gc_cli_create(kc_t *kc,
     gc_cli->pm_high_watermark = pm_high_watermark;
     gc_cli->pm_gc_size = pm_gc_size;
 
+    /* nothing sampled yet, the first round goes to worker #0 */
+    gc_cli->nr_workers = nr_workers;
+    gc_cli->nr_ranges = 1;
+
+    ret = create_workers(gc_cli, logger_clis, shim_clis, dclis);
+    if (unlikely(ret)) {
+        gc_cli = ERR_PTR(ret);
+        goto out;
+    }
+
     ret = pthread_create(&gc_cli->gc_thread, NULL, gc_thread, gc_cli);
     if (unlikely(ret)) {
         gc_cli = ERR_PTR(-ret);
@@ -191,18 +488,31 @@ gc_cli_t *gc_cli_create(kc_t *kc,
         cpu_relax();
     }
 
-    pr_debug(5, "gc created, tid=%d", gc_cli->tid);
+    pr_debug(5, "gc created, tid=%d, %d workers", gc_cli->tid, nr_workers);
 
 out:
     return gc_cli;
 }
 
 void gc_cli_destroy(gc_cli_t *gc_cli) {
+    int i;
+
     pr_debug(5, "destroy gc");
 
     gc_cli->exit = true;
     pthread_join(gc_cli->gc_thread, NULL);
 
+    if (gc_cli->nr_workers > 1) {
+        for (i = 0; i < gc_cli->nr_workers; i++) {
+            pthread_join(gc_cli->workers[i].thread, NULL);
+            free(gc_cli->workers[i].sample_buf);
+        }
+        pthread_barrier_destroy(&gc_cli->start);
+        pthread_barrier_destroy(&gc_cli->done);
+    }
+
+    free(gc_cli->bound_buf);
+    free(gc_cli->workers);
     free(gc_cli);
 }
 
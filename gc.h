@@ -11,10 +11,17 @@
 
 #include "rpm.h"
 
+/* max nr of gc workers, each one ingests and GCs its own key range */
+#define GC_MAX_WORKERS      64
+
 typedef struct gc_cli gc_cli_t;
 
-gc_cli_t *gc_cli_create(kc_t *kc,
-                        logger_cli_t *logger_cli, shim_cli_t *shim_cli, dcli_t *dcli,
+/*
+ * Clients #0 are used by the gc thread, clients #1 to #@nr_workers by the gc workers. With a
+ * single worker, the gc thread does all the work on its own and only clients #0 are needed.
+ */
+gc_cli_t *gc_cli_create(kc_t *kc, int nr_workers,
+                        logger_cli_t **logger_clis, shim_cli_t **shim_clis, dcli_t **dclis,
                         bool auto_gc_logs, bool auto_gc_pm,
                         size_t min_gc_size, size_t pm_high_watermark, size_t pm_gc_size);
 void gc_cli_destroy(gc_cli_t *gc_cli);
@@ -0,0 +1,46 @@
+/*
+ * BonsaiKV+: Scaling persistent in-memory key-value store for modern tiered, heterogeneous memory systems
+ *
+ * Index backend registry
+ *
+ * Hohai University
+ */
+
+#define _GNU_SOURCE
+
+#include "utils.h"
+#include "index.h"
+
+static const index_ops_t *backends[] = {
+    /* the first one is the default */
+    &index_mt_ops,
+    &index_art_ops
+};
+
+index_t *index_create(const char *backend, kc_t *kc) {
+    const index_ops_t *ops = NULL;
+    index_t *index;
+    int i;
+
+    for (i = 0; i < ARRAY_LEN(backends) && !ops; i++) {
+        if (!backend || !strcmp(backend, backends[i]->name)) {
+            ops = backends[i];
+        }
+    }
+    if (unlikely(!ops)) {
+        index = ERR_PTR(-ENOENT);
+        pr_err("unknown index backend %s", backend);
+        goto out;
+    }
+
+    index = ops->create(kc);
+    if (unlikely(IS_ERR(index))) {
+        pr_err("failed to create %s index: %s", ops->name, strerror(-PTR_ERR(index)));
+        goto out;
+    }
+
+    pr_debug(5, "index created, backend: %s", ops->name);
+
+out:
+    return index;
+}
@@ -3,6 +3,9 @@
  *
  * BonsaiKV+ volatile index layer
  *
+ * The index maps the left fence of each inode to the inode. It is pluggable: a backend provides
+ * an index_ops table, and embeds index_t as the first member of its own index structure.
+ *
  * Hohai University
  */
 
@@ -14,12 +17,53 @@
 
 #include "k.h"
 
-typedef void index_t;
+typedef struct index index_t;
+typedef struct index_ops index_ops_t;
+
+struct index_ops {
+    const char *name;
+
+    index_t *(*create)(kc_t *kc);
+    void (*destroy)(index_t *index);
+    /* called by each thread before its first index access */
+    void (*thread_init)(index_t *index);
+
+    int (*upsert)(index_t *index, k_t key, void *val);
+    int (*remove)(index_t *index, k_t key);
+    /* value of the greatest key not above @key, ERR_PTR(-ENOENT) if none */
+    void *(*find_first_ge)(index_t *index, k_t key);
+};
+
+struct index {
+    const index_ops_t *ops;
+};
+
+/* masstree, any keys */
+extern const index_ops_t index_mt_ops;
+/* adaptive radix tree, fixed-width keys of up to 8 bytes in big-endian order */
+extern const index_ops_t index_art_ops;
+
+/* create an index with backend @backend (NULL for the default) */
+index_t *index_create(const char *backend, kc_t *kc);
+
+static inline void index_destroy(index_t *index) {
+    index->ops->destroy(index);
+}
+
+static inline void index_thread_init(index_t *index) {
+    index->ops->thread_init(index);
+}
+
+static inline int index_upsert(index_t *index, k_t key, void *val) {
+    return index->ops->upsert(index, key, val);
+}
+
+static inline int index_remove(index_t *index, k_t key) {
+    return index->ops->remove(index, key);
+}
 
-index_t *index_create();
-void index_destroy(index_t *index);
-int index_upsert(index_t *index, k_t key, void *val);
-int index_remove(index_t *index, k_t key);
-void *index_find_first_ge(index_t *index, k_t key);
+static inline void *index_find_first_ge(index_t *index, k_t key) {
+    return index->ops->find_first_ge(index, key);
+}
 
 #endif //INDEX_H
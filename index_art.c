@@ -0,0 +1,580 @@
+/*
+ * BonsaiKV+: Scaling persistent in-memory key-value store for modern tiered, heterogeneous memory systems
+ *
+ * Adaptive radix tree index for fixed-width integer keys
+ *
+ * Keys (up to 8 bytes, zero-padded, ordered as big-endian integers) are dispatched a byte at a
+ * time. Inner nodes hold 4, 16 or 48 children in key order, or 256 children indexed by byte, and
+ * grow or shrink between these sizes as children come and go. A subtree with a single key is a
+ * leaf, and a node with a single child is replaced by the child: each node keeps the depth it
+ * dispatches at and the key bits above it (its prefix), so that chains of one-child nodes never
+ * exist.
+ *
+ * Lookups are lock-free and run within reclaim read-side sections. Updates are serialized by a
+ * spinlock, and never change a sorted node in place except for replacing one child pointer:
+ * inserting into or removing from a sorted node publishes a modified copy, and the old node is
+ * retired through reclaim_defer. 256-way nodes have their slots set and cleared in place.
+ *
+ * Hohai University
+ */
+
+#define _GNU_SOURCE
+
+#include <endian.h>
+
+#include "utils.h"
+#include "list.h"
+#include "lock.h"
+#include "index.h"
+#include "reclaim.h"
+
+#define ART_KEY_LEN     8
+
+/* child pointers with the low bit set point to leaves */
+#define ART_LEAF_BIT    1ul
+
+enum {
+    ART_N4 = 0,
+    ART_N16,
+    ART_N48,
+    ART_N256,
+    NR_ART_TYPES
+};
+
+static const int art_caps[NR_ART_TYPES] = { 4, 16, 48, 256 };
+
+struct art_leaf {
+    uint64_t key;
+    void *val;
+};
+
+struct art_node {
+    uint8_t type;
+    /* the key byte this node dispatches on */
+    uint8_t depth;
+    uint16_t nr;
+    /* key bits above @depth shared by the whole subtree */
+    uint64_t prefix;
+    /* sorted nodes: slots[cap] followed by the key bytes of slots, in key order */
+    void *slots[];
+};
+
+struct art_index {
+    index_t base;
+
+    void *root;
+    spinlock_t lock;
+};
+
+static inline bool is_leaf(void *p) {
+    return (uintptr_t) p & ART_LEAF_BIT;
+}
+
+static inline struct art_leaf *to_leaf(void *p) {
+    return (struct art_leaf *) ((uintptr_t) p & ~ART_LEAF_BIT);
+}
+
+static inline void *leaf_ptr(struct art_leaf *leaf) {
+    return (void *) ((uintptr_t) leaf | ART_LEAF_BIT);
+}
+
+static inline uint8_t byte_at(uint64_t key, int depth) {
+    return key >> (56 - 8 * depth);
+}
+
+/* the key bits above @depth */
+static inline uint64_t prefix_of(uint64_t key, int depth) {
+    return depth ? key & (~0ul << (64 - 8 * depth)) : 0;
+}
+
+static inline uint8_t *node_keys(struct art_node *node) {
+    return (uint8_t *) (node->slots + art_caps[node->type]);
+}
+
+static inline int to_int(k_t key, uint64_t *v) {
+    uint64_t buf = 0;
+
+    if (unlikely(key.len > ART_KEY_LEN)) {
+        return -EINVAL;
+    }
+
+    memcpy(&buf, key.key, key.len);
+    *v = be64toh(buf);
+
+    return 0;
+}
+
+static void art_free(void *ctx, uint64_t a, uint64_t b) {
+    free(ctx);
+}
+
+static inline void retire(void *p) {
+    reclaim_defer(art_free, is_leaf(p) ? (void *) to_leaf(p) : p, 0, 0);
+}
+
+static struct art_node *node_alloc(int type, int depth, uint64_t prefix) {
+    struct art_node *node;
+    size_t size;
+
+    size = sizeof(*node) + art_caps[type] * sizeof(void *);
+    if (type != ART_N256) {
+        size += art_caps[type];
+    }
+
+    node = calloc(1, size);
+    if (unlikely(!node)) {
+        return NULL;
+    }
+
+    node->type = type;
+    node->depth = depth;
+    node->prefix = prefix;
+
+    return node;
+}
+
+/* the slot of child @b in @node, NULL if none */
+static inline void **node_find(struct art_node *node, uint8_t b) {
+    uint8_t *keys;
+    int i;
+
+    if (node->type == ART_N256) {
+        return READ_ONCE(node->slots[b]) ? &node->slots[b] : NULL;
+    }
+
+    keys = node_keys(node);
+    for (i = 0; i < node->nr && keys[i] <= b; i++) {
+        if (keys[i] == b) {
+            return &node->slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* the greatest leaf of the subtree at @p */
+static struct art_leaf *max_leaf(void *p) {
+    struct art_leaf *leaf = NULL;
+    struct art_node *node;
+    int i;
+
+    if (!p || is_leaf(p)) {
+        return p ? to_leaf(p) : NULL;
+    }
+
+    node = p;
+    if (node->type == ART_N256) {
+        for (i = 255; i >= 0 && !leaf; i--) {
+            leaf = max_leaf(READ_ONCE(node->slots[i]));
+        }
+    } else {
+        for (i = node->nr - 1; i >= 0 && !leaf; i--) {
+            leaf = max_leaf(READ_ONCE(node->slots[i]));
+        }
+    }
+
+    return leaf;
+}
+
+/* the greatest leaf not above @key of the subtree at @p */
+static struct art_leaf *floor_leaf(void *p, uint64_t key) {
+    struct art_leaf *leaf = NULL;
+    struct art_node *node;
+    uint64_t prefix;
+    uint8_t *keys, b;
+    int i;
+
+    if (!p) {
+        return NULL;
+    }
+
+    if (is_leaf(p)) {
+        leaf = to_leaf(p);
+        return leaf->key <= key ? leaf : NULL;
+    }
+
+    node = p;
+
+    /* the whole subtree is either below or above @key */
+    prefix = prefix_of(key, node->depth);
+    if (prefix != node->prefix) {
+        return prefix > node->prefix ? max_leaf(node) : NULL;
+    }
+
+    b = byte_at(key, node->depth);
+
+    if (node->type == ART_N256) {
+        leaf = floor_leaf(READ_ONCE(node->slots[b]), key);
+        for (i = b - 1; i >= 0 && !leaf; i--) {
+            leaf = max_leaf(READ_ONCE(node->slots[i]));
+        }
+        return leaf;
+    }
+
+    keys = node_keys(node);
+    for (i = node->nr - 1; i >= 0 && keys[i] > b; i--);
+    if (i >= 0 && keys[i] == b) {
+        leaf = floor_leaf(READ_ONCE(node->slots[i]), key);
+        i--;
+    }
+    for (; i >= 0 && !leaf; i--) {
+        leaf = max_leaf(READ_ONCE(node->slots[i]));
+    }
+
+    return leaf;
+}
+
+/* a copy of @node of type @type, with child @b set to @child (or dropped if NULL) */
+static struct art_node *node_copy(struct art_node *node, int type, uint8_t b, void *child) {
+    uint8_t *keys, *new_keys;
+    struct art_node *new;
+    int i, n = 0, nr;
+    bool placed = false;
+    void *slot;
+
+    new = node_alloc(type, node->depth, node->prefix);
+    if (unlikely(!new)) {
+        return NULL;
+    }
+    new_keys = type == ART_N256 ? NULL : node_keys(new);
+
+#define emit(k, c)  do {                        \
+        if (type == ART_N256) {                 \
+            new->slots[k] = (c);                \
+        } else {                                \
+            new_keys[n] = (k);                  \
+            new->slots[n] = (c);                \
+        }                                       \
+        n++;                                    \
+    } while (0)
+
+    nr = node->type == ART_N256 ? 256 : node->nr;
+    keys = node->type == ART_N256 ? NULL : node_keys(node);
+
+    for (i = 0; i < nr; i++) {
+        uint8_t k = keys ? keys[i] : i;
+
+        slot = node->slots[i];
+        if (!slot) {
+            continue;
+        }
+        if (!placed && k >= b) {
+            placed = true;
+            if (child) {
+                emit(b, child);
+            }
+            if (k == b) {
+                continue;
+            }
+        }
+        emit(k, slot);
+    }
+    if (!placed && child) {
+        emit(b, child);
+    }
+
+#undef emit
+
+    new->nr = n;
+
+    return new;
+}
+
+/* a node holding @a and @b (subtrees with key or prefix @ka and @kb), which first differ at byte @depth */
+static struct art_node *node_pair(uint64_t ka, void *a, uint64_t kb, void *b, int depth) {
+    struct art_node *node;
+    uint8_t *keys;
+    int lo = ka > kb;
+
+    node = node_alloc(ART_N4, depth, prefix_of(ka, depth));
+    if (unlikely(!node)) {
+        return NULL;
+    }
+
+    keys = node_keys(node);
+    keys[lo] = byte_at(ka, depth);
+    keys[!lo] = byte_at(kb, depth);
+    node->slots[lo] = a;
+    node->slots[!lo] = b;
+    node->nr = 2;
+
+    return node;
+}
+
+static inline int first_diff(uint64_t a, uint64_t b) {
+    return __builtin_clzll(a ^ b) / 8;
+}
+
+static struct art_leaf *leaf_alloc(uint64_t key, void *val) {
+    struct art_leaf *leaf;
+
+    leaf = malloc(sizeof(*leaf));
+    if (likely(leaf)) {
+        leaf->key = key;
+        leaf->val = val;
+    }
+
+    return leaf;
+}
+
+/* make @p visible to lock-free lookups at *@ref, after its contents */
+static inline void publish(void **ref, void *p) {
+    smp_wmb();
+    WRITE_ONCE(*ref, p);
+}
+
+static int do_upsert(struct art_index *art, uint64_t key, void *val) {
+    void **ref = &art->root, **cref, *p;
+    struct art_node *node, *new;
+    struct art_leaf *leaf;
+    uint64_t pkey;
+    int type;
+    uint8_t b;
+
+    for (;;) {
+        p = *ref;
+
+        if (!p) {
+            leaf = leaf_alloc(key, val);
+            if (unlikely(!leaf)) {
+                return -ENOMEM;
+            }
+            publish(ref, leaf_ptr(leaf));
+            return 0;
+        }
+
+        if (is_leaf(p)) {
+            leaf = to_leaf(p);
+            if (leaf->key == key) {
+                WRITE_ONCE(leaf->val, val);
+                return 0;
+            }
+            pkey = leaf->key;
+            break;
+        }
+
+        node = p;
+        if (prefix_of(key, node->depth) != node->prefix) {
+            pkey = node->prefix;
+            break;
+        }
+
+        b = byte_at(key, node->depth);
+        cref = node_find(node, b);
+        if (cref) {
+            ref = cref;
+            continue;
+        }
+
+        leaf = leaf_alloc(key, val);
+        if (unlikely(!leaf)) {
+            return -ENOMEM;
+        }
+
+        if (node->type == ART_N256) {
+            publish(&node->slots[b], leaf_ptr(leaf));
+            node->nr++;
+            return 0;
+        }
+
+        type = node->nr < art_caps[node->type] ? node->type : node->type + 1;
+        new = node_copy(node, type, b, leaf_ptr(leaf));
+        if (unlikely(!new)) {
+            free(leaf);
+            return -ENOMEM;
+        }
+        publish(ref, new);
+        retire(node);
+        return 0;
+    }
+
+    /* @key parts from the subtree at @p here, hang both below a new node */
+    leaf = leaf_alloc(key, val);
+    if (unlikely(!leaf)) {
+        return -ENOMEM;
+    }
+    new = node_pair(pkey, p, key, leaf_ptr(leaf), first_diff(pkey, key));
+    if (unlikely(!new)) {
+        free(leaf);
+        return -ENOMEM;
+    }
+    publish(ref, new);
+
+    return 0;
+}
+
+static int do_remove(struct art_index *art, uint64_t key) {
+    void **ref = &art->root, **cref, *p, *child;
+    struct art_node *node, *new;
+    uint8_t b;
+    int type;
+
+    p = *ref;
+    if (!p) {
+        return -ENOENT;
+    }
+
+    if (is_leaf(p)) {
+        if (to_leaf(p)->key != key) {
+            return -ENOENT;
+        }
+        publish(ref, NULL);
+        retire(p);
+        return 0;
+    }
+
+    for (;;) {
+        node = p;
+        if (prefix_of(key, node->depth) != node->prefix) {
+            return -ENOENT;
+        }
+
+        b = byte_at(key, node->depth);
+        cref = node_find(node, b);
+        if (!cref) {
+            return -ENOENT;
+        }
+
+        child = *cref;
+        if (!is_leaf(child)) {
+            ref = cref;
+            p = child;
+            continue;
+        }
+        if (to_leaf(child)->key != key) {
+            return -ENOENT;
+        }
+        break;
+    }
+
+    if (node->nr == 2) {
+        /* the other child takes the place of @node */
+        publish(ref, node->slots[cref == &node->slots[0]]);
+        retire(node);
+    } else if (node->type == ART_N256 && node->nr - 1 > art_caps[ART_N48]) {
+        WRITE_ONCE(*cref, NULL);
+        node->nr--;
+    } else {
+        type = node->type;
+        if (type > ART_N4 && node->nr - 1 <= art_caps[type - 1]) {
+            type--;
+        }
+        new = node_copy(node, type, b, NULL);
+        if (unlikely(!new)) {
+            return -ENOMEM;
+        }
+        publish(ref, new);
+        retire(node);
+    }
+
+    retire(child);
+
+    return 0;
+}
+
+static void free_subtree(void *p) {
+    struct art_node *node;
+    int i, nr;
+
+    if (!p || is_leaf(p)) {
+        free(p ? to_leaf(p) : NULL);
+        return;
+    }
+
+    node = p;
+    nr = node->type == ART_N256 ? 256 : node->nr;
+    for (i = 0; i < nr; i++) {
+        free_subtree(node->slots[i]);
+    }
+    free(node);
+}
+
+static index_t *art_create(kc_t *kc) {
+    struct art_index *art;
+
+    if (unlikely(kc->max_len > ART_KEY_LEN)) {
+        pr_err("keys of up to %d bytes only, got %lu", ART_KEY_LEN, kc->max_len);
+        return ERR_PTR(-EINVAL);
+    }
+
+    art = calloc(1, sizeof(*art));
+    if (unlikely(!art)) {
+        return ERR_PTR(-ENOMEM);
+    }
+
+    art->base.ops = &index_art_ops;
+    spin_lock_init(&art->lock);
+
+    return &art->base;
+}
+
+static void art_destroy(index_t *index) {
+    struct art_index *art = container_of(index, struct art_index, base);
+
+    free_subtree(art->root);
+    free(art);
+}
+
+static void art_thread_init(index_t *index) {
+    /* nothing per-thread */
+}
+
+static int art_upsert(index_t *index, k_t key, void *val) {
+    struct art_index *art = container_of(index, struct art_index, base);
+    uint64_t k;
+    int ret;
+
+    ret = to_int(key, &k);
+    if (unlikely(ret)) {
+        return ret;
+    }
+
+    spin_lock(&art->lock);
+    ret = do_upsert(art, k, val);
+    spin_unlock(&art->lock);
+
+    return ret;
+}
+
+static int art_remove(index_t *index, k_t key) {
+    struct art_index *art = container_of(index, struct art_index, base);
+    uint64_t k;
+    int ret;
+
+    ret = to_int(key, &k);
+    if (unlikely(ret)) {
+        return ret;
+    }
+
+    spin_lock(&art->lock);
+    ret = do_remove(art, k);
+    spin_unlock(&art->lock);
+
+    return ret;
+}
+
+static void *art_find_first_ge(index_t *index, k_t key) {
+    struct art_index *art = container_of(index, struct art_index, base);
+    struct art_leaf *leaf;
+    uint64_t k;
+    int ret;
+
+    ret = to_int(key, &k);
+    if (unlikely(ret)) {
+        return ERR_PTR(ret);
+    }
+
+    leaf = floor_leaf(READ_ONCE(art->root), k);
+
+    return leaf ? READ_ONCE(leaf->val) : ERR_PTR(-ENOENT);
+}
+
+const index_ops_t index_art_ops = {
+    .name = "art",
+    .create = art_create,
+    .destroy = art_destroy,
+    .thread_init = art_thread_init,
+    .upsert = art_upsert,
+    .remove = art_remove,
+    .find_first_ge = art_find_first_ge
+};
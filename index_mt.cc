@@ -26,6 +26,7 @@
 extern "C" {
 
 #include "utils.h"
+#include "index.h"
 #include "k.h"
 
 }
@@ -33,8 +34,6 @@ extern "C" {
 relaxed_atomic<mrcu_epoch_type> globalepoch = { 1 };
 relaxed_atomic<mrcu_epoch_type> active_epoch = { 1 };
 
-typedef void index_t;
-
 struct table_params : Masstree::nodeparams<> {
     using value_type = void *;
     using value_print_type = Masstree::value_print<value_type>;
@@ -55,6 +54,7 @@ static std::atomic<int> thread_id(0);
 static __thread table_params::threadinfo_type *ti = nullptr;
 
 struct mt_index {
+    index_t base;
     table_type tab;
 };
 
@@ -75,18 +75,17 @@ private:
     void **val;
 };
 
-extern "C" {
-
-index_t *index_create() {
+static index_t *mt_create(kc_t *kc) {
     auto *mti = new mt_index;
+    mti->base.ops = &index_mt_ops;
     bonsai_assert(!ti);
     int cur = thread_id++;
     ti = threadinfo::make(threadinfo::TI_MAIN, cur);
     mti->tab.initialize(*ti);
-    return mti;
+    return &mti->base;
 }
 
-void index_thread_init(index_t *index) {
+static void mt_thread_init(index_t *index) {
     if (ti) {
         return;
     }
@@ -95,12 +94,12 @@ void index_thread_init(index_t *index) {
     pr_debug(10, "masstree index thread init (thread id: %d)", cur);
 }
 
-void index_destroy(index_t *index) {
-    delete static_cast<mt_index *>(index);
+static void mt_destroy(index_t *index) {
+    delete reinterpret_cast<mt_index *>(index);
 }
 
-int index_upsert(index_t *index, k_t key, void *val) {
-    auto *mti = static_cast<mt_index *>(index);
+static int mt_upsert(index_t *index, k_t key, void *val) {
+    auto *mti = reinterpret_cast<mt_index *>(index);
     cursor_type lp(mti->tab, key.key, key.len);
     lp.find_insert(*ti);
     lp.value() = val;
@@ -109,8 +108,8 @@ int index_upsert(index_t *index, k_t key, void *val) {
     return 0;
 }
 
-int index_remove(index_t *index, k_t key) {
-    auto *mti = static_cast<mt_index *>(index);
+static int mt_remove(index_t *index, k_t key) {
+    auto *mti = reinterpret_cast<mt_index *>(index);
     cursor_type lp(mti->tab, key.key, key.len);
     if (unlikely(!lp.find_locked(*ti))) {
         lp.finish(0, *ti);
@@ -120,8 +119,8 @@ int index_remove(index_t *index, k_t key) {
     return 0;
 }
 
-void *index_find_first_ge(index_t *index, k_t key) {
-    auto *mti = static_cast<mt_index *>(index);
+static void *mt_find_first_ge(index_t *index, k_t key) {
+    auto *mti = reinterpret_cast<mt_index *>(index);
     void *val = ERR_PTR(-ENOENT);
     auto k = Str(key.key, key.len);
     scanner scanner(&val);
@@ -129,4 +128,16 @@ void *index_find_first_ge(index_t *index, k_t key) {
     return val;
 }
 
+extern "C" {
+
+const index_ops_t index_mt_ops = {
+    "masstree",
+    mt_create,
+    mt_destroy,
+    mt_thread_init,
+    mt_upsert,
+    mt_remove,
+    mt_find_first_ge
+};
+
 }
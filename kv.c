@@ -6,6 +6,8 @@
  * Hohai University
  */
 
+#define _GNU_SOURCE
+
 #include <pthread.h>
 
 #include "oplog.h"
@@ -15,10 +17,22 @@
 #include "rpm.h"
 #include "kv.h"
 #include "gc.h"
+#include "reclaim.h"
+
+/* gc clients take the IDs downwards from the last logger client ID */
+#define GC_CLI_ID   (NR_CLIS_MAX - 1)
+
+#define MAX_GET_DEPTH   32
+
+/* how long writers back off when their log ring is full */
+#define LOG_FULL_WAIT_US    100
 
-#define GC_CLI_ID   4096
+/* keys looked up by kv_multiget at a time, bounded by the lookup states of a client */
+#define MULTIGET_BATCH  min(MAX_GET_DEPTH, MAX_MULTI_LOOKUP)
 
 struct kv {
+    kc_t *kc;
+
     rpma_t *rpma;
     index_t *index;
     shim_t *shim;
@@ -28,27 +42,133 @@ struct kv {
     spinlock_t lock;
     struct list_head clis;
 
-    kv_cli_t *gc_cli;
+    int nr_gc_clis;
+    kv_cli_t *gc_clis[GC_MAX_WORKERS + 1];
     gc_cli_t *gc;
 };
 
 struct kv_cli {
     struct list_head head;
 
+    kv_t *kv;
     int id;
 
+    kc_t *kc;
+
     rpma_cli_t *rpma_cli;
     shim_cli_t *shim_cli;
     logger_cli_t *logger_cli;
     dcli_t *dcli;
+
+    /* pipelined kv_get_batch: up to @get_depth lookups in flight */
+    int get_depth;
+    dlookup_t dls[MAX_GET_DEPTH];
 };
 
 struct kv_rm {
     rpma_svr_t *svr;
 };
 
+struct replay_worker {
+    pthread_t thread;
+    kv_cli_t *kv_cli;
+    int id, nr;
+
+    const oplog_t *logs;
+    size_t nr_logs;
+
+    int ret;
+};
+
+/* replay the logs of keys hashed to this worker, in stamp order */
+static void *replay_worker_fn(void *arg) {
+    struct replay_worker *w = arg;
+    kv_cli_t *kv_cli = w->kv_cli;
+    uint64_t valp;
+    size_t i;
+    k_t key;
+    int ret;
+
+    reclaim_thread_init();
+    shim_thread_init(kv_cli->shim_cli);
+
+    for (i = 0; i < w->nr_logs; i++) {
+        reclaim_read_lock();
+
+        logger_get(kv_cli->logger_cli, w->logs[i], &key, &valp);
+        if (k_hash(kv_cli->kc, key) % w->nr != w->id) {
+            reclaim_read_unlock();
+            continue;
+        }
+
+        ret = shim_upsert(kv_cli->shim_cli, key, w->logs[i]);
+
+        reclaim_read_unlock();
+
+        /* a newer log of the key may have been replayed already */
+        if (unlikely(ret && ret != -EEXIST)) {
+            w->ret = ret;
+            pr_err("failed to replay log %lx: %s", w->logs[i], strerror(-ret));
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Bring back the shim layer of the last run: first map the bnodes left in PM, then replay the
+ * logs not yet ingested into them on top, spread over the gc clients by key hash so that the
+ * logs of one key are replayed by one thread, in order.
+ */
+static int kv_recover(kv_t *kv) {
+    struct replay_worker workers[GC_MAX_WORKERS + 1] = { 0 };
+    size_t nr_logs;
+    oplog_t *logs;
+    int i, ret;
+
+    ret = dset_recover(kv->gc_clis[0]->dcli);
+    if (unlikely(ret)) {
+        pr_err("failed to recover dset: %s", strerror(-ret));
+        goto out;
+    }
+
+    logs = logger_recovered_logs(kv->logger, &nr_logs);
+    if (unlikely(IS_ERR(logs))) {
+        ret = PTR_ERR(logs);
+        pr_err("failed to collect recovered logs: %s", strerror(-ret));
+        goto out;
+    }
+
+    for (i = 0; i < kv->nr_gc_clis; i++) {
+        workers[i].kv_cli = kv->gc_clis[i];
+        workers[i].id = i;
+        workers[i].nr = kv->nr_gc_clis;
+        workers[i].logs = logs;
+        workers[i].nr_logs = nr_logs;
+        ret = pthread_create(&workers[i].thread, NULL, replay_worker_fn, &workers[i]);
+        bonsai_assert(!ret);
+    }
+
+    for (i = 0; i < kv->nr_gc_clis; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ret = ret ? : workers[i].ret;
+    }
+
+    free(logs);
+
+    pr_debug(5, "recovered %lu logs with %d threads", nr_logs, kv->nr_gc_clis);
+
+out:
+    return ret;
+}
+
 kv_t *kv_create(kv_conf_t *conf) {
-    kv_cli_conf_t gc_cli_conf;
+    logger_cli_t *logger_clis[GC_MAX_WORKERS + 1];
+    shim_cli_t *shim_clis[GC_MAX_WORKERS + 1];
+    dcli_t *dclis[GC_MAX_WORKERS + 1];
+    kv_cli_conf_t gc_cli_conf = { 0 };
+    int nr_gc_workers, i, ret;
     kv_t *kv;
 
     kv = calloc(1, sizeof(*kv));
@@ -58,6 +178,8 @@ kv_t *kv_create(kv_conf_t *conf) {
         goto out;
     }
 
+    kv->kc = conf->kc;
+
     kv->rpma = rpma_create(conf->rpma_host, conf->rpma_dev_ip, conf->rpma_interval_us);
     if (unlikely(IS_ERR(kv->rpma))) {
         kv = ERR_CAST(kv->rpma);
@@ -65,21 +187,22 @@ kv_t *kv_create(kv_conf_t *conf) {
         goto out;
     }
 
-    kv->index = index_create();
+    kv->index = index_create(conf->index_backend, conf->kc);
     if (unlikely(IS_ERR(kv->index))) {
         kv = ERR_CAST(kv->index);
         pr_err("failed to create index");
         goto out;
     }
 
-    kv->shim = shim_create(kv->index, conf->kc);
+    kv->shim = shim_create(kv->index, conf->kc, conf->shim_inode_fanout, conf->shim_hot_inode_hits);
     if (unlikely(IS_ERR(kv->shim))) {
         kv = ERR_CAST(kv->shim);
         pr_err("failed to create shim");
         goto out;
     }
 
-    kv->logger = logger_create(conf->kc, conf->logger_nr_shards, conf->logger_shard_devs, conf->logger_lcb_size);
+    kv->logger = logger_create(conf->kc, conf->logger_nr_shards, conf->logger_shard_devs,
+                               conf->logger_lcb_size, conf->recover);
     if (unlikely(IS_ERR(kv->logger))) {
         kv = ERR_CAST(kv->logger);
         pr_err("failed to create logger");
@@ -87,7 +210,8 @@ kv_t *kv_create(kv_conf_t *conf) {
     }
 
     kv->dset = dset_create(conf->kc, conf->dset_bnode_size, conf->dset_dnode_size,
-                           conf->dset_bdev, kv->rpma, conf->dset_max_gc_prefetch);
+                           conf->dset_bdev, kv->rpma, conf->dset_max_gc_prefetch,
+                           conf->dset_dnode_cache_size, conf->recover);
     if (unlikely(IS_ERR(kv->dset))) {
         kv = ERR_CAST(kv->dset);
         pr_err("failed to create dset");
@@ -97,16 +221,35 @@ kv_t *kv_create(kv_conf_t *conf) {
     spin_lock_init(&kv->lock);
     INIT_LIST_HEAD(&kv->clis);
 
+    /* one client for the gc thread, plus one for each worker if there are many */
+    nr_gc_workers = max(1, min(conf->gc_nr_workers, GC_MAX_WORKERS));
+    kv->nr_gc_clis = nr_gc_workers > 1 ? nr_gc_workers + 1 : 1;
+
     gc_cli_conf.logger_region_size = 0;
-    gc_cli_conf.id = GC_CLI_ID;
-    kv->gc_cli = kv_cli_create(kv, &gc_cli_conf);
-    if (unlikely(IS_ERR(kv->gc_cli))) {
-        kv = ERR_CAST(kv->gc_cli);
-        pr_err("failed to create gc_cli");
-        goto out;
+    gc_cli_conf.get_depth = 1;
+    for (i = 0; i < kv->nr_gc_clis; i++) {
+        gc_cli_conf.id = GC_CLI_ID - i;
+        kv->gc_clis[i] = kv_cli_create(kv, &gc_cli_conf);
+        if (unlikely(IS_ERR(kv->gc_clis[i]))) {
+            kv = ERR_CAST(kv->gc_clis[i]);
+            pr_err("failed to create gc_cli");
+            goto out;
+        }
+        logger_clis[i] = kv->gc_clis[i]->logger_cli;
+        shim_clis[i] = kv->gc_clis[i]->shim_cli;
+        dclis[i] = kv->gc_clis[i]->dcli;
     }
-    kv->gc = gc_cli_create(conf->kc,
-                           kv->gc_cli->logger_cli, kv->gc_cli->shim_cli, kv->gc_cli->dcli,
+
+    if (conf->recover) {
+        ret = kv_recover(kv);
+        if (unlikely(ret)) {
+            kv = ERR_PTR(ret);
+            pr_err("failed to recover");
+            goto out;
+        }
+    }
+
+    kv->gc = gc_cli_create(conf->kc, nr_gc_workers, logger_clis, shim_clis, dclis,
                            conf->auto_gc_logs, conf->auto_gc_pm,
                            conf->min_gc_size, conf->pm_high_watermark, conf->pm_gc_size);
     if (unlikely(IS_ERR(kv->gc))) {
@@ -120,6 +263,16 @@ out:
 }
 
 void kv_destroy(kv_t *kv) {
+    int i;
+
+    gc_cli_destroy(kv->gc);
+    for (i = 0; i < kv->nr_gc_clis; i++) {
+        kv_cli_destroy(kv->gc_clis[i]);
+    }
+
+    /* retired nodes are recycled into the allocators below */
+    reclaim_barrier();
+
     dset_destroy(kv->dset);
     logger_destroy(kv->logger);
     shim_destroy(kv->shim);
@@ -129,6 +282,7 @@ void kv_destroy(kv_t *kv) {
 
 kv_cli_t *kv_cli_create(kv_t *kv, kv_cli_conf_t *conf) {
     kv_cli_t *kv_cli;
+    int i, ret;
 
     kv_cli = calloc(1, sizeof(*kv_cli));
     if (unlikely(!kv_cli)) {
@@ -142,43 +296,102 @@ kv_cli_t *kv_cli_create(kv_t *kv, kv_cli_conf_t *conf) {
     list_add_tail(&kv_cli->head, &kv->clis);
     spin_unlock(&kv->lock);
 
+    kv_cli->kv = kv;
     kv_cli->id = conf->id;
+    kv_cli->kc = kv->kc;
+
+    /* clients may be created (and then used) by any thread */
+    index_thread_init(kv->index);
 
     kv_cli->rpma_cli = rpma_cli_create(kv->rpma);
     if (unlikely(IS_ERR(kv_cli->rpma_cli))) {
-        kv_cli = ERR_CAST(kv_cli->rpma_cli);
+        ret = PTR_ERR(kv_cli->rpma_cli);
         pr_err("failed to create rpma_cli");
-        goto out;
-    }
-
-    kv_cli->shim_cli = shim_create_cli(kv->shim, kv_cli->logger_cli);
-    if (unlikely(IS_ERR(kv_cli->shim_cli))) {
-        kv_cli = ERR_CAST(kv_cli->shim_cli);
-        pr_err("failed to create shim_cli");
-        goto out;
+        goto out_free;
     }
 
     kv_cli->logger_cli = logger_cli_create(kv->logger, conf->logger_region_size, conf->id);
     if (unlikely(IS_ERR(kv_cli->logger_cli))) {
-        kv_cli = ERR_CAST(kv_cli->logger_cli);
+        ret = PTR_ERR(kv_cli->logger_cli);
         pr_err("failed to create logger_cli");
-        goto out;
+        goto out_destroy_rpma_cli;
+    }
+
+    kv_cli->shim_cli = shim_create_cli(kv->shim, kv_cli->logger_cli);
+    if (unlikely(IS_ERR(kv_cli->shim_cli))) {
+        ret = PTR_ERR(kv_cli->shim_cli);
+        pr_err("failed to create shim_cli");
+        goto out_destroy_logger_cli;
     }
 
     kv_cli->dcli = dcli_create(kv->dset, kv_cli->shim_cli);
     if (unlikely(IS_ERR(kv_cli->dcli))) {
-        kv_cli = ERR_CAST(kv_cli->dcli);
+        ret = PTR_ERR(kv_cli->dcli);
         pr_err("failed to create dcli");
-        goto out;
+        goto out_destroy_shim_cli;
     }
 
     shim_set_dcli(kv_cli->shim_cli, kv_cli->dcli);
 
+    for (i = 0; i < MAX_GET_DEPTH; i++) {
+        ret = dset_lookup_init(kv_cli->dcli, &kv_cli->dls[i]);
+        if (unlikely(ret)) {
+            pr_err("failed to init pipelined lookup state");
+            goto out_fini_dls;
+        }
+    }
+    kv_cli_set_get_depth(kv_cli, conf->get_depth);
+
+    ret = kv_cli_set_durability(kv_cli, conf->durability, conf->group_commit_us, conf->group_commit_size);
+    if (unlikely(ret)) {
+        spin_lock(&kv->lock);
+        list_del(&kv_cli->head);
+        spin_unlock(&kv->lock);
+        kv_cli_destroy(kv_cli);
+        kv_cli = ERR_PTR(ret);
+        goto out;
+    }
+
 out:
-    return 0;
+    return kv_cli;
+
+out_fini_dls:
+    while (i--) {
+        dset_lookup_fini(kv_cli->dcli, &kv_cli->dls[i]);
+    }
+    dcli_destroy(kv_cli->dcli);
+
+out_destroy_shim_cli:
+    shim_destroy_cli(kv_cli->shim_cli);
+
+out_destroy_logger_cli:
+    logger_cli_quiesce(kv_cli->logger_cli);
+    reclaim_barrier();
+    logger_cli_destroy(kv_cli->logger_cli);
+
+out_destroy_rpma_cli:
+    rpma_cli_destroy(kv_cli->rpma_cli);
+
+out_free:
+    spin_lock(&kv->lock);
+    list_del(&kv_cli->head);
+    spin_unlock(&kv->lock);
+    free(kv_cli);
+    return ERR_PTR(ret);
 }
 
 void kv_cli_destroy(kv_cli_t *kv_cli) {
+    int i;
+
+    for (i = 0; i < MAX_GET_DEPTH; i++) {
+        dset_lookup_fini(kv_cli->dcli, &kv_cli->dls[i]);
+    }
+
+    logger_cli_quiesce(kv_cli->logger_cli);
+
+    /* deferred reclamation may refer to our rpma_cli, and LCB releases to our logger_cli */
+    reclaim_barrier();
+
     dcli_destroy(kv_cli->dcli);
     logger_cli_destroy(kv_cli->logger_cli);
     shim_destroy_cli(kv_cli->shim_cli);
@@ -186,42 +399,311 @@ void kv_cli_destroy(kv_cli_t *kv_cli) {
     free(kv_cli);
 }
 
+struct sort_task {
+    kc_t *kc;
+    const k_t *keys;
+};
+
+/* sort by key, equal keys stay in request order */
+static int sort_cmp_key(const void *a, const void *b, void *priv) {
+    int p = *(int *)a, q = *(int *)b;
+    struct sort_task *task = priv;
+    int cmp = k_cmp(task->kc, task->keys[p], task->keys[q]);
+    return cmp ? : p - q;
+}
+
+static int *get_key_order(kv_cli_t *kv_cli, const k_t *keys, int n) {
+    struct sort_task task = { kv_cli->kc, keys };
+    int *order, i;
+
+    order = malloc(n * sizeof(*order));
+    if (unlikely(!order)) {
+        pr_err("failed to allocate memory for key order");
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    qsort_r(order, n, sizeof(*order), sort_cmp_key, &task);
+
+    return order;
+}
+
+/*
+ * The log ring of @kv_cli is full (or about to be, if !@full): kick log GC, and if full, wait
+ * for it to reclaim space. Called within a read-side section, which is left while waiting, as
+ * log GC waits for all of them.
+ */
+static void log_backpressure(kv_cli_t *kv_cli, bool full) {
+    gc_logs(kv_cli->kv->gc);
+
+    if (full) {
+        reclaim_read_unlock();
+        usleep(LOG_FULL_WAIT_US);
+        reclaim_read_lock();
+    }
+}
+
+static oplog_t append_log(kv_cli_t *kv_cli, op_t op, k_t key, uint64_t valp) {
+    oplog_t oplog;
+
+    while (unlikely((oplog = logger_append(kv_cli->logger_cli, op, key, valp, 0)) == (oplog_t) -ENOSPC)) {
+        log_backpressure(kv_cli, true);
+    }
+
+    if (unlikely(!IS_ERR(oplog) && logger_is_filling(kv_cli->logger_cli))) {
+        log_backpressure(kv_cli, false);
+    }
+
+    return oplog;
+}
+
 int kv_put(kv_cli_t *kv_cli, k_t key, uint64_t valp) {
     oplog_t oplog;
     int ret;
 
-    oplog = logger_append(kv_cli->logger_cli, OP_PUT, key, valp, 0);
+    reclaim_read_lock();
+
+    oplog = append_log(kv_cli, OP_PUT, key, valp);
+    if (unlikely(IS_ERR(oplog))) {
+        ret = PTR_ERR(oplog);
+        pr_err("logger_append failed with %d", ret);
+        goto out;
+    }
 
     ret = shim_upsert(kv_cli->shim_cli, key, oplog);
-    if (unlikely(ret)) {
+    if (ret == -EEXIST) {
+        /* the key was there already, the log supersedes the old one */
+        ret = 0;
+    } else if (unlikely(ret)) {
         pr_err("shim_upsert failed with %d", ret);
     }
 
 out:
+    reclaim_read_unlock();
+    return ret;
+}
+
+/*
+ * Write @n keys (deleted if @dels[i], put @vals[i] otherwise) in one go: logs of the whole
+ * batch are appended back to back in key order, and then applied to the inodes in the same
+ * order, so that keys sharing an inode take its lock only once. Later writes of a key win.
+ */
+int kv_write_batch(kv_cli_t *kv_cli, const k_t *keys, const uint64_t *vals, const bool *dels, int n) {
+    uint64_t *svals;
+    oplog_t *logs;
+    op_t *ops;
+    k_t *skeys;
+    int *order;
+    int i, ret;
+
+    if (!n) {
+        return 0;
+    }
+
+    order = get_key_order(kv_cli, keys, n);
+    skeys = malloc(n * sizeof(*skeys));
+    svals = malloc(n * sizeof(*svals));
+    logs = malloc(n * sizeof(*logs));
+    ops = malloc(n * sizeof(*ops));
+    if (unlikely(!order || !skeys || !svals || !logs || !ops)) {
+        pr_err("failed to allocate memory for write batch");
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < n; i++) {
+        skeys[i] = keys[order[i]];
+        svals[i] = dels && dels[order[i]] ? 0 : vals[order[i]];
+        ops[i] = dels && dels[order[i]] ? OP_DEL : OP_PUT;
+    }
+
+    reclaim_read_lock();
+
+    while (unlikely((ret = logger_append_batch(kv_cli->logger_cli, n, ops, skeys, svals, logs)) == -ENOSPC)) {
+        log_backpressure(kv_cli, true);
+    }
+    if (likely(!ret) && logger_is_filling(kv_cli->logger_cli)) {
+        log_backpressure(kv_cli, false);
+    }
+    if (unlikely(ret)) {
+        pr_err("logger_append_batch failed with %d", ret);
+    } else {
+        ret = shim_upsert_batch(kv_cli->shim_cli, skeys, logs, n);
+        if (unlikely(ret)) {
+            pr_err("shim_upsert_batch failed with %d", ret);
+        }
+    }
+
+    reclaim_read_unlock();
+
+out:
+    free(ops);
+    free(logs);
+    free(svals);
+    free(skeys);
+    free(order);
     return ret;
 }
 
+int kv_multiput(kv_cli_t *kv_cli, const k_t *keys, const uint64_t *vals, int n) {
+    return kv_write_batch(kv_cli, keys, vals, NULL, n);
+}
+
 int kv_get(kv_cli_t *kv_cli, k_t key, uint64_t *valp) {
-    return shim_lookup(kv_cli->shim_cli, key, valp);
+    int ret;
+
+    reclaim_read_lock();
+    ret = shim_lookup(kv_cli->shim_cli, key, valp);
+    reclaim_read_unlock();
+
+    return ret;
+}
+
+void kv_cli_set_get_depth(kv_cli_t *kv_cli, int depth) {
+    kv_cli->get_depth = max(1, min(depth, MAX_GET_DEPTH));
+}
+
+/*
+ * Choose when puts (and dels) of @kv_cli are persisted: when its LCB fills up, within
+ * @group_commit_us or once @group_commit_size bytes of logs pile up, or before they return.
+ */
+int kv_cli_set_durability(kv_cli_t *kv_cli, log_durability_t durability, int group_commit_us, size_t group_commit_size) {
+    int ret;
+
+    ret = logger_cli_set_durability(kv_cli->logger_cli, durability, group_commit_us, group_commit_size);
+    if (unlikely(ret)) {
+        pr_err("failed to set durability of kv_cli #%d: %s", kv_cli->id, strerror(-ret));
+    }
+
+    return ret;
+}
+
+/*
+ * Look up @n keys with up to @get_depth of them in flight: a lookup that misses the local tiers
+ * issues its dnode read and yields to the next one, and is resumed once its read completes.
+ */
+int kv_get_batch(kv_cli_t *kv_cli, const k_t *keys, int n, uint64_t *vals, int *rets) {
+    int slot_req[MAX_GET_DEPTH];
+    int i, ret, next = 0, nr_inflight = 0, nr_found = 0;
+
+    for (i = 0; i < kv_cli->get_depth; i++) {
+        slot_req[i] = -1;
+    }
+
+    reclaim_read_lock();
+
+    while (next < n || nr_inflight) {
+        for (i = 0; i < kv_cli->get_depth; i++) {
+            if (slot_req[i] >= 0) {
+                /* resume in-flight lookup */
+                ret = shim_lookup_resume(kv_cli->shim_cli, &kv_cli->dls[i], &vals[slot_req[i]]);
+                if (ret == -EINPROGRESS) {
+                    continue;
+                }
+                rets[slot_req[i]] = ret;
+                nr_found += !ret;
+                slot_req[i] = -1;
+                nr_inflight--;
+            }
+
+            /* refill the slot, requests served locally complete right away */
+            while (next < n) {
+                ret = shim_lookup_start(kv_cli->shim_cli, keys[next], &vals[next], &kv_cli->dls[i]);
+                if (ret == -EINPROGRESS) {
+                    slot_req[i] = next++;
+                    nr_inflight++;
+                    break;
+                }
+                rets[next++] = ret;
+                nr_found += !ret;
+            }
+        }
+    }
+
+    reclaim_read_unlock();
+
+    return nr_found;
+}
+
+/*
+ * Look up @n keys in key order, so that keys falling into the same inode / dnode are resolved
+ * together. The remote reads of each batch of keys are issued as one chain.
+ */
+int kv_multiget(kv_cli_t *kv_cli, const k_t *keys, int n, uint64_t *vals, int *rets) {
+    k_t bkeys[MULTIGET_BATCH];
+    uint64_t bvals[MULTIGET_BATCH];
+    int brets[MULTIGET_BATCH];
+    int *order, i, j, nr, ret = 0;
+
+    order = get_key_order(kv_cli, keys, n);
+    if (unlikely(!order)) {
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < n; i += nr) {
+        nr = min(n - i, MULTIGET_BATCH);
+
+        for (j = 0; j < nr; j++) {
+            bkeys[j] = keys[order[i + j]];
+        }
+
+        reclaim_read_lock();
+        shim_multi_lookup(kv_cli->shim_cli, bkeys, nr, bvals, brets, kv_cli->dls);
+        reclaim_read_unlock();
+
+        for (j = 0; j < nr; j++) {
+            vals[order[i + j]] = bvals[j];
+            rets[order[i + j]] = brets[j];
+            ret += !brets[j];
+        }
+    }
+
+    free(order);
+
+    return ret;
 }
 
 int kv_del(kv_cli_t *kv_cli, k_t key) {
     oplog_t oplog;
     int ret;
 
-    oplog = logger_append(kv_cli->logger_cli, OP_DEL, key, 0, 0);
+    reclaim_read_lock();
+
+    oplog = append_log(kv_cli, OP_DEL, key, 0);
+    if (unlikely(IS_ERR(oplog))) {
+        ret = PTR_ERR(oplog);
+        pr_err("logger_append failed with %d", ret);
+        goto out;
+    }
 
     ret = shim_upsert(kv_cli->shim_cli, key, oplog);
-    if (unlikely(ret)) {
+    if (ret == -EEXIST) {
+        /* the key was there already, the log supersedes the old one */
+        ret = 0;
+    } else if (unlikely(ret)) {
         pr_err("shim_upsert failed with %d", ret);
     }
 
 out:
+    reclaim_read_unlock();
+    return ret;
+}
+
+int kv_scan(kv_cli_t *kv_cli, k_t key, int len, kv_scanner scanner, void *priv) {
+    int ret;
+
+    reclaim_read_lock();
+    ret = shim_scan(kv_cli->shim_cli, key, len, scanner, priv);
+    reclaim_read_unlock();
+
     return ret;
 }
 
-int kv_scan(kv_cli_t *kv_cli, k_t key, int len) {
-    return shim_scan(kv_cli->shim_cli, key, len);
+/* wait until all writes of @kv_cli so far are persisted, whatever its durability */
+int kv_sync(kv_cli_t *kv_cli) {
+    return logger_sync(kv_cli->logger_cli);
 }
 
 kv_rm_t *kv_rm_create(kv_rm_conf_t *conf) {
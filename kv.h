@@ -17,6 +17,9 @@ typedef struct kv kv_t;
 typedef struct kv_cli kv_cli_t;
 typedef struct kv_rm kv_rm_t;
 
+/* called for each key/value pair of kv_scan in key order, returns non-zero to stop the scan */
+typedef int kv_scanner(k_t key, uint64_t valp, void *priv);
+
 kv_t *kv_create(kv_conf_t *conf);
 void kv_destroy(kv_t *kv);
 
@@ -24,9 +27,16 @@ kv_cli_t *kv_cli_create(kv_t *kv, kv_cli_conf_t *conf);
 void kv_cli_destroy(kv_cli_t *kv_cli);
 
 int kv_put(kv_cli_t *kv_cli, k_t key, uint64_t valp);
+int kv_multiput(kv_cli_t *kv_cli, const k_t *keys, const uint64_t *vals, int n);
+int kv_write_batch(kv_cli_t *kv_cli, const k_t *keys, const uint64_t *vals, const bool *dels, int n);
 int kv_get(kv_cli_t *kv_cli, k_t key, uint64_t *valp);
+int kv_get_batch(kv_cli_t *kv_cli, const k_t *keys, int n, uint64_t *vals, int *rets);
+void kv_cli_set_get_depth(kv_cli_t *kv_cli, int depth);
+int kv_cli_set_durability(kv_cli_t *kv_cli, log_durability_t durability, int group_commit_us, size_t group_commit_size);
+int kv_multiget(kv_cli_t *kv_cli, const k_t *keys, int n, uint64_t *vals, int *rets);
 int kv_del(kv_cli_t *kv_cli, k_t key);
-int kv_scan(kv_cli_t *kv_cli, k_t key, int len);
+int kv_scan(kv_cli_t *kv_cli, k_t key, int len, kv_scanner scanner, void *priv);
+int kv_sync(kv_cli_t *kv_cli);
 
 void kv_gc_logs(kv_t *kv);
 void kv_gc_pm(kv_t *kv);
@@ -8,6 +8,7 @@
 
 #define _GNU_SOURCE
 
+#include <pthread.h>
 #include <sched.h>
 #include <urcu.h>
 #include <numa.h>
@@ -17,13 +18,54 @@
 #include "oplog.h"
 #include "lock.h"
 #include "list.h"
+#include "reclaim.h"
 #include "pm.h"
 
-#define NR_CLIS_MAX      1024
+#define FLUSHER_IDLE_US     5
+
+#define LOGGER_MAGIC        0x474c49415342ul
+
+/* where the log region of a client lives in its shard, and up to where its logs are GCed */
+struct logger_region {
+    size_t off, size;
+    size_t head;
+    /* fresh for each client created, logs of earlier owners of the space don't check out */
+    uint32_t gen;
+};
+
+/* at the start of each shard, so that log regions can be found again after a crash */
+struct logger_super {
+    uint64_t magic;
+    /* the last region generation handed out in this shard */
+    uint32_t gen;
+    struct logger_region regions[NR_CLIS_MAX];
+};
+
+/*
+ * LCBs are flushed off the critical path of writers: a full LCB is sealed and handed over to
+ * the flusher of its socket, while the writer goes on with the spare LCB of its client.
+ */
+struct logger_flusher {
+    logger_t *logger;
+    int socket;
+
+    pthread_t thread;
+    bool exit;
+
+    /* sealed LCBs to be persisted, in sealing order */
+    spinlock_t lock;
+    struct list_head queue;
+
+    /* LOG_GROUP_COMMIT clients, whose LCBs are persisted once their logs wait for too long */
+    spinlock_t group_lock;
+    struct list_head group_clis;
+};
 
 struct logger_shard {
     struct pm_dev *dev;
+    struct logger_super *super;
     allocator_t *allocator;
+    struct logger_flusher *flusher;
     /* clients bind to this shard */
     int nr_clis;
 };
@@ -36,9 +78,19 @@ struct logger {
 
     size_t lcb_size;
 
+    /* one for each socket the shards are on */
+    struct logger_flusher *flushers;
+    int nr_flushers;
+
     spinlock_t lock;
 
     struct logger_cli **clis;
+
+    /* added to TSC to stamp logs, so that stamps keep growing across restarts */
+    uint64_t stamp_base;
+
+    /* the last region generation handed out, across shards and runs */
+    uint32_t gen;
 };
 
 struct oplog_ptr {
@@ -51,36 +103,87 @@ struct oplog_ptr {
     };
 };
 
+/*
+ * A log is valid only if @csum checks out. The checksum is seeded with the generation of the
+ * ring and the logical offset of the log, so that logs torn by a crash, stale ones of previous
+ * laps of the ring, and ones left by earlier owners of the space all fail it.
+ */
 struct oplog_data {
-    op_t op;
-    uint32_t key_len;
+    /* CRC32C of the rest of the log, key included */
+    uint32_t csum;
+    uint16_t key_len;
+    uint8_t op;
+    uint8_t rsvd;
     uint64_t valp;
     uint64_t depend;
+    /* append time, orders logs of different clients in recovery */
+    uint64_t stamp;
     char key[];
 };
 
 struct lcb {
     struct rcu_head rcu;
-    /* Logs between [@start, @tail) reside in LCB and not persisted */
-    size_t start;
+    struct logger_cli *cli;
+    /* queued to the flusher once sealed */
+    struct list_head node;
+    /*
+     * Logs between [@start, @tail) reside in LCB and not persisted. Once sealed, the LCB holds
+     * the ones between [@start, @end) until they are persisted. Logs below @synced are
+     * persisted already.
+     */
+    size_t start, end;
+    size_t synced;
     char data[];
 };
 
+/*
+ * Log regions are rings. Log offsets (@head, @tail, and the ones in log pointers) are logical:
+ * they only grow, and a log lives at @off modulo the region size in PM. A log never wraps around
+ * the end of the region, the space up to the end is skipped instead.
+ */
 struct logger_cli {
     logger_t *logger;
     int id;
 
     /*
-     * @head points to the beginning of log region
-     * @tail points to the end of log region
+     * Logs below @head are GCed (stale). Logs below @reclaimed are not referenced anymore
+     * either, their space can be reused. Logs are appended at @tail, up to @reclaimed plus the
+     * region size.
      */
     size_t head, tail;
+    size_t reclaimed;
 
-    struct lcb *lcb;
+    /*
+     * Logs are appended to @lcb. The previous one stays @sealed until the flusher persists it,
+     * and is then recycled as the @spare one as soon as no lock-free reader can see it.
+     */
+    struct lcb *lcb, *sealed, *spare;
     size_t lcb_size;
+    /* from sealing an LCB until the flusher has handed it over to RCU for release */
+    bool flushing;
+    /* LCBs set aside for the switches a batch append takes, used up after the spare one */
+    struct list_head reserved;
+    int nr_reserved;
+    struct logger_flusher *flusher;
+
+    /* serializes syncs of the current LCB (by the client or its flusher) and LCB switches */
+    spinlock_t sync_lock;
+    log_durability_t durability;
+    uint64_t group_commit_ns;
+    size_t group_commit_size;
+    struct list_head group_node;
+    /* when the flusher saw unsynced logs in the LCB first, flusher private */
+    uint64_t unsynced_since;
 
+    struct pm_dev *dev;
     void *log_region;
     size_t log_region_size;
+    /* in the shard superblock, NULL if the client has no log region */
+    struct logger_region *region;
+    uint32_t gen;
+
+    /* left by the last run, not taken over by a new client yet */
+    bool recovered;
 };
 
 struct logger_cli_barrier {
@@ -97,9 +200,208 @@ struct logger_barrier {
     struct logger_cli_barrier cli_barriers[];
 };
 
-logger_t *logger_create(kc_t *kc, int nr_shards, const char *shard_devs[], size_t lcb_size) {
+static inline size_t log_phys(logger_cli_t *logger_cli, size_t off) {
+    return off % logger_cli->log_region_size;
+}
+
+/* checksum of @log at @off of @logger_cli's ring */
+static inline uint32_t log_csum(logger_cli_t *logger_cli, const struct oplog_data *log, size_t off) {
+    uint32_t crc;
+
+    crc = crc32c(logger_cli->gen, &off, sizeof(off));
+    return crc32c(crc, (const void *) log + sizeof(log->csum), sizeof(*log) - sizeof(log->csum) + log->key_len);
+}
+
+/* copy logs of [@off, @off + @size) from @src into the ring */
+static void region_write(logger_cli_t *logger_cli, size_t off, void *src, size_t size) {
+    size_t phys = log_phys(logger_cli, off), first;
+
+    first = min(size, logger_cli->log_region_size - phys);
+    memcpy_nt(logger_cli->log_region + phys, src, first);
+    if (first < size) {
+        memcpy_nt(logger_cli->log_region, src + first, size - first);
+    }
+}
+
+/* copy logs of [@off, @off + @size) out of the ring into @dst */
+static void region_read(logger_cli_t *logger_cli, void *dst, size_t off, size_t size) {
+    size_t phys, first;
+
+    if (!size) {
+        return;
+    }
+
+    phys = log_phys(logger_cli, off);
+    first = min(size, logger_cli->log_region_size - phys);
+    memcpy(dst, logger_cli->log_region + phys, first);
+    if (first < size) {
+        memcpy(dst + first, logger_cli->log_region, size - first);
+    }
+}
+
+/* persist logs of the sealed @lcb into the ring */
+static void persist_lcb(struct lcb *lcb) {
+    logger_cli_t *logger_cli = lcb->cli;
+    size_t from = max(lcb->start, lcb->synced), size;
+
+    if (from >= lcb->end) {
+        return;
+    }
+
+    size = lcb->end - from;
+    region_write(logger_cli, from, lcb->data + (from - lcb->start), size);
+    memory_sfence();
+    pm_persist_delay(logger_cli->dev, size);
+
+    pr_debug(20, "lcb flush, cli=%d, off=%lu, size=%lu, lcb=%p", logger_cli->id, from, size, lcb);
+}
+
+/*
+ * Persist logs of the current LCB appended so far, the client goes on appending meanwhile if
+ * called by the flusher. Called with sync_lock held.
+ */
+static void sync_lcb(logger_cli_t *logger_cli) {
+    struct lcb *lcb = logger_cli->lcb;
+    size_t tail, start, from;
+
+    /* the LCB start moves forward before the tail does (log_reserve) */
+    tail = READ_ONCE(logger_cli->tail);
+    smp_rmb();
+    start = READ_ONCE(lcb->start);
+
+    from = max(lcb->synced, start);
+    if (from < tail) {
+        region_write(logger_cli, from, lcb->data + (from - start), tail - from);
+        memory_sfence();
+        pm_persist_delay(logger_cli->dev, tail - from);
+
+        pr_debug(30, "lcb sync, cli=%d, off=%lu, size=%lu", logger_cli->id, from, tail - from);
+    }
+
+    WRITE_ONCE(lcb->synced, max(lcb->synced, tail));
+}
+
+/* sync LCBs of group commit clients whose oldest unsynced logs are due */
+static void flusher_sweep(struct logger_flusher *flusher) {
+    logger_cli_t *logger_cli;
+    uint64_t now;
+
+    spin_lock(&flusher->group_lock);
+
+    now = get_ns();
+    list_for_each_entry(logger_cli, &flusher->group_clis, group_node) {
+        spin_lock(&logger_cli->sync_lock);
+
+        if (READ_ONCE(logger_cli->tail) <= logger_cli->lcb->synced) {
+            logger_cli->unsynced_since = 0;
+        } else if (!logger_cli->unsynced_since) {
+            logger_cli->unsynced_since = now;
+        } else if (logger_cli->group_commit_ns && now - logger_cli->unsynced_since >= logger_cli->group_commit_ns) {
+            sync_lcb(logger_cli);
+            logger_cli->unsynced_since = 0;
+        }
+
+        spin_unlock(&logger_cli->sync_lock);
+    }
+
+    spin_unlock(&flusher->group_lock);
+}
+
+/* no reader sees @lcb anymore, keep it as the spare one, or free it if there's one already */
+static void release_lcb(struct rcu_head *head) {
+    struct lcb *lcb = container_of(head, struct lcb, rcu);
+
+    if (!cmpxchg2(&lcb->cli->spare, NULL, lcb)) {
+        free(lcb);
+    }
+}
+
+static void *flusher_thread(void *arg) {
+    struct logger_flusher *flusher = arg;
+    logger_cli_t *logger_cli;
+    struct lcb *lcb;
+
+    reclaim_thread_init();
+
+    if (flusher->socket >= 0) {
+        numa_run_on_node(flusher->socket);
+    }
+
+    pr_debug(5, "logger flusher on socket %d start", flusher->socket);
+
+    /* drain the queue before exit, destroying a client waits for its sealed LCB */
+    while (true) {
+        spin_lock(&flusher->lock);
+        lcb = list_empty(&flusher->queue) ? NULL : list_first_entry(&flusher->queue, struct lcb, node);
+        if (lcb) {
+            list_del(&lcb->node);
+        }
+        spin_unlock(&flusher->lock);
+
+        if (!lcb) {
+            if (READ_ONCE(flusher->exit)) {
+                break;
+            }
+            flusher_sweep(flusher);
+            usleep(FLUSHER_IDLE_US);
+            continue;
+        }
+
+        logger_cli = lcb->cli;
+        persist_lcb(lcb);
+
+        /* readers find the logs in PM from now on */
+        rcu_assign_pointer(logger_cli->sealed, NULL);
+        call_rcu(&lcb->rcu, release_lcb);
+
+        /* the client may go once the release is queued, rcu_barrier waits for it then */
+        smp_wmb();
+        WRITE_ONCE(logger_cli->flushing, false);
+    }
+
+    pr_debug(5, "logger flusher on socket %d exit", flusher->socket);
+
+    return NULL;
+}
+
+static int flusher_start(logger_t *logger, struct logger_flusher *flusher, int socket) {
+    int ret;
+
+    flusher->logger = logger;
+    flusher->socket = socket;
+    flusher->exit = false;
+    spin_lock_init(&flusher->lock);
+    INIT_LIST_HEAD(&flusher->queue);
+    spin_lock_init(&flusher->group_lock);
+    INIT_LIST_HEAD(&flusher->group_clis);
+
+    ret = pthread_create(&flusher->thread, NULL, flusher_thread, flusher);
+    if (unlikely(ret)) {
+        pr_err("failed to create flusher thread: %s", strerror(ret));
+        return -ret;
+    }
+
+    return 0;
+}
+
+static void flusher_stop(struct logger_flusher *flusher) {
+    WRITE_ONCE(flusher->exit, true);
+    pthread_join(flusher->thread, NULL);
+}
+
+static void flusher_submit(struct logger_flusher *flusher, struct lcb *lcb) {
+    spin_lock(&flusher->lock);
+    list_add_tail(&lcb->node, &flusher->queue);
+    spin_unlock(&flusher->lock);
+}
+
+static int recover_clis(logger_t *logger);
+
+logger_t *logger_create(kc_t *kc, int nr_shards, const char *shard_devs[], size_t lcb_size, bool recover) {
+    struct logger_shard *shard;
+    uint64_t super_off;
     logger_t *logger;
-    int i;
+    int i, j, ret;
 
     if (unlikely(nr_shards <= 0)) {
         logger = ERR_PTR(-EINVAL);
@@ -127,10 +429,13 @@ logger_t *logger_create(kc_t *kc, int nr_shards, const char *shard_devs[], size_
 
     logger->lcb_size = lcb_size;
 
+    /* devices without a superblock may still hold logs of any generation, start at a random one */
+    logger->gen = get_tsc();
+
     for (i = 0; i < nr_shards; i++) {
-        logger->shards[i].dev = pm_open_devs(nr_shards, shard_devs);
-        if (unlikely(!logger->shards[i].dev)) {
-            logger = ERR_PTR(-ENODEV);
+        logger->shards[i].dev = pm_open_devs(1, &shard_devs[i]);
+        if (unlikely(IS_ERR(logger->shards[i].dev))) {
+            logger = ERR_CAST(logger->shards[i].dev);
             pr_err("failed to open PM device: %s", shard_devs[i]);
             goto out;
         }
@@ -141,6 +446,55 @@ logger_t *logger_create(kc_t *kc, int nr_shards, const char *shard_devs[], size_
             goto out;
         }
         logger->shards[i].nr_clis = 0;
+
+        /* the superblock comes first */
+        super_off = allocator_alloc(logger->shards[i].allocator, sizeof(struct logger_super));
+        bonsai_assert(super_off == 0);
+        logger->shards[i].super = logger->shards[i].dev->start + super_off;
+
+        /* generations keep growing across runs, even if the logs of the last one are dropped */
+        if (logger->shards[i].super->magic == LOGGER_MAGIC) {
+            logger->gen = max(logger->gen, logger->shards[i].super->gen);
+        }
+
+        if (recover && logger->shards[i].super->magic == LOGGER_MAGIC) {
+            continue;
+        }
+        if (recover) {
+            pr_warn("no logs to recover on PM device %s", shard_devs[i]);
+        }
+
+        memset(logger->shards[i].super, 0, sizeof(struct logger_super));
+        logger->shards[i].super->magic = LOGGER_MAGIC;
+        logger->shards[i].super->gen = logger->gen;
+        flush_range(logger->shards[i].super, sizeof(struct logger_super));
+        memory_sfence();
+    }
+
+    logger->flushers = calloc(nr_shards, sizeof(*logger->flushers));
+    if (unlikely(logger->flushers == NULL)) {
+        logger = ERR_PTR(-ENOMEM);
+        pr_err("failed to allocate memory for logger->flushers");
+        goto out;
+    }
+
+    /* shards on the same socket share a flusher */
+    for (i = 0; i < nr_shards; i++) {
+        shard = &logger->shards[i];
+        for (j = 0; j < logger->nr_flushers; j++) {
+            if (logger->flushers[j].socket == shard->dev->socket) {
+                break;
+            }
+        }
+        if (j == logger->nr_flushers) {
+            ret = flusher_start(logger, &logger->flushers[j], shard->dev->socket);
+            if (unlikely(ret)) {
+                logger = ERR_PTR(ret);
+                goto out;
+            }
+            logger->nr_flushers++;
+        }
+        shard->flusher = &logger->flushers[j];
     }
 
     logger->clis = calloc(NR_CLIS_MAX, sizeof(*logger->clis));
@@ -150,19 +504,36 @@ logger_t *logger_create(kc_t *kc, int nr_shards, const char *shard_devs[], size_
         goto out;
     }
 
-    pr_debug(5, "created logger across %d local PM areas, lcb_size=%luB", nr_shards, logger->lcb_size);
+    if (recover) {
+        ret = recover_clis(logger);
+        if (unlikely(ret)) {
+            logger = ERR_PTR(ret);
+            goto out;
+        }
+    }
+
+    pr_debug(5, "created logger across %d local PM areas, %d flushers, lcb_size=%luB",
+             nr_shards, logger->nr_flushers, logger->lcb_size);
 
 out:
     return logger;
 }
 
 void logger_destroy(logger_t *logger) {
+    int i;
+
+    for (i = 0; i < logger->nr_flushers; i++) {
+        flusher_stop(&logger->flushers[i]);
+    }
+
+    free(logger->flushers);
     free(logger->shards);
     free(logger);
 }
 
 static inline bool is_local_socket(int socket) {
-    return numa_node_of_cpu(sched_getcpu()) == socket;
+    /* emulated devices without NUMA binding are local to everyone */
+    return socket < 0 || numa_node_of_cpu(sched_getcpu()) == socket;
 }
 
 static inline struct logger_shard *find_cli_shard(logger_t *logger) {
@@ -193,10 +564,10 @@ static inline struct logger_shard *find_cli_shard(logger_t *logger) {
     return shard;
 }
 
-logger_cli_t *logger_cli_create(logger_t *logger, size_t log_region_size, int id) {
-    struct logger_shard *shard;
+/* set up a client with the log region at @logs_off of @shard, appending from @tail on */
+static logger_cli_t *cli_init(logger_t *logger, struct logger_shard *shard, int id,
+                              uint64_t logs_off, size_t log_region_size, size_t tail) {
     logger_cli_t *cli;
-    uint64_t logs_off;
 
     cli = calloc(1, sizeof(*cli));
     if (unlikely(cli == NULL)) {
@@ -210,6 +581,63 @@ logger_cli_t *logger_cli_create(logger_t *logger, size_t log_region_size, int id
 
     cli->lcb_size = logger->lcb_size;
 
+    cli->dev = shard->dev;
+    cli->log_region = shard->dev->start + logs_off;
+    cli->log_region_size = log_region_size;
+    cli->region = log_region_size ? &shard->super->regions[id] : NULL;
+    cli->gen = cli->region ? cli->region->gen : 0;
+
+    cli->flusher = shard->flusher;
+    INIT_LIST_HEAD(&cli->reserved);
+    spin_lock_init(&cli->sync_lock);
+    cli->durability = LOG_BUFFERED;
+    INIT_LIST_HEAD(&cli->group_node);
+
+    cli->head = cli->reclaimed = cli->region ? cli->region->head : 0;
+    cli->tail = tail;
+
+    /* an LCB pair, the spare one is taken over when the current one gets sealed */
+    cli->lcb = malloc(sizeof(struct lcb) + cli->lcb_size);
+    cli->spare = malloc(sizeof(struct lcb) + cli->lcb_size);
+    if (unlikely(!cli->lcb || !cli->spare)) {
+        cli = ERR_PTR(-ENOMEM);
+        pr_err("failed to allocate memory for lcb");
+        goto out;
+    }
+    cli->lcb->cli = cli->spare->cli = cli;
+    cli->lcb->start = cli->lcb->synced = tail;
+
+out:
+    return cli;
+}
+
+logger_cli_t *logger_cli_create(logger_t *logger, size_t log_region_size, int id) {
+    struct logger_region *region;
+    struct logger_shard *shard;
+    logger_cli_t *cli;
+    uint64_t logs_off;
+    int i;
+
+    if (unlikely(id < 0 || id >= NR_CLIS_MAX)) {
+        cli = ERR_PTR(-EINVAL);
+        pr_err("invalid logger client ID %d", id);
+        goto out;
+    }
+
+    /* take over the logs of the client with the same ID from the last run */
+    cli = logger->clis[id];
+    if (cli && cli->recovered) {
+        if (unlikely(cli->log_region_size != log_region_size)) {
+            cli = ERR_PTR(-EINVAL);
+            pr_err("logger client #%d had a log region of %luB, not %luB",
+                   id, logger->clis[id]->log_region_size, log_region_size);
+            goto out;
+        }
+        cli->recovered = false;
+        pr_debug(10, "take over logger client #%d (head=%lu, tail=%lu)", id, cli->head, cli->tail);
+        goto out;
+    }
+
     shard = find_cli_shard(logger);
     if (unlikely(!shard)) {
         cli = ERR_PTR(-ENODEV);
@@ -223,8 +651,32 @@ logger_cli_t *logger_cli_create(logger_t *logger, size_t log_region_size, int id
         pr_err("failed to allocate memory for logs: %s", strerror(-PTR_ERR(logs_off)));
         goto out;
     }
-    cli->log_region = shard->dev->start + logs_off;
-    cli->log_region_size = log_region_size;
+
+    if (log_region_size) {
+        /* the region is found in this shard from now on */
+        for (i = 0; i < logger->nr_shards; i++) {
+            region = &logger->shards[i].super->regions[id];
+            if (&logger->shards[i] != shard && region->size) {
+                region->size = 0;
+                flush_range(region, sizeof(*region));
+            }
+        }
+        region = &shard->super->regions[id];
+        region->off = logs_off;
+        region->size = log_region_size;
+        region->head = 0;
+        spin_lock(&logger->lock);
+        region->gen = shard->super->gen = ++logger->gen;
+        spin_unlock(&logger->lock);
+        flush_range(region, sizeof(*region));
+        flush_range(&shard->super->gen, sizeof(shard->super->gen));
+        memory_sfence();
+    }
+
+    cli = cli_init(logger, shard, id, logs_off, log_region_size, 0);
+    if (unlikely(IS_ERR(cli))) {
+        goto out;
+    }
 
     logger->clis[id] = cli;
 
@@ -235,83 +687,449 @@ out:
     return cli;
 }
 
-void logger_cli_destroy(logger_cli_t *logger_cli) {
-    free(logger_cli);
+/* the valid log at @off of @cli's ring, NULL if there's none */
+static struct oplog_data *log_at(logger_cli_t *cli, size_t off) {
+    size_t phys = log_phys(cli, off);
+    struct oplog_data *log;
+
+    if (phys + sizeof(*log) > cli->log_region_size) {
+        return NULL;
+    }
+
+    log = cli->log_region + phys;
+    if (log->key_len > cli->logger->kc->max_len || phys + sizeof(*log) + log->key_len > cli->log_region_size ||
+        log->csum != log_csum(cli, log, off) || log->op >= NR_OP_TYPES) {
+        return NULL;
+    }
+
+    return log;
 }
 
-static void free_lcb(struct rcu_head *head) {
-    struct lcb *lcb = container_of(head, struct lcb, rcu);
-    free(lcb);
+/* the valid log at @*off or, if it was skipped to the start of the region, right after, NULL at the tail */
+static struct oplog_data *next_log(logger_cli_t *cli, size_t *off) {
+    size_t phys = log_phys(cli, *off), next;
+    struct oplog_data *log;
+
+    log = log_at(cli, *off);
+    if (!log && phys) {
+        next = *off + (cli->log_region_size - phys);
+        log = log_at(cli, next);
+        if (log) {
+            *off = next;
+        }
+    }
+
+    return log;
+}
+
+struct recover_task {
+    logger_t *logger;
+    struct logger_shard *shard;
+    pthread_t thread;
+    uint64_t max_stamp;
+    int ret;
+};
+
+/* bring back clients of a shard with their logs after the persisted heads */
+static void *recover_shard(void *arg) {
+    struct recover_task *task = arg;
+    struct logger_shard *shard = task->shard;
+    logger_t *logger = task->logger;
+    struct logger_region *region;
+    struct oplog_data *log;
+    logger_cli_t *cli;
+    size_t off, nr;
+    int id;
+
+    for (id = 0; id < NR_CLIS_MAX; id++) {
+        region = &shard->super->regions[id];
+        if (!region->size) {
+            continue;
+        }
+
+        allocator_mark_used(shard->allocator, region->off, region->size);
+
+        cli = cli_init(logger, shard, id, region->off, region->size, region->head);
+        if (unlikely(IS_ERR(cli))) {
+            task->ret = PTR_ERR(cli);
+            break;
+        }
+
+        /* find the tail, the first log whose checksum fails (torn or stale) */
+        off = cli->head;
+        nr = 0;
+        while ((log = next_log(cli, &off))) {
+            task->max_stamp = max(task->max_stamp, log->stamp);
+            off += sizeof(*log) + log->key_len;
+            nr++;
+        }
+        cli->tail = cli->lcb->start = cli->lcb->synced = off;
+        cli->recovered = true;
+
+        if (unlikely(!cmpxchg2(&logger->clis[id], NULL, cli))) {
+            pr_warn("logger client #%d found in several shards, ignoring one", id);
+            free(cli->lcb);
+            free(cli->spare);
+            free(cli);
+            continue;
+        }
+
+        spin_lock(&logger->lock);
+        shard->nr_clis++;
+        spin_unlock(&logger->lock);
+
+        pr_debug(10, "recovered logger client #%d, %lu logs (head=%lu, tail=%lu)", id, nr, cli->head, cli->tail);
+    }
+
+    return NULL;
+}
+
+static int recover_clis(logger_t *logger) {
+    struct recover_task *tasks;
+    uint64_t max_stamp = 0, now;
+    int i, ret = 0;
+
+    tasks = calloc(logger->nr_shards, sizeof(*tasks));
+    if (unlikely(!tasks)) {
+        pr_err("failed to allocate memory for recovery tasks");
+        return -ENOMEM;
+    }
+
+    /* shards are scanned in parallel */
+    for (i = 0; i < logger->nr_shards; i++) {
+        tasks[i].logger = logger;
+        tasks[i].shard = &logger->shards[i];
+        ret = pthread_create(&tasks[i].thread, NULL, recover_shard, &tasks[i]);
+        if (unlikely(ret)) {
+            pr_err("failed to create recovery thread: %s", strerror(ret));
+            ret = -ret;
+            break;
+        }
+    }
+
+    while (i--) {
+        pthread_join(tasks[i].thread, NULL);
+        max_stamp = max(max_stamp, tasks[i].max_stamp);
+        ret = ret ? : tasks[i].ret;
+    }
+
+    free(tasks);
+
+    /* TSC restarts from zero after a reboot */
+    now = get_tsc();
+    if (max_stamp >= now) {
+        logger->stamp_base = max_stamp - now + 1;
+    }
+
+    return ret;
+}
+
+struct recovered_log {
+    uint64_t stamp;
+    oplog_t log;
+};
+
+static int cmp_recovered_log(const void *a, const void *b) {
+    const struct recovered_log *x = a, *y = b;
+
+    if (x->stamp != y->stamp) {
+        return x->stamp < y->stamp ? -1 : 1;
+    }
+    /* same client and batch, or a tie between clients */
+    return x->log < y->log ? -1 : x->log > y->log;
+}
+
+/*
+ * Logs left by the last run (after the persisted heads) of clients not taken over yet, in the
+ * order they were appended. Return the nr of logs in @*nr, the caller frees the array.
+ */
+oplog_t *logger_recovered_logs(logger_t *logger, size_t *nr) {
+    struct recovered_log *logs = NULL, *tmp;
+    struct oplog_data *log;
+    size_t n = 0, cap = 0, off;
+    struct oplog_ptr p;
+    logger_cli_t *cli;
+    oplog_t *out;
+    int id;
+
+    for (id = 0; id < NR_CLIS_MAX; id++) {
+        cli = logger->clis[id];
+        if (!cli || !cli->recovered) {
+            continue;
+        }
+
+        p.cli_id = id;
+        for (off = cli->head; off < cli->tail && (log = next_log(cli, &off)); off += sizeof(*log) + log->key_len) {
+            if (n == cap) {
+                cap = max(cap * 2, 1024ul);
+                tmp = realloc(logs, cap * sizeof(*logs));
+                if (unlikely(!tmp)) {
+                    free(logs);
+                    out = ERR_PTR(-ENOMEM);
+                    pr_err("failed to allocate memory for recovered logs");
+                    goto out;
+                }
+                logs = tmp;
+            }
+            p.off = off;
+            logs[n].stamp = log->stamp;
+            logs[n].log = p.raw;
+            n++;
+        }
+    }
+
+    qsort(logs, n, sizeof(*logs), cmp_recovered_log);
+
+    /* in place, oplog_t is no larger than recovered_log */
+    out = (oplog_t *) logs;
+    for (off = 0; off < n; off++) {
+        out[off] = logs[off].log;
+    }
+    *nr = n;
+
+out:
+    return out;
 }
 
-static int flush_lcb(logger_cli_t *logger_cli) {
-    struct lcb *old_lcb, *new_lcb;
-    size_t size, off;
+/* persist all logs appended by @logger_cli so far, must be called by its owner */
+int logger_sync(logger_cli_t *logger_cli) {
+    spin_lock(&logger_cli->sync_lock);
+    sync_lcb(logger_cli);
+    spin_unlock(&logger_cli->sync_lock);
+
+    /* the flusher does not wait for readers, so we may wait for it within read-side sections */
+    while (unlikely(READ_ONCE(logger_cli->sealed))) {
+        cpu_relax();
+    }
+
+    return 0;
+}
+
+int logger_cli_set_durability(logger_cli_t *logger_cli, log_durability_t durability,
+                              int max_delay_us, size_t max_size) {
+    struct logger_flusher *flusher = logger_cli->flusher;
     int ret = 0;
 
-    /* flush data into pmem */
-    off = logger_cli->lcb->start;
-    size = logger_cli->tail - off;
-    memcpy_nt(logger_cli->log_region + off, logger_cli->lcb, size);
-    memory_sfence();
+    if (unlikely(durability < 0 || durability >= NR_LOG_DURABILITIES || max_delay_us < 0)) {
+        ret = -EINVAL;
+        pr_err("invalid durability %d (max delay %dus) for logger client #%d",
+               durability, max_delay_us, logger_cli->id);
+        goto out;
+    }
 
-    /* allocate new LCB, we do not overwrite old LCB since some lock-free readers may accessing it */
-    new_lcb = malloc(sizeof(struct lcb) + logger_cli->lcb_size);
-    new_lcb->start = logger_cli->tail;
-    if (unlikely(new_lcb == NULL)) {
-        ret = -ENOMEM;
-        pr_err("failed to allocate memory for lcb");
+    if (unlikely(durability == LOG_GROUP_COMMIT && !max_delay_us && !max_size)) {
+        ret = -EINVAL;
+        pr_err("group commit of logger client #%d needs a max delay or size", logger_cli->id);
         goto out;
     }
 
-    /* delay free old LCB (until no readers see it) */
-    old_lcb = logger_cli->lcb;
-    call_rcu(&old_lcb->rcu, free_lcb);
+    spin_lock(&flusher->group_lock);
 
-    /* replace current LCB */
-    rcu_assign_pointer(logger_cli->lcb, new_lcb);
+    if (logger_cli->durability == LOG_GROUP_COMMIT) {
+        list_del_init(&logger_cli->group_node);
+    }
+
+    spin_lock(&logger_cli->sync_lock);
+    logger_cli->durability = durability;
+    logger_cli->group_commit_ns = (uint64_t) max_delay_us * 1000;
+    logger_cli->group_commit_size = max_size;
+    logger_cli->unsynced_since = 0;
+    spin_unlock(&logger_cli->sync_lock);
 
-    pr_debug(20, "lcb flush, cli=%d, off=%lu, size=%lu, lcb:%p->%p",
-             logger_cli->id, off, size, old_lcb, new_lcb);
+    if (durability == LOG_GROUP_COMMIT) {
+        list_add_tail(&logger_cli->group_node, &flusher->group_clis);
+    }
+
+    spin_unlock(&flusher->group_lock);
+
+    /* logs appended before count as well */
+    if (durability != LOG_BUFFERED) {
+        logger_sync(logger_cli);
+    }
+
+    pr_debug(10, "logger client #%d durability: %d, max delay %dus, max size %luB",
+             logger_cli->id, durability, max_delay_us, max_size);
 
 out:
     return ret;
 }
 
-oplog_t logger_append(logger_cli_t *logger_cli, op_t op, k_t key, uint64_t valp, oplog_t depend) {
-    struct oplog_data *log;
-    struct oplog_ptr p;
-    size_t lcb_used;
+void logger_cli_quiesce(logger_cli_t *logger_cli) {
+    logger_cli_set_durability(logger_cli, LOG_BUFFERED, 0, 0);
+
+    /* wait for the flusher to be done with our sealed LCB, and to queue its release */
+    while (READ_ONCE(logger_cli->flushing)) {
+        cpu_relax();
+    }
+}
+
+void logger_cli_destroy(logger_cli_t *logger_cli) {
+    struct lcb *lcb, *tmp;
+
+    /* the ID is free again, a client created with it must not take this one over */
+    WRITE_ONCE(logger_cli->logger->clis[logger_cli->id], NULL);
+
+    list_for_each_entry_safe(lcb, tmp, &logger_cli->reserved, node) {
+        free(lcb);
+    }
+    free(logger_cli->lcb);
+    free(logger_cli->spare);
+    free(logger_cli);
+}
+
+/* persist logs appended so far, due to the durability of @logger_cli */
+static inline void log_commit(logger_cli_t *logger_cli) {
+    size_t unsynced;
+
+    switch (logger_cli->durability) {
+        case LOG_SYNC:
+            logger_sync(logger_cli);
+            break;
+
+        case LOG_GROUP_COMMIT:
+            unsynced = logger_cli->tail - READ_ONCE(logger_cli->lcb->synced);
+            if (logger_cli->group_commit_size && unsynced >= logger_cli->group_commit_size) {
+                spin_lock(&logger_cli->sync_lock);
+                sync_lcb(logger_cli);
+                spin_unlock(&logger_cli->sync_lock);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ * Seal the full LCB and switch to the spare one. The sealed LCB is persisted by the flusher in
+ * background, or right here if the flusher has not even finished with the previous one yet.
+ */
+static int switch_lcb(logger_cli_t *logger_cli) {
+    struct lcb *old_lcb = logger_cli->lcb, *new_lcb;
+
+    /* only release_lcb fills the spare slot, and only when empty */
+    new_lcb = READ_ONCE(logger_cli->spare);
+    if (likely(new_lcb)) {
+        WRITE_ONCE(logger_cli->spare, NULL);
+    } else if (!list_empty(&logger_cli->reserved)) {
+        new_lcb = list_first_entry(&logger_cli->reserved, struct lcb, node);
+        list_del(&new_lcb->node);
+        logger_cli->nr_reserved--;
+    } else {
+        /* the spare one is still seen by some lock-free readers, do not wait for them */
+        new_lcb = malloc(sizeof(struct lcb) + logger_cli->lcb_size);
+        if (unlikely(new_lcb == NULL)) {
+            pr_err("failed to allocate memory for lcb");
+            return -ENOMEM;
+        }
+        new_lcb->cli = logger_cli;
+    }
+
+    spin_lock(&logger_cli->sync_lock);
+
+    old_lcb->end = logger_cli->tail;
+
+    if (old_lcb->synced >= old_lcb->end) {
+        /* persisted by syncs already */
+        call_rcu(&old_lcb->rcu, release_lcb);
+    } else if (likely(!READ_ONCE(logger_cli->sealed))) {
+        /* readers look into the sealed LCB until it is persisted */
+        WRITE_ONCE(logger_cli->flushing, true);
+        rcu_assign_pointer(logger_cli->sealed, old_lcb);
+        flusher_submit(logger_cli->flusher, old_lcb);
+    } else {
+        persist_lcb(old_lcb);
+        /* delay release of old LCB (until no readers see it) */
+        call_rcu(&old_lcb->rcu, release_lcb);
+    }
+
+    /* replace current LCB */
+    new_lcb->start = new_lcb->synced = logger_cli->tail;
+    rcu_assign_pointer(logger_cli->lcb, new_lcb);
+
+    spin_unlock(&logger_cli->sync_lock);
+
+    return 0;
+}
+
+/*
+ * Make room for a log of @size bytes at the tail: it must fit into the LCB, and must not wrap
+ * around the end of the region (the tail skips to the start of the region then). Return
+ * -ENOSPC if the ring is full, until log GC reclaims the oldest logs.
+ */
+static int log_reserve(logger_cli_t *logger_cli, size_t size) {
+    size_t phys, pad = 0, lcb_used;
     int ret;
 
-    /* generate new log pointer */
-    p.cli_id = logger_cli->id;
-    p.off = logger_cli->tail;
+    if (unlikely(size > logger_cli->lcb_size || size > logger_cli->log_region_size)) {
+        return -E2BIG;
+    }
 
-    lcb_used = logger_cli->tail - logger_cli->lcb->start;
-    log = (void *) logger_cli->lcb->data + lcb_used;
+    phys = log_phys(logger_cli, logger_cli->tail);
+    if (unlikely(phys + size > logger_cli->log_region_size)) {
+        pad = logger_cli->log_region_size - phys;
+    }
+
+    if (unlikely(logger_cli->tail + pad + size > READ_ONCE(logger_cli->reclaimed) + logger_cli->log_region_size)) {
+        return -ENOSPC;
+    }
 
     /* special case: LCB full */
-    if (unlikely(lcb_used + sizeof(*log) + key.len > logger_cli->lcb_size)) {
-        ret = flush_lcb(logger_cli);
+    lcb_used = logger_cli->tail - logger_cli->lcb->start;
+    if (unlikely(lcb_used && lcb_used + pad + size > logger_cli->lcb_size)) {
+        ret = switch_lcb(logger_cli);
         if (unlikely(ret)) {
-            p.raw = ret;
-            pr_err("failed to flush lcb");
-        } else {
-            p.raw = logger_append(logger_cli, op, key, valp, depend);
+            pr_err("failed to switch lcb");
+            return ret;
+        }
+        lcb_used = 0;
+    }
+
+    if (!lcb_used) {
+        /* nothing in the LCB yet, the skipped space needs not be in it either */
+        WRITE_ONCE(logger_cli->lcb->start, logger_cli->tail + pad);
+        smp_wmb();
+    }
+    WRITE_ONCE(logger_cli->tail, logger_cli->tail + pad);
+
+    return 0;
+}
+
+oplog_t logger_append(logger_cli_t *logger_cli, op_t op, k_t key, uint64_t valp, oplog_t depend) {
+    struct oplog_data *log;
+    struct oplog_ptr p;
+    int ret;
+
+    ret = log_reserve(logger_cli, sizeof(*log) + key.len);
+    if (unlikely(ret)) {
+        p.raw = ret;
+        if (ret != -ENOSPC) {
+            pr_err("failed to reserve log space: %s", strerror(-ret));
         }
         goto out;
     }
 
+    /* generate new log pointer */
+    p.cli_id = logger_cli->id;
+    p.off = logger_cli->tail;
+
+    log = (void *) logger_cli->lcb->data + (logger_cli->tail - logger_cli->lcb->start);
+
     /* copy log into LCB */
     log->op = op;
     log->key_len = key.len;
     log->valp = valp;
     log->depend = depend;
+    log->rsvd = 0;
+    log->stamp = get_tsc() + logger_cli->logger->stamp_base;
     memcpy(log->key, key.key, key.len);
+    log->csum = log_csum(logger_cli, log, p.off);
+
+    /* forward tail, the log must be in the LCB before the flusher may sync it */
+    smp_wmb();
+    WRITE_ONCE(logger_cli->tail, logger_cli->tail + sizeof(*log) + key.len);
 
-    /* forward tail */
-    logger_cli->tail += sizeof(*log) + key.len;
+    log_commit(logger_cli);
 
     pr_debug(30, "log append, cli=%d, off=%lu, key=%s, valp=%lx,",
              logger_cli->id, p.off, k_str(logger_cli->logger->kc, key), valp);
@@ -320,52 +1138,198 @@ out:
     return p.raw;
 }
 
+/* make sure the next @nr LCB switches find an LCB at hand */
+static int reserve_lcbs(logger_cli_t *logger_cli, int nr) {
+    struct lcb *lcb;
+
+    /* only release_lcb fills the spare slot, so it stays filled until we switch */
+    nr -= (READ_ONCE(logger_cli->spare) ? 1 : 0) + logger_cli->nr_reserved;
+
+    for (; nr > 0; nr--) {
+        lcb = malloc(sizeof(struct lcb) + logger_cli->lcb_size);
+        if (unlikely(!lcb)) {
+            pr_err("failed to allocate memory for lcb");
+            return -ENOMEM;
+        }
+        lcb->cli = logger_cli;
+        list_add(&lcb->node, &logger_cli->reserved);
+        logger_cli->nr_reserved++;
+    }
+
+    return 0;
+}
+
+/*
+ * Append @n logs (all OP_PUT if @ops is NULL) back to back, the LCB is flushed only when full.
+ * Either all logs are appended, or none (-ENOSPC if the ring can't take them all now).
+ */
+int logger_append_batch(logger_cli_t *logger_cli, int n, const op_t *ops,
+                        const k_t *keys, const uint64_t *vals, oplog_t *logs) {
+    size_t size, end, phys, pad, lcb_used;
+    int i, nr_switches = 0, ret = 0;
+    struct oplog_data *log;
+    struct oplog_ptr p;
+    uint64_t stamp;
+
+    /*
+     * Lay the batch out the way log_reserve will, so that it fails (if at all) before the first
+     * log is appended: each log must fit into an LCB, the batch into the free space of the ring,
+     * and an LCB must be at hand for each switch on the way.
+     */
+    end = logger_cli->tail;
+    lcb_used = end - logger_cli->lcb->start;
+    for (i = 0; i < n; i++) {
+        size = sizeof(*log) + keys[i].len;
+        if (unlikely(size > logger_cli->lcb_size)) {
+            ret = -E2BIG;
+            pr_err("log of %lu bytes does not fit into an LCB", size);
+            goto out;
+        }
+
+        phys = log_phys(logger_cli, end);
+        pad = phys + size > logger_cli->log_region_size ? logger_cli->log_region_size - phys : 0;
+        if (lcb_used && lcb_used + pad + size > logger_cli->lcb_size) {
+            nr_switches++;
+            lcb_used = 0;
+        }
+        /* the skipped space is left out of an empty LCB */
+        lcb_used += lcb_used ? pad + size : size;
+        end += pad + size;
+    }
+    size = end - logger_cli->tail;
+    if (unlikely(size > logger_cli->log_region_size)) {
+        ret = -E2BIG;
+        pr_err("log batch of %lu bytes does not fit into the log region", size);
+        goto out;
+    }
+    if (unlikely(end > READ_ONCE(logger_cli->reclaimed) + logger_cli->log_region_size)) {
+        ret = -ENOSPC;
+        goto out;
+    }
+    ret = reserve_lcbs(logger_cli, nr_switches);
+    if (unlikely(ret)) {
+        goto out;
+    }
+
+    p.cli_id = logger_cli->id;
+
+    /* logs of a batch share the stamp, they are ordered by offset */
+    stamp = get_tsc() + logger_cli->logger->stamp_base;
+
+    for (i = 0; i < n; i++) {
+        /* laid out above, nothing can fail half way through the batch */
+        ret = log_reserve(logger_cli, sizeof(*log) + keys[i].len);
+        bonsai_assert(!ret);
+
+        /* copy log into LCB */
+        log = (void *) logger_cli->lcb->data + (logger_cli->tail - logger_cli->lcb->start);
+        log->op = ops ? ops[i] : OP_PUT;
+        log->key_len = keys[i].len;
+        log->valp = vals[i];
+        log->depend = 0;
+        log->rsvd = 0;
+        log->stamp = stamp;
+        memcpy(log->key, keys[i].key, keys[i].len);
+        log->csum = log_csum(logger_cli, log, logger_cli->tail);
+
+        p.off = logger_cli->tail;
+        logs[i] = p.raw;
+
+        smp_wmb();
+        WRITE_ONCE(logger_cli->tail, logger_cli->tail + sizeof(*log) + keys[i].len);
+    }
+
+    log_commit(logger_cli);
+
+    pr_debug(30, "log append batch, cli=%d, tail=%lu, size=%lu", logger_cli->id, logger_cli->tail, size);
+
+out:
+    return ret;
+}
+
+/* whether @logger_cli's ring is filled beyond 3/4, so that log GC should better run now */
+bool logger_is_filling(logger_cli_t *logger_cli) {
+    size_t used = logger_cli->tail - READ_ONCE(logger_cli->reclaimed);
+    return used > logger_cli->log_region_size / 4 * 3;
+}
+
 op_t logger_get(logger_cli_t *logger_cli, oplog_t log, k_t *key, uint64_t *valp) {
     struct oplog_ptr o = { .raw = log };
     logger_cli_t *target_cli;
+    struct lcb *lcb, *sealed;
     struct oplog_data *data;
-    struct lcb *lcb;
     op_t op;
 
     /* get the client of the oplog */
     target_cli = logger_cli->logger->clis[o.cli_id];
     bonsai_assert(target_cli);
 
+    /* the LCB is sealed before the switch, see it before the new one goes */
     lcb = rcu_dereference(target_cli->lcb);
+    sealed = rcu_dereference(target_cli->sealed);
 
-    /* log in PM or LCB? */
-    if (likely(o.off < lcb->start)) {
-        /* in PM */
-        bonsai_assert(o.off < target_cli->log_region_size);
-        data = target_cli->log_region + o.off;
-    } else {
+    /* log in PM, LCB, or sealed LCB? */
+    if (unlikely(o.off >= lcb->start)) {
         /* in LCB */
         bonsai_assert(o.off - lcb->start < target_cli->lcb_size);
         data = (void *) lcb->data + (o.off - lcb->start);
+    } else if (unlikely(sealed && o.off >= sealed->start && o.off < sealed->end)) {
+        /* in sealed LCB, not persisted yet */
+        data = (void *) sealed->data + (o.off - sealed->start);
+    } else {
+        /* in PM */
+        bonsai_assert(o.off >= target_cli->reclaimed && o.off < target_cli->tail);
+        data = target_cli->log_region + log_phys(target_cli, o.off);
     }
 
+#ifdef LOG_VERIFY_READS
+    /* callers trust what they get, there is no serving a corrupted log */
+    if (unlikely(data->csum != log_csum(target_cli, data, o.off))) {
+        pr_err("corrupted log, cli=%d, off=%lu", o.cli_id, (size_t) o.off);
+        abort();
+    }
+#endif
+
     /* get log pointer */
     op = data->op;
     key->key = data->key;
     key->len = data->key_len;
     *valp = data->valp;
 
-out:
     return op;
 }
 
+/* copy logs of [@head, @tail) that are within [@start, @end) from LCB data @data to @dst */
+static inline void lcb_cpy(void *dst, size_t head, size_t tail, const char *data, size_t start, size_t end) {
+    size_t from = max(head, start), to = min(tail, end);
+
+    if (from < to) {
+        memcpy(dst + (from - head), data + (from - start), to - from);
+    }
+}
+
 static inline void logger_cpy(logger_cli_t *cli, void *dst, size_t head, size_t tail) {
-    struct lcb *lcb;
+    struct lcb *lcb, *sealed;
+    size_t start;
+
+    rcu_read_lock();
 
     lcb = rcu_dereference(cli->lcb);
+    sealed = rcu_dereference(cli->sealed);
+    start = READ_ONCE(lcb->start);
 
-    /* copy in-PM logs to dst */
-    bonsai_assert(lcb->start - head <= cli->log_region_size);
-    memcpy(dst, cli->log_region + head, lcb->start - head);
+    /* copy in-PM logs to dst, the range of the sealed LCB is overwritten below */
+    bonsai_assert(tail - head <= cli->log_region_size);
+    region_read(cli, dst, head, max(head, min(start, tail)) - head);
 
     /* copy in-LCB logs to dst */
-    bonsai_assert(tail - lcb->start <= cli->lcb_size);
-    memcpy(dst + lcb->start - head, lcb->data, tail - lcb->start);
+    if (sealed) {
+        lcb_cpy(dst, head, tail, sealed->data, sealed->start, sealed->end);
+    }
+    bonsai_assert(tail <= start || tail - start <= cli->lcb_size);
+    lcb_cpy(dst, head, tail, lcb->data, start, tail);
+
+    rcu_read_unlock();
 }
 
 bool logger_is_stale(logger_cli_t *logger_cli, oplog_t log) {
@@ -421,7 +1385,7 @@ op_t logger_get_within_barrier(logger_barrier_t *barrier, oplog_t log, k_t *key,
         goto out;
     }
 
-    if (unlikely(log < cb->head_snap || log >= cb->tail_snap)) {
+    if (unlikely(o.off < cb->head_snap || o.off >= cb->tail_snap)) {
         /* not within range */
         op = -ENOENT;
         goto out;
@@ -434,7 +1398,15 @@ op_t logger_get_within_barrier(logger_barrier_t *barrier, oplog_t log, k_t *key,
     }
 
     /* read log in DRAM (fast path) */
-    data = cb->prefetched + (log - cb->head_snap);
+    data = cb->prefetched + (o.off - cb->head_snap);
+
+#ifdef LOG_VERIFY_READS
+    if (unlikely(data->csum != log_csum(cb->cli, data, o.off))) {
+        pr_err("corrupted log, cli=%d, off=%lu", o.cli_id, (size_t) o.off);
+        abort();
+    }
+#endif
+
     op = data->op;
     key->key = data->key;
     key->len = data->key_len;
@@ -501,6 +1473,37 @@ void logger_gc_before_barrier(logger_barrier_t *barrier) {
     }
 }
 
+/*
+ * Let the space of logs GCed by logger_gc_before_barrier be reused. The caller must make sure
+ * that no stale log is referenced by the shim layer, or by any lock-free reader, anymore, and
+ * that the data layer has flushed what these logs brought in: the new heads are persisted, and
+ * recovery replays logs from there on.
+ */
+void logger_reclaim_before_barrier(logger_barrier_t *barrier) {
+    struct logger_cli_barrier *cb;
+    int i;
+
+    /* the data layer goes first */
+    memory_sfence();
+
+    for (i = 0; i < NR_CLIS_MAX; i++) {
+        cb = &barrier->cli_barriers[i];
+        if (!cb->cli) {
+            continue;
+        }
+
+        bonsai_assert(cb->cli->reclaimed <= cb->cli->head);
+        WRITE_ONCE(cb->cli->reclaimed, cb->tail_snap);
+
+        if (cb->cli->region) {
+            cb->cli->region->head = cb->tail_snap;
+            flush_range(&cb->cli->region->head, sizeof(cb->cli->region->head));
+        }
+    }
+
+    memory_sfence();
+}
+
 cJSON *logger_dump_log(logger_cli_t *logger_cli, oplog_t log) {
     uint64_t valp;
     cJSON *out;
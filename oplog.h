@@ -15,11 +15,25 @@
 #include <unistd.h>
 #include <stdint.h>
 
+/* logger client IDs are within [0, NR_CLIS_MAX) */
+#define NR_CLIS_MAX      1024
+
 typedef enum {
     OP_PUT = 0,
     OP_DEL,
     NR_OP_TYPES
 } op_t;
+/* when appended logs are persisted */
+typedef enum {
+    /* once the LCB fills up */
+    LOG_BUFFERED = 0,
+    /* within a max delay, or once enough bytes of logs pile up in the LCB */
+    LOG_GROUP_COMMIT,
+    /* before logger_append returns */
+    LOG_SYNC,
+    NR_LOG_DURABILITIES
+} log_durability_t;
+
 typedef struct logger logger_t;
 typedef struct logger_cli logger_cli_t;
 typedef struct logger_barrier logger_barrier_t;
@@ -30,20 +44,38 @@ static const char *op_str[] = {
     [OP_DEL] = "del"
 };
 
-logger_t *logger_create(kc_t *kc, int nr_shards, const char *shard_devs[], size_t lcb_size);
+/* with @recover, clients of the last run are brought back with the logs they left in PM */
+logger_t *logger_create(kc_t *kc, int nr_shards, const char *shard_devs[], size_t lcb_size, bool recover);
 void logger_destroy(logger_t *logger);
+/* a client with the ID of a recovered one takes over its log region and logs */
 logger_cli_t *logger_cli_create(logger_t *logger, size_t log_region_size, int id);
+/*
+ * Destroying a client takes a quiesce, and then a reclaim_barrier for the LCB releases still
+ * pending before logger_cli_destroy.
+ */
+void logger_cli_quiesce(logger_cli_t *logger_cli);
 void logger_cli_destroy(logger_cli_t *logger_cli);
+/* for LOG_GROUP_COMMIT, @max_delay_us or @max_size of 0 leaves out that bound */
+int logger_cli_set_durability(logger_cli_t *logger_cli, log_durability_t durability,
+                              int max_delay_us, size_t max_size);
 
 oplog_t logger_append(logger_cli_t *logger_cli, op_t op, k_t key, uint64_t valp, oplog_t depend);
+int logger_append_batch(logger_cli_t *logger_cli, int n, const op_t *ops,
+                        const k_t *keys, const uint64_t *vals, oplog_t *logs);
+int logger_sync(logger_cli_t *logger_cli);
 op_t logger_get(logger_cli_t *logger_cli, oplog_t log, k_t *key, uint64_t *valp);
 
+bool logger_is_filling(logger_cli_t *logger_cli);
+
+oplog_t *logger_recovered_logs(logger_t *logger, size_t *nr);
+
 bool logger_is_stale(logger_cli_t *logger_cli, oplog_t log);
 
 logger_barrier_t *logger_snap_barrier(logger_cli_t *logger_cli, size_t *total);
 op_t logger_get_within_barrier(logger_barrier_t *barrier, oplog_t log, k_t *key, uint64_t *valp);
 void logger_prefetch_until_barrier(logger_barrier_t *barrier);
 void logger_gc_before_barrier(logger_barrier_t *barrier);
+void logger_reclaim_before_barrier(logger_barrier_t *barrier);
 void logger_destroy_barrier(logger_barrier_t *barrier);
 
 cJSON *logger_dump_log(logger_cli_t *logger_cli, oplog_t log);
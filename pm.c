@@ -6,15 +6,21 @@
  * Hohai University
  */
 
+#define _GNU_SOURCE
+
 #include <ndctl/libdaxctl.h>
 #include <ndctl/libndctl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <numa.h>
 
+#include "atomic.h"
 #include "utils.h"
 #include "pm.h"
 
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024ul)
+
 #define FOREACH_BUS_REGION_NAMESPACE(ctx, bus, region, ndns)	\
 	        ndctl_bus_foreach(ctx, bus)				            \
 	        ndctl_region_foreach(bus, region)			        \
@@ -65,7 +71,7 @@ out:
     return ret;
 }
 
-static int open_dev(struct pm_dev *dev, const char *name) {
+static int open_dax_dev(struct pm_dev *dev, const char *name) {
     char path[256];
     int ret;
 
@@ -85,7 +91,9 @@ static int open_dev(struct pm_dev *dev, const char *name) {
     dev->start = mmap(NULL, dev->size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
     if (unlikely(dev->start == MAP_FAILED)) {
         ret = -errno;
+        dev->start = NULL;
         pr_err("failed to mmap PM device %s: %s", path, strerror(-ret));
+        goto out;
     }
 
     dev->name = name;
@@ -97,6 +105,154 @@ out:
     return ret;
 }
 
+static int parse_size(const char *s, size_t *size) {
+    char *end;
+
+    *size = strtoull(s, &end, 0);
+    switch (*end) {
+        case 'G': case 'g': *size <<= 10;
+            /* fallthrough */
+        case 'M': case 'm': *size <<= 10;
+            /* fallthrough */
+        case 'K': case 'k': *size <<= 10;
+            end++;
+        default:
+            break;
+    }
+
+    return *size && (!*end || *end == '@' || *end == ',') ? 0 : -EINVAL;
+}
+
+/* parse "<size>[@<node>][,lat=<ns>][,bw=<MB/s>]" */
+static int parse_emu_params(struct pm_dev *dev, const char *s) {
+    const char *p;
+    int ret;
+
+    ret = parse_size(s, &dev->size);
+    if (unlikely(ret)) {
+        goto out;
+    }
+
+    dev->socket = -1;
+    p = strchr(s, '@');
+    if (p) {
+        dev->socket = atoi(p + 1);
+        if (unlikely(dev->socket < 0 || dev->socket > numa_max_node())) {
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    for (p = strchr(s, ','); p; p = strchr(p + 1, ',')) {
+        if (!strncmp(p + 1, "lat=", 4)) {
+            dev->emu_lat_ns = strtoull(p + 5, NULL, 0);
+        } else if (!strncmp(p + 1, "bw=", 3)) {
+            dev->emu_bw_mbps = strtoull(p + 4, NULL, 0);
+        } else {
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+out:
+    return ret;
+}
+
+static int open_emu_dev(struct pm_dev *dev, const char *name) {
+    char path[256];
+    const char *p;
+    int flags, ret;
+
+    if (dev->type == PM_DEV_FILE) {
+        /* file:<path>:<params> */
+        p = strrchr(name + 5, ':');
+        if (unlikely(!p || p - (name + 5) >= sizeof(path))) {
+            ret = -EINVAL;
+            goto out_inval;
+        }
+        memcpy(path, name + 5, p - (name + 5));
+        path[p - (name + 5)] = '\0';
+        ret = parse_emu_params(dev, p + 1);
+    } else {
+        /* anon:<params> */
+        strcpy(path, "[anon]");
+        ret = parse_emu_params(dev, name + 5);
+    }
+    if (unlikely(ret)) {
+        goto out_inval;
+    }
+
+    if (dev->type == PM_DEV_FILE) {
+        dev->fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (unlikely(dev->fd < 0)) {
+            ret = -errno;
+            pr_err("failed to open PM emulation file %s: %s", path, strerror(-ret));
+            goto out;
+        }
+
+        ret = ftruncate(dev->fd, dev->size);
+        if (unlikely(ret)) {
+            ret = -errno;
+            pr_err("failed to resize PM emulation file %s: %s", path, strerror(-ret));
+            goto out;
+        }
+
+        dev->start = mmap(NULL, dev->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, dev->fd, 0);
+    } else {
+        /* prefer explicit huge pages, fall back to THP */
+        dev->size = ALIGN_UP(dev->size, HUGE_PAGE_SIZE);
+        flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+        dev->start = mmap(NULL, dev->size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (dev->start == MAP_FAILED) {
+            dev->start = mmap(NULL, dev->size, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (likely(dev->start != MAP_FAILED)) {
+                madvise(dev->start, dev->size, MADV_HUGEPAGE);
+            }
+        }
+    }
+    if (unlikely(dev->start == MAP_FAILED)) {
+        ret = -errno;
+        dev->start = NULL;
+        pr_err("failed to mmap emulated PM device %s: %s", name, strerror(-ret));
+        goto out;
+    }
+
+    if (dev->socket >= 0) {
+        numa_tonode_memory(dev->start, dev->size, dev->socket);
+    }
+
+    dev->name = name;
+
+    pr_debug(10, "open emulated PM device name=%s path=%s, size=%.2fMB, socket=%d, lat=%luns, bw=%luMB/s, start=%p",
+             name, path, (double) dev->size / (1 << 20), dev->socket,
+             dev->emu_lat_ns, dev->emu_bw_mbps, dev->start);
+
+out:
+    return ret;
+
+out_inval:
+    pr_err("invalid emulated PM device spec: %s", name);
+    return -EINVAL;
+}
+
+static int open_dev(struct pm_dev *dev, const char *name) {
+    /* nothing to close yet if opening fails early */
+    dev->fd = -1;
+
+    if (!strncmp(name, "anon:", 5)) {
+        dev->type = PM_DEV_ANON;
+        return open_emu_dev(dev, name);
+    }
+
+    if (!strncmp(name, "file:", 5)) {
+        dev->type = PM_DEV_FILE;
+        return open_emu_dev(dev, name);
+    }
+
+    dev->type = PM_DEV_DAX;
+    return open_dax_dev(dev, name);
+}
+
 static void close_dev(struct pm_dev *dev) {
     if (dev->start) {
         munmap(dev->start, dev->size);
@@ -106,6 +262,27 @@ static void close_dev(struct pm_dev *dev) {
     }
 }
 
+/*
+ * The media is modeled as a single queue shared by all writers of @dev: each persist
+ * occupies it for @len / bandwidth, and completes @emu_lat_ns after leaving the queue.
+ */
+void pm_emu_delay(struct pm_dev *dev, size_t len) {
+    uint64_t now, busy, start, end, deadline;
+
+    now = get_ns();
+
+    do {
+        busy = READ_ONCE(dev->emu_busy_until);
+        start = max(now, busy);
+        end = start + (dev->emu_bw_mbps ? len * 1000 / dev->emu_bw_mbps : 0);
+    } while (!cmpxchg2(&dev->emu_busy_until, busy, end));
+
+    deadline = end + dev->emu_lat_ns;
+    while (get_ns() < deadline) {
+        cpu_relax();
+    }
+}
+
 struct pm_dev *pm_open_devs(int nr_devs, const char *dev_names[]) {
     struct pm_dev *devs;
     int i, ret;
@@ -120,6 +297,7 @@ struct pm_dev *pm_open_devs(int nr_devs, const char *dev_names[]) {
     for (i = 0; i < nr_devs; i++) {
         ret = open_dev(&devs[i], dev_names[i]);
         if (unlikely(ret)) {
+            pm_close_devs(i + 1, devs);
             free(devs);
             devs = ERR_PTR(ret);
             pr_err("failed to open PM device %s: %s", dev_names[i], strerror(-ret));
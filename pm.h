@@ -10,6 +10,26 @@
 #define PM_H
 
 #include <stdlib.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+/*
+ * A PM device is either a real devdax namespace (looked up by its ndctl alt name), or an
+ * emulated one, selected by a backend prefix in the device name:
+ *
+ *   anon:<size>[@<node>][,lat=<ns>][,bw=<MB/s>]          anonymous (huge page) DRAM region
+ *   file:<path>:<size>[@<node>][,lat=<ns>][,bw=<MB/s>]   regular or tmpfs (e.g. /dev/shm) file
+ *
+ * <size> accepts K/M/G suffixes. Emulated devices without @<node> have no NUMA affinity
+ * (@socket is -1). If @lat or @bw is given, pm_persist_delay() injects the write latency
+ * and bandwidth profile of the emulated media at each persist point.
+ */
+typedef enum {
+    PM_DEV_DAX = 0,
+    PM_DEV_ANON,
+    PM_DEV_FILE
+} pm_dev_type_t;
 
 struct pm_dev {
     void *start;
@@ -18,9 +38,25 @@ struct pm_dev {
     const char *name;
     size_t size;
     int fd;
+
+    pm_dev_type_t type;
+
+    /* emulated write latency (ns) and bandwidth (MB/s), 0 if not emulated */
+    uint64_t emu_lat_ns, emu_bw_mbps;
+    /* virtual time (ns) until which the emulated media is busy */
+    uint64_t emu_busy_until;
 };
 
 struct pm_dev *pm_open_devs(int nr_devs, const char *dev_names[]);
 void pm_close_devs(int nr_devs, struct pm_dev *devs);
 
+void pm_emu_delay(struct pm_dev *dev, size_t len);
+
+/* call after @len bytes have been flushed and fenced to @dev */
+static inline void pm_persist_delay(struct pm_dev *dev, size_t len) {
+    if (unlikely(dev->emu_lat_ns || dev->emu_bw_mbps)) {
+        pm_emu_delay(dev, len);
+    }
+}
+
 #endif //PM_H
@@ -0,0 +1,76 @@
+/*
+ * BonsaiKV+: Scaling persistent in-memory key-value store for modern tiered, heterogeneous memory systems
+ *
+ * Deferred reclamation
+ *
+ * Hohai University
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "list.h"
+#include "reclaim.h"
+
+struct retired {
+    struct rcu_head rcu;
+    reclaim_fn *fn;
+    void *ctx;
+    uint64_t a, b;
+};
+
+__thread bool reclaim_registered;
+
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static void thread_exit_hook(void *arg) {
+    rcu_unregister_thread();
+}
+
+static void create_exit_key(void) {
+    int ret = pthread_key_create(&exit_key, thread_exit_hook);
+    bonsai_assert(!ret);
+}
+
+void reclaim_register_thread(void) {
+    pthread_once(&exit_key_once, create_exit_key);
+
+    rcu_register_thread();
+    /* the hook only runs for a non-NULL value */
+    pthread_setspecific(exit_key, (void *) 1);
+    reclaim_registered = true;
+}
+
+static void do_reclaim(struct rcu_head *head) {
+    struct retired *r = container_of(head, struct retired, rcu);
+    r->fn(r->ctx, r->a, r->b);
+    free(r);
+}
+
+int reclaim_defer(reclaim_fn *fn, void *ctx, uint64_t a, uint64_t b) {
+    struct retired *r;
+
+    r = malloc(sizeof(*r));
+    if (unlikely(!r)) {
+        /* leak rather than free too early */
+        pr_warn("failed to allocate memory for retired object, leaking it");
+        return -ENOMEM;
+    }
+
+    r->fn = fn;
+    r->ctx = ctx;
+    r->a = a;
+    r->b = b;
+    reclaim_thread_init();
+    call_rcu(&r->rcu, do_reclaim);
+
+    return 0;
+}
+
+void reclaim_barrier(void) {
+    rcu_barrier();
+}
@@ -0,0 +1,55 @@
+/*
+ * BonsaiKV+: Scaling persistent in-memory key-value store for modern tiered, heterogeneous memory systems
+ *
+ * Deferred reclamation
+ *
+ * Lock-free readers (inode lookups, LCB reads, bnode/dnode probes) may still hold a structure
+ * after it is unlinked. Every kv operation runs within a read-side section, and unlinked
+ * structures are retired through reclaim_defer, to be freed or recycled once all sections that
+ * could have seen them are over. Built on liburcu (memb flavor), so that a section costs a
+ * couple of thread-local stores.
+ *
+ * Hohai University
+ */
+
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <urcu.h>
+
+#include "utils.h"
+
+typedef void reclaim_fn(void *ctx, uint64_t a, uint64_t b);
+
+extern __thread bool reclaim_registered;
+
+void reclaim_register_thread(void);
+
+/*
+ * Threads are registered with urcu on first use, and unregistered when they exit, so that a
+ * client may be created and destroyed by different threads.
+ */
+static inline void reclaim_thread_init(void) {
+    if (unlikely(!reclaim_registered)) {
+        reclaim_register_thread();
+    }
+}
+
+static inline void reclaim_read_lock(void) {
+    reclaim_thread_init();
+    rcu_read_lock();
+}
+
+static inline void reclaim_read_unlock(void) {
+    rcu_read_unlock();
+}
+
+/* call @fn(@ctx, @a, @b) once no read-side section can still see the retired object */
+int reclaim_defer(reclaim_fn *fn, void *ctx, uint64_t a, uint64_t b);
+
+/* wait for all deferred reclamation to be done */
+void reclaim_barrier(void);
+
+#endif //RECLAIM_H
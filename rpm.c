@@ -100,6 +100,12 @@
 
 #define MAX_OUTSTANDING_RD_ATOM     16
 
+#define NR_POLL_WC      16
+
+#define LB_HOST_PREFIX  "shm:"
+#define LB_MAX_QPS      256
+#define LB_REP_RKEY     UINT32_MAX
+
 static unsigned epoch;
 
 /*
@@ -156,6 +162,11 @@ struct svr_dom {
     in_addr_t ip;
     in_port_t port;
 
+    /* loopback transport, host "shm:<name>[,rtt=<ns>][,bw=<MB/s>]" */
+    bool loopback;
+    char *lb_name;
+    uint64_t lb_rtt_ns, lb_bw_mbps;
+
     struct cm *cm;
 };
 
@@ -195,6 +206,12 @@ struct cm {
     struct ibv_qp *qp;
     uint32_t rep_rkey;
 
+    /* loopback transport: the cm thread acts as the domain's NIC */
+    struct list_head lb_node;
+    struct lb_qp *lb_qps[LB_MAX_QPS];
+    int nr_lb_qps;
+    uint64_t lb_busy_until;
+
     struct cm_dom doms[];
 };
 
@@ -221,8 +238,14 @@ struct cli_dom {
     int id;
 };
 
-struct wr_list {
-    struct ibv_send_wr *head, *tail;
+/*
+ * Preallocated WR chain. WRs are appended in place and linked as they are posted, so the
+ * post path allocates nothing; the whole chain is recycled once rpma_commit hands it to the QP.
+ */
+struct wr_ring {
+    struct ibv_send_wr wrs[MAX_QP_SR];
+    struct ibv_sge sges[MAX_QP_SR][MAX_SEND_SGE];
+    int nr_wrs;
 };
 
 struct rpma {
@@ -254,12 +277,29 @@ struct rpma_cli {
     struct ibv_qp *qp;
     struct ibv_cq *cq;
 
+    struct lb_qp *lb_qp;
+
     size_t strip_size, stripe_size;
     size_t segment_size;
     size_t logical_size;
 
-    struct wr_list wr_list;
-    int nr_cqe;
+    struct wr_ring wr_ring;
+
+    /*
+     * Every WR of a committed chain carries the chain's ticket as wr_id. Chains complete in
+     * order on the QP, so @done_ticket covers all earlier tickets too. Completion status of
+     * the last MAX_QP_SR tickets is kept in @ticket_status.
+     */
+    rpma_ticket_t last_ticket, done_ticket;
+    enum ibv_wc_status ticket_status[MAX_QP_SR];
+
+    /*
+     * WRs posted so far, and the ones of them completed (up to @done_ticket). A ticket's WRs
+     * leave the SQ once it completes, the nr of WRs posted up to each of the last MAX_QP_SR
+     * tickets is kept in @ticket_wrs, so that no more than MAX_QP_SR WRs are in flight.
+     */
+    uint64_t posted_wrs, done_wrs;
+    uint64_t ticket_wrs[MAX_QP_SR];
 
     allocator_t *cli_buf_allocator;
 
@@ -275,6 +315,52 @@ struct pdata {
     uint32_t dommr_keys[];
 };
 
+/*
+ * Loopback transport
+ *
+ * Without an RNIC, the cm thread of each domain plays the NIC. Clients in the same process
+ * post WRs into a per-client send ring, the cm thread executes them directly against the
+ * domain's PM mappings (following the striped/replicated layout that the mkeys would have
+ * described), and reports signaled WRs through a per-client completion ring. A completion
+ * becomes visible to the poller only after the injected RTT and link occupancy, so the cost
+ * of unbatched round trips stays observable.
+ */
+struct lb_sqe {
+    uint64_t wr_id;
+    uint64_t post_ns;
+    enum ibv_wr_opcode opcode;
+    bool signaled;
+    uint32_t rkey;
+    uint64_t remote_addr;
+    int num_sge;
+    struct ibv_sge sg_list[MAX_SEND_SGE];
+};
+
+struct lb_cqe {
+    uint64_t wr_id;
+    uint64_t ready_ns;
+    enum ibv_wc_opcode opcode;
+    enum ibv_wc_status status;
+};
+
+struct lb_qp {
+    struct cm *cm;
+    bool dead;
+
+    /* send ring: produced by client, consumed by cm */
+    unsigned long sq_head __attribute__((aligned(CACHELINE_SIZE)));
+    unsigned long sq_tail __attribute__((aligned(CACHELINE_SIZE)));
+    struct lb_sqe sq[MAX_QP_SR];
+
+    /* completion ring: produced by cm, consumed by client */
+    unsigned long cq_head __attribute__((aligned(CACHELINE_SIZE)));
+    unsigned long cq_tail __attribute__((aligned(CACHELINE_SIZE)));
+    struct lb_cqe cq[MAX_QP_SR];
+};
+
+static LIST_HEAD(lb_cms);
+static pthread_mutex_t lb_cms_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static inline struct ibv_qp *create_qp(struct cm *cm, struct rdma_cm_id *cli_id) {
     struct ibv_context *context = cli_id->verbs;
     struct mlx5dv_qp_init_attr mlx5_qp_attr;
@@ -718,6 +804,46 @@ out:
     return ret;
 }
 
+static inline bool is_loopback_host(const char *host) {
+    return !strncmp(host, LB_HOST_PREFIX, strlen(LB_HOST_PREFIX));
+}
+
+static inline int parse_lb_host(struct svr_dom *dom, const char *s) {
+    const char *p;
+    int ret = 0;
+
+    s += strlen(LB_HOST_PREFIX);
+
+    dom->lb_name = strndup(s, strcspn(s, ","));
+    if (unlikely(!dom->lb_name)) {
+        ret = -ENOMEM;
+        pr_err("failed to allocate memory for loopback name: %s", strerror(-ret));
+        goto out;
+    }
+    if (unlikely(!*dom->lb_name)) {
+        ret = -EINVAL;
+        pr_err("empty loopback endpoint name");
+        goto out;
+    }
+
+    for (p = strchr(s, ','); p; p = strchr(p + 1, ',')) {
+        if (!strncmp(p + 1, "rtt=", 4)) {
+            dom->lb_rtt_ns = strtoull(p + 5, NULL, 0);
+        } else if (!strncmp(p + 1, "bw=", 3)) {
+            dom->lb_bw_mbps = strtoull(p + 4, NULL, 0);
+        } else {
+            ret = -EINVAL;
+            pr_err("invalid loopback option: %s", p + 1);
+            goto out;
+        }
+    }
+
+    dom->loopback = true;
+
+out:
+    return ret;
+}
+
 /*
  * Connection Manager Entry
  */
@@ -816,6 +942,171 @@ out:
     return ret;
 }
 
+/* map @off of domain @dom's striped MR, as laid out by create_striped_mr */
+static inline void *lb_striped_addr(struct cm_dom *dom, size_t off, size_t *len) {
+    rpma_svr_t *svr = dom->cm->svr;
+    size_t pattern, rep, inner;
+    struct spair *spair;
+
+    if (unlikely(off >= svr->logical_size)) {
+        return NULL;
+    }
+
+    pattern = svr->nr_spairs * svr->strip_size;
+    rep = off / pattern;
+    spair = &svr->spairs[off % pattern / svr->strip_size];
+    inner = off % svr->strip_size;
+
+    *len = min(*len, svr->strip_size - inner);
+    return dom->dom->devs[spair->dev].start + spair->off + rep * (spair->count + spair->skip) + inner;
+}
+
+/* map @off of MR @rkey, @len is trimmed to the physically contiguous part */
+static inline void *lb_addr(struct cm *cm, uint32_t rkey, size_t off, size_t *len) {
+    rpma_svr_t *svr = cm->svr;
+    size_t seg, inner;
+    int dom;
+
+    if (rkey == LB_REP_RKEY) {
+        /* as laid out by create_replicated_mr: per domain, bytes_count = bytes_skip = segment_size */
+        seg = off / svr->segment_size;
+        inner = off % svr->segment_size;
+        dom = seg % svr->nr_doms;
+        off = seg / svr->nr_doms * (2 * svr->segment_size) + inner;
+        *len = min(*len, svr->segment_size - inner);
+    } else {
+        if (unlikely(rkey >= svr->nr_doms)) {
+            return NULL;
+        }
+        dom = rkey;
+    }
+
+    return lb_striped_addr(&cm->doms[dom], off, len);
+}
+
+static enum ibv_wc_status lb_exec_wr(struct cm *cm, struct lb_sqe *sqe) {
+    size_t off = sqe->remote_addr, len, chunk;
+    void *local, *remote;
+    int i;
+
+    if (unlikely(sqe->opcode != IBV_WR_RDMA_WRITE && sqe->opcode != IBV_WR_RDMA_READ)) {
+        return IBV_WC_LOC_QP_OP_ERR;
+    }
+
+    for (i = 0; i < sqe->num_sge; i++) {
+        local = (void *) sqe->sg_list[i].addr;
+        len = sqe->sg_list[i].length;
+
+        while (len) {
+            chunk = len;
+            remote = lb_addr(cm, sqe->rkey, off, &chunk);
+            if (unlikely(!remote)) {
+                return IBV_WC_REM_ACCESS_ERR;
+            }
+
+            if (sqe->opcode == IBV_WR_RDMA_WRITE) {
+                memcpy(remote, local, chunk);
+            } else {
+                memcpy(local, remote, chunk);
+            }
+
+            local += chunk;
+            off += chunk;
+            len -= chunk;
+        }
+    }
+
+    return IBV_WC_SUCCESS;
+}
+
+static void lb_process_sqe(struct cm *cm, struct lb_qp *qp, struct lb_sqe *sqe) {
+    struct svr_dom *dom = cm->local_dom;
+    enum ibv_wc_status status;
+    uint64_t start, end;
+    struct lb_cqe *cqe;
+    size_t bytes = 0;
+    int i;
+
+    status = lb_exec_wr(cm, sqe);
+
+    for (i = 0; i < sqe->num_sge; i++) {
+        bytes += sqe->sg_list[i].length;
+    }
+
+    /* the request arrives after half an RTT, then occupies the link for bytes / bandwidth */
+    start = max(sqe->post_ns + dom->lb_rtt_ns / 2, cm->lb_busy_until);
+    end = start + (dom->lb_bw_mbps ? bytes * 1000 / dom->lb_bw_mbps : 0);
+    cm->lb_busy_until = end;
+
+    if (!sqe->signaled && status == IBV_WC_SUCCESS) {
+        return;
+    }
+
+    /* wait for the client to drain its CQ */
+    while (qp->cq_tail - READ_ONCE(qp->cq_head) >= MAX_QP_SR) {
+        if (READ_ONCE(qp->dead)) {
+            return;
+        }
+        cpu_relax();
+    }
+
+    cqe = &qp->cq[qp->cq_tail % MAX_QP_SR];
+    cqe->wr_id = sqe->wr_id;
+    cqe->opcode = sqe->opcode == IBV_WR_RDMA_WRITE ? IBV_WC_RDMA_WRITE : IBV_WC_RDMA_READ;
+    cqe->status = status;
+    cqe->ready_ns = end + dom->lb_rtt_ns / 2;
+    smp_wmb();
+    WRITE_ONCE(qp->cq_tail, qp->cq_tail + 1);
+}
+
+/*
+ * Loopback NIC Entry
+ */
+static void *lb_nic_entry(void *arg) {
+    struct cm *cm = arg;
+    unsigned long tail;
+    struct lb_qp *qp;
+    bool idle;
+    int i;
+
+    cm->tid = syscall(SYS_gettid);
+
+    pr_debug(5, "RPMA loopback NIC created, endpoint %s (rtt=%luns, bw=%luMB/s)",
+             cm->local_dom->lb_name, cm->local_dom->lb_rtt_ns, cm->local_dom->lb_bw_mbps);
+
+    while (!READ_ONCE(cm->exit)) {
+        idle = true;
+
+        for (i = 0; i < READ_ONCE(cm->nr_lb_qps); i++) {
+            qp = READ_ONCE(cm->lb_qps[i]);
+            if (!qp) {
+                continue;
+            }
+
+            if (unlikely(READ_ONCE(qp->dead))) {
+                /* the slot is reused by the next client connecting */
+                WRITE_ONCE(cm->lb_qps[i], NULL);
+                free(qp);
+                continue;
+            }
+
+            tail = READ_ONCE(qp->sq_tail);
+            smp_rmb();
+            while (qp->sq_head != tail) {
+                lb_process_sqe(cm, qp, &qp->sq[qp->sq_head % MAX_QP_SR]);
+                WRITE_ONCE(qp->sq_head, qp->sq_head + 1);
+                idle = false;
+            }
+        }
+
+        if (idle) {
+            cpu_relax();
+        }
+    }
+
+    return NULL;
+}
+
 static inline int get_nr_occur(const int *arr, int size, int val) {
     int i, cnt = 0;
 
@@ -868,7 +1159,12 @@ static void dump_topology(rpma_svr_t *svr) {
         dom = &svr->doms[i];
 
         pr_debug(5, "domain %d", dom->id);
-        pr_debug(5, "\tcm_host: %s:%d", inet_ntoa((struct in_addr) { dom->ip }), dom->port);
+        if (dom->loopback) {
+            pr_debug(5, "\tcm_host: %s%s (rtt=%luns, bw=%luMB/s)",
+                     LB_HOST_PREFIX, dom->lb_name, dom->lb_rtt_ns, dom->lb_bw_mbps);
+        } else {
+            pr_debug(5, "\tcm_host: %s:%d", inet_ntoa((struct in_addr) { dom->ip }), dom->port);
+        }
         pr_debug(5, "\tdevices:");
 
         for (j = 0; j < svr->nr_devs_per_dom; j++) {
@@ -917,11 +1213,15 @@ rpma_svr_t *rpma_svr_create(rpma_conf_t *rpma_conf) {
         }
 
         /* get host info */
-        ret = parse_ip_port(dom_conf->host, &dom->ip, &dom->port);
+        if (is_loopback_host(dom_conf->host)) {
+            ret = parse_lb_host(dom, dom_conf->host);
+        } else {
+            ret = parse_ip_port(dom_conf->host, &dom->ip, &dom->port);
+        }
         if (unlikely(ret)) {
             free(svr);
             svr = ERR_PTR(ret);
-            pr_err("failed to parse IP:PORT: %s", dom_conf->host);
+            pr_err("failed to parse host: %s", dom_conf->host);
             goto out;
         }
     }
@@ -977,7 +1277,7 @@ rpma_svr_t *rpma_svr_create(rpma_conf_t *rpma_conf) {
             cm->doms[j].dom = &svr->doms[j];
         }
 
-        ret = pthread_create(&cm->thread, NULL, cm_entry, cm);
+        ret = pthread_create(&cm->thread, NULL, dom->loopback ? lb_nic_entry : cm_entry, cm);
         if (unlikely(ret)) {
             free(svr);
             svr = ERR_PTR(-ret);
@@ -990,6 +1290,13 @@ rpma_svr_t *rpma_svr_create(rpma_conf_t *rpma_conf) {
         while (!READ_ONCE(cm->tid)) {
             cpu_relax();
         }
+
+        /* start accepting loopback clients */
+        if (dom->loopback) {
+            pthread_mutex_lock(&lb_cms_lock);
+            list_add_tail(&cm->lb_node, &lb_cms);
+            pthread_mutex_unlock(&lb_cms_lock);
+        }
     }
 
     dump_topology(svr);
@@ -1006,6 +1313,11 @@ void rpma_svr_destroy(rpma_svr_t *svr) {
 
     for (i = 0; i < svr->nr_doms; i++) {
         cm = svr->doms[i].cm;
+        if (svr->doms[i].loopback) {
+            pthread_mutex_lock(&lb_cms_lock);
+            list_del(&cm->lb_node);
+            pthread_mutex_unlock(&lb_cms_lock);
+        }
         cm->exit = true;
         pthread_join(cm->thread, NULL);
     }
@@ -1108,36 +1420,27 @@ void rpma_destroy(rpma_t *rpma) {
     free(rpma);
 }
 
-rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
+static struct pdata *rdma_cli_connect(rpma_cli_t *cli) {
     struct rdma_conn_param conn_param = { };
     struct ibv_qp_init_attr_ex init_attr;
     struct rdma_event_channel *cm_chan;
     struct rdma_cm_event *event;
+    rpma_t *rpma = cli->rpma;
     struct sockaddr_in sin;
     struct rdma_cm_id *id;
     struct pdata *pdata;
-    rpma_cli_t *cli;
-    int ret, i;
-
-    cli = calloc(1, sizeof(*cli));
-    if (unlikely(!cli)) {
-        pr_err("failed to allocate memory for rpma_cli_t");
-        cli = ERR_PTR(-ENOMEM);
-        goto out;
-    }
-
-    cli->rpma = rpma;
+    int ret;
 
     cm_chan = rdma_create_event_channel();
     if (unlikely(!cm_chan)) {
         pr_err("failed to create RDMA event channel: %s", strerror(errno));
-        cli = ERR_PTR(-errno);
+        pdata = ERR_PTR(-errno);
         goto out;
     }
 
     ret = rdma_create_id(cm_chan, &id, NULL, RDMA_PS_TCP);
     if (unlikely(ret)) {
-        cli = ERR_PTR(-errno);
+        pdata = ERR_PTR(-errno);
         pr_err("failed to create RDMA listen ID: %s", strerror(errno));
         goto out;
     }
@@ -1152,7 +1455,7 @@ rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
 
     ret = rdma_bind_addr(id, (struct sockaddr *) &sin);
     if (unlikely(ret)) {
-        cli = ERR_PTR(-errno);
+        pdata = ERR_PTR(-errno);
         pr_err("failed to bind RDMA address: %s", strerror(errno));
         goto out_destroy_id;
     }
@@ -1161,25 +1464,25 @@ rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
     sin.sin_family = AF_INET;
     ret = parse_ip_port(rpma->host, &sin.sin_addr.s_addr, &sin.sin_port);
     if (unlikely(ret)) {
-        cli = ERR_PTR(ret);
+        pdata = ERR_PTR(ret);
         pr_err("failed to parse IP:PORT: %s", rpma->host);
         goto out_destroy_id;
     }
 
     ret = rdma_resolve_addr(id, NULL, (struct sockaddr *) &sin, 2000);
     if (unlikely(ret)) {
-        cli = ERR_PTR(-errno);
+        pdata = ERR_PTR(-errno);
         pr_err("failed to resolve RDMA address: %s", strerror(errno));
         goto out_destroy_id;
     }
     ret = rdma_get_cm_event(cm_chan, &event);
     if (unlikely(ret)) {
-        cli = ERR_PTR(-errno);
+        pdata = ERR_PTR(-errno);
         pr_err("failed to get RDMA CM event: %s", strerror(errno));
         goto out_destroy_id;
     }
     if (unlikely(event->event != RDMA_CM_EVENT_ADDR_RESOLVED)) {
-        cli = ERR_PTR(-EINVAL);
+        pdata = ERR_PTR(-EINVAL);
         pr_err("unexpected RDMA CM event: %d", event->event);
         goto out_destroy_id;
     }
@@ -1187,18 +1490,18 @@ rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
 
     ret = rdma_resolve_route(id, 2000);
     if (unlikely(ret)) {
-        cli = ERR_PTR(-errno);
+        pdata = ERR_PTR(-errno);
         pr_err("failed to resolve RDMA route: %s", strerror(errno));
         goto out_destroy_id;
     }
     ret = rdma_get_cm_event(cm_chan, &event);
     if (unlikely(ret)) {
-        cli = ERR_PTR(-errno);
+        pdata = ERR_PTR(-errno);
         pr_err("failed to get RDMA CM event: %s", strerror(errno));
         goto out_destroy_id;
     }
     if (unlikely(event->event != RDMA_CM_EVENT_ROUTE_RESOLVED)) {
-        cli = ERR_PTR(-EINVAL);
+        pdata = ERR_PTR(-EINVAL);
         pr_err("unexpected RDMA CM event: %d", event->event);
         goto out_destroy_id;
     }
@@ -1219,7 +1522,7 @@ rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
     init_attr.comp_mask = IBV_QP_INIT_ATTR_PD | IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
     ret = rdma_create_qp_ex(id, &init_attr);
     if (unlikely(ret)) {
-        cli = ERR_PTR(-errno);
+        pdata = ERR_PTR(-errno);
         pr_err("failed to create RDMA QP: %s", strerror(errno));
         goto out_destroy_id;
     }
@@ -1230,25 +1533,25 @@ rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
     conn_param.rnr_retry_count = RNR_RETRY_CNT;
     ret = rdma_connect(id, &conn_param);
     if (unlikely(ret)) {
-        cli = ERR_PTR(-errno);
+        pdata = ERR_PTR(-errno);
         pr_err("failed to connect RDMA server: %s", strerror(errno));
         goto out_destroy_id;
     }
 
     ret = rdma_get_cm_event(cm_chan, &event);
     if (unlikely(ret)) {
-        cli = ERR_PTR(-errno);
+        pdata = ERR_PTR(-errno);
         pr_err("failed to get RDMA CM event: %s", strerror(errno));
         goto out_destroy_id;
     }
     if (unlikely(event->event != RDMA_CM_EVENT_ESTABLISHED)) {
-        cli = ERR_PTR(-EINVAL);
+        pdata = ERR_PTR(-EINVAL);
         pr_err("unexpected RDMA CM event: %d", event->event);
         goto out_destroy_id;
     }
     pdata = malloc(event->param.conn.private_data_len);
     if (unlikely(!pdata)) {
-        cli = ERR_PTR(-ENOMEM);
+        pdata = ERR_PTR(-ENOMEM);
         pr_err("failed to allocate memory for pdata: %s", strerror(errno));
         goto out_destroy_id;
     }
@@ -1258,6 +1561,120 @@ rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
     cli->pd = id->pd;
     cli->qp = id->qp;
     cli->cq = id->send_cq;
+
+out:
+    return pdata;
+
+out_destroy_id:
+    rdma_destroy_id(id);
+    rdma_destroy_event_channel(cm_chan);
+    return pdata;
+}
+
+static struct pdata *lb_cli_connect(rpma_cli_t *cli) {
+    const char *name = cli->rpma->host + strlen(LB_HOST_PREFIX);
+    struct svr_dom *dom;
+    struct pdata *pdata;
+    rpma_svr_t *svr;
+    struct lb_qp *qp;
+    struct cm *cm;
+    int i, slot;
+
+    qp = calloc(1, sizeof(*qp));
+    if (unlikely(!qp)) {
+        pdata = ERR_PTR(-ENOMEM);
+        pr_err("failed to allocate memory for loopback QP");
+        goto out;
+    }
+
+    pthread_mutex_lock(&lb_cms_lock);
+
+    dom = NULL;
+    list_for_each_entry(cm, &lb_cms, lb_node) {
+        if (!strncmp(cm->local_dom->lb_name, name, strcspn(name, ",")) &&
+            !cm->local_dom->lb_name[strcspn(name, ",")]) {
+            dom = cm->local_dom;
+            break;
+        }
+    }
+    if (unlikely(!dom)) {
+        pdata = ERR_PTR(-ECONNREFUSED);
+        pr_err("no loopback RPMA server listening on %s", cli->rpma->host);
+        goto out_unlock;
+    }
+    /* reuse the slot of a QP the NIC has freed, if any */
+    for (slot = 0; slot < cm->nr_lb_qps && READ_ONCE(cm->lb_qps[slot]); slot++);
+    if (unlikely(slot >= LB_MAX_QPS)) {
+        pdata = ERR_PTR(-EBUSY);
+        pr_err("too many loopback clients on %s", cli->rpma->host);
+        goto out_unlock;
+    }
+    svr = cm->svr;
+
+    pdata = calloc(1, sizeof(*pdata) + svr->nr_doms * sizeof(uint32_t));
+    if (unlikely(!pdata)) {
+        pdata = ERR_PTR(-ENOMEM);
+        pr_err("failed to allocate memory for pdata");
+        goto out_unlock;
+    }
+
+    /* rkey i addresses domain i's striped MR */
+    pdata->strip_size = svr->strip_size;
+    pdata->stripe_size = svr->stripe_size;
+    pdata->segment_size = svr->segment_size;
+    pdata->logical_size = svr->logical_size;
+    pdata->nr_doms = svr->nr_doms;
+    pdata->local_dom = cm->local_dom_id;
+    pdata->repmr_key = LB_REP_RKEY;
+    for (i = 0; i < svr->nr_doms; i++) {
+        pdata->dommr_keys[i] = i;
+    }
+
+    qp->cm = cm;
+    smp_wmb();
+    WRITE_ONCE(cm->lb_qps[slot], qp);
+    if (slot == cm->nr_lb_qps) {
+        smp_wmb();
+        WRITE_ONCE(cm->nr_lb_qps, slot + 1);
+    }
+
+    cli->lb_qp = qp;
+
+    pthread_mutex_unlock(&lb_cms_lock);
+
+out:
+    return pdata;
+
+out_unlock:
+    pthread_mutex_unlock(&lb_cms_lock);
+    free(qp);
+    return pdata;
+}
+
+rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
+    struct pdata *pdata;
+    rpma_cli_t *cli;
+    int ret, i;
+
+    cli = calloc(1, sizeof(*cli));
+    if (unlikely(!cli)) {
+        pr_err("failed to allocate memory for rpma_cli_t");
+        cli = ERR_PTR(-ENOMEM);
+        goto out;
+    }
+
+    cli->rpma = rpma;
+
+    if (is_loopback_host(rpma->host)) {
+        pdata = lb_cli_connect(cli);
+    } else {
+        pdata = rdma_cli_connect(cli);
+    }
+    if (unlikely(IS_ERR(pdata))) {
+        cli = ERR_CAST(pdata);
+        goto out;
+    }
+
     cli->strip_size = pdata->strip_size;
     cli->stripe_size = pdata->stripe_size;
     cli->segment_size = pdata->segment_size;
@@ -1269,7 +1686,7 @@ rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
     if (unlikely(!cli->doms)) {
         cli = ERR_PTR(-ENOMEM);
         pr_err("failed to allocate memory for doms: %s", strerror(errno));
-        goto out_destroy_id;
+        goto out_disconnect;
     }
     for (i = 0; i < cli->nr_doms; i++) {
         //cli->doms[i].dir = rpma->dirs[i];
@@ -1281,21 +1698,21 @@ rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
     if (unlikely(ret)) {
         cli = ERR_PTR(ret);
         pr_err("failed to create operand buffer: %s", strerror(-ret));
-        goto out_destroy_id;
+        goto out_disconnect;
     }
 
     ret = create_cli_buf(cli, CLI_BUF_SIZE);
     if (unlikely(ret)) {
         cli = ERR_PTR(ret);
         pr_err("failed to create client buffer: %s", strerror(-ret));
-        goto out_destroy_id;
+        goto out_disconnect;
     }
 
     cli->cli_buf_allocator = allocator_create(CLI_BUF_SIZE);
     if (unlikely(IS_ERR(cli->cli_buf_allocator))) {
         cli = ERR_PTR(cli->cli_buf_allocator);
         pr_err("failed to create client buffer allocator: %s", strerror(-PTR_ERR(cli->cli_buf_allocator)));
-        goto out_destroy_id;
+        goto out_disconnect;
     }
 
     if (cmpxchg2(&rpma->allocator_created, false, true)) {
@@ -1303,25 +1720,36 @@ rpma_cli_t *rpma_cli_create(rpma_t *rpma) {
         if (unlikely(IS_ERR(rpma->allocator))) {
             cli = ERR_PTR(rpma->allocator);
             pr_err("failed to create RPMA allocator: %s", strerror(-PTR_ERR(rpma->allocator)));
-            goto out_destroy_id;
+            goto out_disconnect;
         }
     }
 
     cli->seed = get_rand_seed();
 
     pr_debug(10, "rpma [%s] -> %s size=%lu,qpn=%d)",
-             rpma->dev_ip, rpma->host, cli->logical_size, cli->qp->qp_num);
+             rpma->dev_ip, rpma->host, cli->logical_size, cli->qp ? cli->qp->qp_num : -1);
+
+    free(pdata);
 
 out:
     return cli;
 
-out_destroy_id:
-    rdma_destroy_id(id);
-    rdma_destroy_event_channel(cm_chan);
+out_disconnect:
+    if (cli->lb_qp) {
+        WRITE_ONCE(cli->lb_qp->dead, true);
+    } else {
+        rdma_destroy_id(cli->cli_id);
+        rdma_destroy_event_channel(cli->cm_chan);
+    }
+    free(pdata);
     return cli;
 }
 
 void rpma_cli_destroy(rpma_cli_t *cli) {
+    if (cli->lb_qp) {
+        /* the loopback NIC reclaims the QP */
+        WRITE_ONCE(cli->lb_qp->dead, true);
+    }
     /* TODO: support disconnect */
     free(cli);
 }
@@ -1330,6 +1758,19 @@ int rpma_add_mr(rpma_cli_t *cli, void *start, size_t size) {
     int flags, ret = 0;
     struct ibv_mr *mr;
 
+    if (cli->lb_qp) {
+        /* the loopback NIC accesses local memory directly, only keep the range for operand lookup */
+        mr = calloc(1, sizeof(*mr));
+        if (unlikely(!mr)) {
+            ret = -ENOMEM;
+            pr_err("failed to allocate memory for MR: %s", strerror(-ret));
+            goto out;
+        }
+        mr->addr = start;
+        mr->length = size;
+        goto out_add;
+    }
+
     flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC;
     mr = ibv_reg_mr(cli->pd, start, size, flags);
     if (unlikely(!mr)) {
@@ -1338,6 +1779,7 @@ int rpma_add_mr(rpma_cli_t *cli, void *start, size_t size) {
         goto out;
     }
 
+out_add:
     cli->mrs[cli->nr_mrs++] = mr;
 
 out:
@@ -1421,8 +1863,7 @@ out_err:
     return operand;
 }
 
-static inline struct ibv_sge *get_sg_list(rpma_cli_t *cli, rpma_buf_t *buf, int *nr, bool read) {
-    struct ibv_sge *sglist;
+static inline int get_sg_list(rpma_cli_t *cli, struct ibv_sge *sglist, rpma_buf_t *buf, bool read) {
     int i, cnt = 0;
     void *addr;
 
@@ -1431,43 +1872,59 @@ static inline struct ibv_sge *get_sg_list(rpma_cli_t *cli, rpma_buf_t *buf, int
         cnt++;
     }
     bonsai_assert(!buf[cnt].size);
-    *nr = cnt;
 
-    sglist = calloc(cnt, sizeof(*sglist) * cnt);
-    if (unlikely(!sglist)) {
-        goto out;
+    if (unlikely(cnt > MAX_SEND_SGE)) {
+        return -E2BIG;
     }
 
     for (i = 0; i < cnt; i++) {
         addr = get_operand(cli, &sglist[i].lkey, buf[i].start, buf[i].size, read);
-        sglist[i].addr = (uintptr_t) addr;
-        sglist[i].length = buf[i].size;
         if (unlikely(IS_ERR(addr))) {
-            free(sglist);
-            sglist = ERR_PTR(PTR_ERR(addr));
-            goto out;
+            return PTR_ERR(addr);
         }
+        sglist[i].addr = (uintptr_t) addr;
+        sglist[i].length = buf[i].size;
     }
 
-out:
-    return sglist;
+    return cnt;
 }
 
-static inline void insert_into_wr_list(rpma_cli_t *cli, struct ibv_send_wr *wr) {
-    struct wr_list *wr_list = &cli->wr_list;
-    if (!wr_list->head) {
-        wr_list->head = wr;
-    } else {
-        wr_list->tail->next = wr;
+static inline int push_wr(rpma_cli_t *cli, enum ibv_wr_opcode opcode, rpma_buf_t buf[],
+                          uint64_t remote_addr, uint32_t rkey) {
+    struct wr_ring *ring = &cli->wr_ring;
+    struct ibv_send_wr *wr;
+    int num_sge;
+
+    if (unlikely(ring->nr_wrs == MAX_QP_SR)) {
+        return -ENOSPC;
     }
-    bonsai_assert(!wr->next);
-    wr_list->tail = wr;
+
+    wr = &ring->wrs[ring->nr_wrs];
+
+    num_sge = get_sg_list(cli, ring->sges[ring->nr_wrs], buf, opcode == IBV_WR_RDMA_READ);
+    if (unlikely(num_sge < 0)) {
+        return num_sge;
+    }
+
+    wr->wr_id = 0;
+    wr->next = NULL;
+    wr->sg_list = ring->sges[ring->nr_wrs];
+    wr->num_sge = num_sge;
+    wr->opcode = opcode;
+    wr->send_flags = 0;
+    wr->wr.rdma.remote_addr = remote_addr;
+    wr->wr.rdma.rkey = rkey;
+
+    if (ring->nr_wrs) {
+        ring->wrs[ring->nr_wrs - 1].next = wr;
+    }
+    ring->nr_wrs++;
+
+    return 0;
 }
 
 int rpma_wr_(rpma_cli_t *cli, rpma_ptr_t dst, rpma_buf_t src[], rpma_flag_t flag) {
-    struct ibv_send_wr *wr;
-    int ret = 0, num_sge;
-    struct ibv_sge *sgl;
+    int ret;
 
 #if 0
     if (unlikely(dst.off >= cli->logical_size)) {
@@ -1477,42 +1934,18 @@ int rpma_wr_(rpma_cli_t *cli, rpma_ptr_t dst, rpma_buf_t src[], rpma_flag_t flag
     }
 #endif
 
-    sgl = get_sg_list(cli, src, &num_sge, false);
-    if (unlikely(IS_ERR(sgl))) {
-        ret = PTR_ERR(sgl);
-        pr_err("failed to get sg list: %s", strerror(-ret));
-        goto out;
-    }
-
-    wr = calloc(1, sizeof(*wr));
-    if (unlikely(!wr)) {
-        free(sgl);
-        ret = -ENOMEM;
-        pr_err("failed to allocate memory for send WR: %s", strerror(-ret));
-        goto out;
+    ret = push_wr(cli, IBV_WR_RDMA_WRITE, src, dst.off, cli->doms[dst.home].mr_key);
+    if (unlikely(ret)) {
+        pr_err("failed to post write WR: %s", strerror(-ret));
     }
 
-    wr->opcode = IBV_WR_RDMA_WRITE;
-    wr->wr_id = 0;
-    wr->sg_list = sgl;
-    wr->num_sge = num_sge;
-    wr->wr.rdma.remote_addr = dst.off;
-    wr->wr.rdma.rkey = cli->doms[dst.home].mr_key;
-
-    pr_info("off: %lu, size: %u, rkey: %u", dst.off, sgl->length, wr->wr.rdma.rkey);
-
-    insert_into_wr_list(cli, wr);
-
-out:
     return ret;
 }
 
 static inline int replicate(rpma_cli_t *cli, void *replica, rpma_ptr_t src) {
-    int ret = 0, num_sge, i;
-    struct ibv_send_wr *wr;
-    struct ibv_sge *sgl;
     size_t target_off;
     void *data;
+    int ret, i;
 
     data = malloc(cli->segment_size * cli->nr_doms);
     if (unlikely(!data)) {
@@ -1526,29 +1959,14 @@ static inline int replicate(rpma_cli_t *cli, void *replica, rpma_ptr_t src) {
 
     target_off = src.off * cli->nr_doms;
 
-    sgl = get_sg_list(cli, rpma_buflist(cli, data, cli->segment_size * cli->nr_doms), &num_sge, false);
-    if (unlikely(IS_ERR(sgl))) {
-        ret = PTR_ERR(sgl);
-        pr_err("failed to get sg list: %s", strerror(-ret));
-        goto out;
-    }
-
-    wr = calloc(1, sizeof(*wr));
-    if (unlikely(!wr)) {
-        free(sgl);
-        ret = -ENOMEM;
-        pr_err("failed to allocate memory for send WR: %s", strerror(-ret));
-        goto out;
+    /* data is copied into the operand buffer */
+    ret = push_wr(cli, IBV_WR_RDMA_WRITE, rpma_buflist(cli, data, cli->segment_size * cli->nr_doms),
+                  target_off, cli->repmr_key);
+    if (unlikely(ret)) {
+        pr_err("failed to post replicate WR: %s", strerror(-ret));
     }
 
-    wr->opcode = IBV_WR_RDMA_WRITE;
-    wr->wr_id = 0;
-    wr->sg_list = sgl;
-    wr->num_sge = num_sge;
-    wr->wr.rdma.remote_addr = target_off;
-    wr->wr.rdma.rkey = cli->repmr_key;
-
-    insert_into_wr_list(cli, wr);
+    free(data);
 
 out:
     return ret;
@@ -1591,9 +2009,7 @@ static inline int rd_segment_fastpath(rpma_cli_t *cli, void *buf, rpma_ptr_t src
 }
 
 int rpma_rd_(rpma_cli_t *cli, rpma_buf_t dst[], rpma_ptr_t src, rpma_flag_t flag) {
-    struct ibv_send_wr *wr;
-    int ret = 0, num_sge;
-    struct ibv_sge *sgl;
+    int ret;
 
     if (unlikely(src.off >= cli->logical_size)) {
         ret = -EINVAL;
@@ -1601,30 +2017,11 @@ int rpma_rd_(rpma_cli_t *cli, rpma_buf_t dst[], rpma_ptr_t src, rpma_flag_t flag
         goto out;
     }
 
-    sgl = get_sg_list(cli, dst, &num_sge, true);
-    if (unlikely(IS_ERR(sgl))) {
-        ret = PTR_ERR(sgl);
-        pr_err("failed to get sg list: %s", strerror(-ret));
-        goto out;
-    }
-
-    wr = calloc(1, sizeof(*wr));
-    if (unlikely(!wr)) {
-        free(sgl);
-        ret = -ENOMEM;
-        pr_err("failed to allocate memory for send WR: %s", strerror(-ret));
-        goto out;
+    ret = push_wr(cli, IBV_WR_RDMA_READ, dst, src.off, cli->doms[src.home].mr_key);
+    if (unlikely(ret)) {
+        pr_err("failed to post read WR: %s", strerror(-ret));
     }
 
-    wr->opcode = IBV_WR_RDMA_READ;
-    wr->wr_id = 0;
-    wr->sg_list = sgl;
-    wr->num_sge = num_sge;
-    wr->wr.rdma.remote_addr = src.off;
-    wr->wr.rdma.rkey = cli->doms[src.home].mr_key;
-
-    insert_into_wr_list(cli, wr);
-
 out:
     return ret;
 }
@@ -1637,57 +2034,187 @@ int rpma_flush(rpma_cli_t *cli, rpma_ptr_t dst, size_t size, rpma_flag_t flag) {
     return rpma_rd(cli, dst, flag, buf, 1);
 }
 
-int rpma_commit(rpma_cli_t *cli) {
-    struct wr_list *wr_list = &cli->wr_list;
-    struct ibv_send_wr *wr, *bad, *tmp;
-    int ret = 0;
+static int lb_post_send(struct lb_qp *qp, struct ibv_send_wr *wr) {
+    unsigned long tail = qp->sq_tail;
+    uint64_t now = get_ns();
+    struct lb_sqe *sqe;
+
+    for (; wr; wr = wr->next) {
+        if (unlikely(wr->num_sge > MAX_SEND_SGE)) {
+            return -EINVAL;
+        }
+
+        /* SQ full, ring the doorbell for what we have and wait for the NIC */
+        if (unlikely(tail - READ_ONCE(qp->sq_head) >= MAX_QP_SR)) {
+            smp_wmb();
+            WRITE_ONCE(qp->sq_tail, tail);
+            while (tail - READ_ONCE(qp->sq_head) >= MAX_QP_SR) {
+                cpu_relax();
+            }
+        }
+
+        sqe = &qp->sq[tail % MAX_QP_SR];
+        sqe->wr_id = wr->wr_id;
+        sqe->post_ns = now;
+        sqe->opcode = wr->opcode;
+        sqe->signaled = wr->send_flags & IBV_SEND_SIGNALED;
+        sqe->rkey = wr->wr.rdma.rkey;
+        sqe->remote_addr = wr->wr.rdma.remote_addr;
+        sqe->num_sge = wr->num_sge;
+        memcpy(sqe->sg_list, wr->sg_list, wr->num_sge * sizeof(*wr->sg_list));
+        tail++;
+    }
+
+    /* one doorbell for the whole chain */
+    smp_wmb();
+    WRITE_ONCE(qp->sq_tail, tail);
+
+    return 0;
+}
+
+static int lb_poll_cq(struct lb_qp *qp, int nr, struct ibv_wc *wc) {
+    unsigned long tail = READ_ONCE(qp->cq_tail);
+    struct lb_cqe *cqe;
+    uint64_t now;
+    int i;
+
+    smp_rmb();
+    now = get_ns();
+
+    for (i = 0; i < nr && qp->cq_head != tail; i++) {
+        cqe = &qp->cq[qp->cq_head % MAX_QP_SR];
+        if (now < cqe->ready_ns) {
+            break;
+        }
+
+        wc[i].wr_id = cqe->wr_id;
+        wc[i].opcode = cqe->opcode;
+        wc[i].status = cqe->status;
+        WRITE_ONCE(qp->cq_head, qp->cq_head + 1);
+    }
+
+    return i;
+}
+
+static int poll_cq(rpma_cli_t *cli) {
+    struct ibv_wc wc[NR_POLL_WC];
+    int nr, i;
+
+    do {
+        nr = cli->lb_qp ? lb_poll_cq(cli->lb_qp, NR_POLL_WC, wc) : ibv_poll_cq(cli->cq, NR_POLL_WC, wc);
+        if (unlikely(nr < 0)) {
+            pr_err("failed to poll CQ");
+            return -EINVAL;
+        }
+
+        /* route completions to their tickets */
+        for (i = 0; i < nr; i++) {
+            if (unlikely(wc[i].status != IBV_WC_SUCCESS)) {
+                pr_err("work request failed: %s (ticket: %lu)", ibv_wc_status_str(wc[i].status), wc[i].wr_id);
+                cli->ticket_status[wc[i].wr_id % MAX_QP_SR] = wc[i].status;
+            }
+            if (wc[i].wr_id > cli->done_ticket) {
+                cli->done_ticket = wc[i].wr_id;
+                cli->done_wrs = cli->ticket_wrs[wc[i].wr_id % MAX_QP_SR];
+            }
+        }
+    } while (nr == NR_POLL_WC);
+
+    /* operands are only referenced by in-flight WRs, and the ones not committed yet */
+    if (cli->done_ticket == cli->last_ticket && !cli->wr_ring.nr_wrs) {
+        cli->op_buf_used = 0;
+    }
+
+    return 0;
+}
+
+rpma_ticket_t rpma_commit(rpma_cli_t *cli) {
+    struct wr_ring *ring = &cli->wr_ring;
+    struct ibv_send_wr *bad;
+    rpma_ticket_t ticket;
+    int i, ret, nr_wrs;
+
+    /* nothing to post, the last chain covers everything committed so far */
+    if (unlikely(!ring->nr_wrs)) {
+        return cli->last_ticket;
+    }
+
+    /* the SQ is full, wait for earlier chains to leave it */
+    while (unlikely(cli->posted_wrs - cli->done_wrs + ring->nr_wrs > MAX_QP_SR)) {
+        ret = poll_cq(cli);
+        if (unlikely(ret)) {
+            ring->nr_wrs = 0;
+            return ret;
+        }
+    }
+
+    ticket = cli->last_ticket + 1;
+    for (i = 0; i < ring->nr_wrs; i++) {
+        ring->wrs[i].wr_id = ticket;
+    }
+    cli->ticket_status[ticket % MAX_QP_SR] = IBV_WC_SUCCESS;
 
     /* only mark the last wr as signaled to reduce ACK msgs */
-    wr_list->tail->send_flags |= IBV_SEND_SIGNALED;
-    cli->nr_cqe++;
+    ring->wrs[ring->nr_wrs - 1].send_flags |= IBV_SEND_SIGNALED;
 
     /* use doorbell batching to reduce DMA doorbells */
-    if (unlikely(ibv_post_send(cli->qp, wr_list->head, &bad))) {
-        pr_err("failed to post wr");
-        ret = -EINVAL;
+    if (cli->lb_qp) {
+        ret = lb_post_send(cli->lb_qp, ring->wrs);
+    } else {
+        ret = ibv_post_send(cli->qp, ring->wrs, &bad);
     }
 
-    for (wr = wr_list->head; wr; wr = tmp) {
-        tmp = wr->next;
-        free(wr->sg_list);
-        free(wr);
+    /* WRs are copied into the SQ on post, the chain can be reused right away */
+    nr_wrs = ring->nr_wrs;
+    ring->nr_wrs = 0;
+
+    if (unlikely(ret)) {
+        pr_err("failed to post wr");
+        return -EINVAL;
     }
 
-    wr_list->head = wr_list->tail = NULL;
+    cli->posted_wrs += nr_wrs;
+    cli->ticket_wrs[ticket % MAX_QP_SR] = cli->posted_wrs;
+    cli->last_ticket = ticket;
 
-    return ret;
+    return ticket;
 }
 
-int rpma_sync(rpma_cli_t *cli) {
-    int total = 0, curr, ret = 0;
-    struct ibv_wc wc = { };
+int rpma_poll(rpma_cli_t *cli, rpma_ticket_t ticket) {
+    int ret;
 
-    do {
-        curr = ibv_poll_cq(cli->cq, 1, &wc);
-        if (unlikely(curr < 0)) {
-            pr_err("failed to poll CQ");
-            ret = -EINVAL;
-            goto out;
+    bonsai_assert(ticket <= cli->last_ticket);
+
+    if (ticket > cli->done_ticket) {
+        ret = poll_cq(cli);
+        if (unlikely(ret)) {
+            return ret;
         }
-        if (unlikely(wc.status != IBV_WC_SUCCESS)) {
-            pr_err("work request failed: %s (wr_id: %lu)", ibv_wc_status_str(wc.status), wc.wr_id);
-            ret = -EINVAL;
-            goto out;
+        if (ticket > cli->done_ticket) {
+            return 0;
         }
+    }
 
-        total += curr;
-    } while (total < cli->nr_cqe);
+    if (unlikely(cli->done_ticket - ticket < MAX_QP_SR &&
+                 cli->ticket_status[ticket % MAX_QP_SR] != IBV_WC_SUCCESS)) {
+        return -EIO;
+    }
 
-    cli->nr_cqe = 0;
-    cli->op_buf_used = 0;
+    return 1;
+}
 
-out:
-    return ret;
+int rpma_wait(rpma_cli_t *cli, rpma_ticket_t ticket) {
+    int ret;
+
+    while (!(ret = rpma_poll(cli, ticket))) {
+        cpu_relax();
+    }
+
+    return ret < 0 ? ret : 0;
+}
+
+int rpma_sync(rpma_cli_t *cli) {
+    return rpma_wait(cli, cli->last_ticket);
 }
 
 int rpma_alloc_dom(rpma_cli_t *cli, rpma_ptr_t *ptr, size_t size, int dom) {
@@ -1710,6 +2237,11 @@ void rpma_free(rpma_cli_t *cli, rpma_ptr_t ptr, size_t size) {
     return allocator_free(cli->rpma->allocator, ptr.off, size);
 }
 
+/* keep the extent of a remote object that outlived the last run from being allocated again */
+void rpma_mark_used(rpma_cli_t *cli, rpma_ptr_t ptr, size_t size) {
+    allocator_mark_used(cli->rpma->allocator, ptr.off, size);
+}
+
 size_t rpma_get_strip_size(rpma_cli_t *cli) {
     return cli->strip_size;
 }
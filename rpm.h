@@ -105,6 +105,10 @@
  *   cli0   cli1       cli2  cli3
  */
 
+/*
+ * @host is either "IP:PORT" of the domain's RNIC, or "shm:<name>[,rtt=<ns>][,bw=<MB/s>]" to serve
+ * the domain over the in-process loopback transport (clients then use "shm:<name>" as their host).
+ */
 struct rpma_dom_conf {
     const char *host;
     const char **dev_paths;
@@ -133,6 +137,7 @@ typedef struct rpma_cli rpma_cli_t;
 typedef struct rpma_buf rpma_buf_t;
 typedef struct rpma_ptr rpma_ptr_t;
 typedef unsigned long rpma_flag_t;
+typedef uint64_t rpma_ticket_t;
 
 struct rpma_ptr {
     union {
@@ -163,15 +168,23 @@ int rpma_wr_(rpma_cli_t *cli, rpma_ptr_t dst, rpma_buf_t src[], rpma_flag_t flag
 int rpma_rd_(rpma_cli_t *cli, rpma_buf_t dst[], rpma_ptr_t src, rpma_flag_t flag);
 int rpma_flush(rpma_cli_t *cli, rpma_ptr_t dst, size_t size, rpma_flag_t flag);
 
-int rpma_commit(rpma_cli_t *cli);
+/*
+ * rpma_commit posts all WRs queued since the last commit as one chain and returns its ticket
+ * (check with IS_ERR). Chains complete in commit order. rpma_poll returns 1 once @ticket has
+ * completed, 0 while it is in flight; rpma_wait spins until it completes; rpma_sync waits for
+ * every committed chain.
+ */
+rpma_ticket_t rpma_commit(rpma_cli_t *cli);
+int rpma_poll(rpma_cli_t *cli, rpma_ticket_t ticket);
+int rpma_wait(rpma_cli_t *cli, rpma_ticket_t ticket);
 int rpma_sync(rpma_cli_t *cli);
 
 static inline int rpma_commit_sync(rpma_cli_t *cli) {
-    int ret = rpma_commit(cli);
-    if (ret) {
-        return ret;
+    rpma_ticket_t ticket = rpma_commit(cli);
+    if (IS_ERR(ticket)) {
+        return PTR_ERR(ticket);
     }
-    return rpma_sync(cli);
+    return rpma_wait(cli, ticket);
 }
 
 #define rpma_buflist(cli, ...)          ((rpma_buf_t[]) { __VA_ARGS__, { NULL, 0 } })
@@ -181,6 +194,7 @@ static inline int rpma_commit_sync(rpma_cli_t *cli) {
 int rpma_alloc_dom(rpma_cli_t *cli, rpma_ptr_t *ptr, size_t size, int dom);
 int rpma_alloc(rpma_cli_t *cli, rpma_ptr_t *ptr, size_t size);
 void rpma_free(rpma_cli_t *cli, rpma_ptr_t ptr, size_t size);
+void rpma_mark_used(rpma_cli_t *cli, rpma_ptr_t ptr, size_t size);
 
 size_t rpma_get_strip_size(rpma_cli_t *cli);
 size_t rpma_get_stripe_size(rpma_cli_t *cli);
@@ -13,33 +13,109 @@
 #include "shim.h"
 #include "lock.h"
 #include "bitmap.h"
+#include "fgprt.h"
+#include "reclaim.h"
 #include "oplog.h"
 #include "dset.h"
 #include "kv.h"
 
+/* max keys per inode, the runtime fanout may be lower */
 #define INODE_FANOUT    46
 
+/* 1 in INODE_HIT_SAMPLE inode accesses is counted */
+#define INODE_HIT_SAMPLE        16
+/* hot inodes with fewer keys are not worth splitting */
+#define INODE_MIN_HOT_SPLIT     8
+
+#ifdef INODE_KEY_PREFIX
+/* keys of at most KPREFIX_LEN bytes are fully held by their prefix */
+#define KPREFIX_LEN     sizeof(uint64_t)
+#endif
+
 struct shim {
     index_t *index;
     kc_t *kc;
 
+    int fanout;
+    uint32_t hot_hits;
+
     inode_t *sentinel;
+
+    /* bumped whenever an inode is retired, invalidates all inode hints */
+    uint64_t igen;
 };
 
+/* per-client cache of recently reached inodes, saves index lookups for nearby keys */
+#define SHIM_NR_IHINTS      4
+
 struct shim_cli {
     shim_t *shim;
 
     /* cache frequently-accessed fields in @shim (to reduce pointer chasing) */
     index_t *index;
     kc_t *kc;
+    int fanout;
 
     logger_cli_t *logger_cli;
     dcli_t *dcli;
+
+    /* for sampling inode accesses */
+    uint32_t nr_accesses;
+
+    /* inode hints, valid while shim->igen == ihint_gen */
+    inode_t *ihints[SHIM_NR_IHINTS];
+    uint64_t ihint_gen;
+    int ihint_next;
 };
 
+#ifdef INODE_SPLIT_LAYOUT
+/*
+ * Cache-line-aware layout (9 cache lines + fences):
+ *   line 0:    read-mostly header, written only by split/merge
+ *   line 1:    validmap and fingerprints, written by inserts
+ *   line 2-7:  log pointers, written by inserts and updates
+ *   line 8:    lock, so that lock traffic doesn't invalidate lines that readers touch, access
+ *              statistics, and the sorted permutation (if enabled), used by lock holders and scans
+ * Fences are read by every lookup as well, they start on a line of their own.
+ * Key prefixes (if enabled) follow the lock, they are read only on fingerprint hits.
+ */
+struct inode {
+    seqcount_t seq;
+    uint32_t deleted;
+
+    inode_t *next;
+
+    dgroup_t dgroup;
+
+    uint8_t rfence_len;
+    uint8_t lfence_len;
+
+    uint64_t validmap __attribute__((aligned(CACHELINE_SIZE)));
+    uint8_t fgprt[INODE_FANOUT];
+
+    uint64_t logs[INODE_FANOUT] __attribute__((aligned(CACHELINE_SIZE)));
+
+    spinlock_t lock __attribute__((aligned(CACHELINE_SIZE)));
+
+    uint32_t hits;
+    uint8_t last_ins;
+
+#ifdef INODE_SORTED
+    uint8_t nr_perm;
+    uint8_t perm[INODE_FANOUT];
+#endif
+
+#ifdef INODE_KEY_PREFIX
+    uint64_t kprefix[INODE_FANOUT] __attribute__((aligned(CACHELINE_SIZE)));
+    uint8_t klen[INODE_FANOUT];
+#endif
+
+    char fences[] __attribute__((aligned(CACHELINE_SIZE)));
+};
+#else
 /* Each inode has 8 cache lines */
 struct inode {
-    uint32_t validmap;
+    uint64_t validmap;
     uint32_t deleted;
 
     inode_t *next;
@@ -51,17 +127,49 @@ struct inode {
     uint8_t lfence_len;
 
     spinlock_t lock;
+    /* sampled accesses since the last GC round, off the line every reader loads */
+    uint32_t hits;
     seqcount_t seq;
 
+    /* slot of the last inserted key */
+    uint8_t last_ins;
+
+#ifdef INODE_SORTED
+    uint8_t nr_perm;
+    uint8_t perm[INODE_FANOUT];
+#endif
+
     uint64_t logs[INODE_FANOUT];
 
+#ifdef INODE_KEY_PREFIX
+    uint64_t kprefix[INODE_FANOUT];
+    uint8_t klen[INODE_FANOUT];
+#endif
+
     char fences[];
 };
+#endif
+
+static inline inode_t *inode_alloc(size_t fences_len) {
+    size_t size = sizeof(inode_t) + fences_len;
+    inode_t *inode;
+
+#ifdef INODE_SPLIT_LAYOUT
+    if (unlikely(posix_memalign((void **) &inode, CACHELINE_SIZE, size))) {
+        return NULL;
+    }
+    memset(inode, 0, size);
+#else
+    inode = calloc(1, size);
+#endif
+
+    return inode;
+}
 
 static inline inode_t *create_sentinel(shim_t *shim) {
     inode_t *sentinel;
 
-    sentinel = calloc(1, sizeof(*sentinel) + 1);
+    sentinel = inode_alloc(1);
     if (unlikely(!sentinel)) {
         sentinel = ERR_PTR(-ENOMEM);
         pr_err("failed to allocate sentinel memory");
@@ -70,6 +178,7 @@ static inline inode_t *create_sentinel(shim_t *shim) {
 
     sentinel->validmap = 0;
     sentinel->deleted = 0;
+    sentinel->last_ins = INODE_FANOUT;
     sentinel->next = NULL;
     sentinel->dgroup = (dgroup_t) { };
     seqcount_init(&sentinel->seq);
@@ -79,7 +188,7 @@ out:
     return sentinel;
 }
 
-shim_t *shim_create(index_t *index, kc_t *kc) {
+shim_t *shim_create(index_t *index, kc_t *kc, int fanout, int hot_hits) {
     shim_t *shim;
 
     shim = calloc(1, sizeof(*shim));
@@ -93,12 +202,15 @@ shim_t *shim_create(index_t *index, kc_t *kc) {
 
     shim->kc = kc;
 
+    shim->fanout = fanout > 0 ? max(min(fanout, INODE_FANOUT), 2) : INODE_FANOUT;
+    shim->hot_hits = max(hot_hits, 0);
+
     shim->sentinel = create_sentinel(shim);
     if (unlikely(IS_ERR(shim->sentinel))) {
         pr_err("failed to create sentinel");
     }
 
-    pr_debug(5, "shim created");
+    pr_debug(5, "shim created, inode fanout %d", shim->fanout);
 
 out:
     return shim;
@@ -127,6 +239,8 @@ shim_cli_t *shim_create_cli(shim_t *shim, logger_cli_t *logger_cli) {
 
     shim_cli->kc = shim->kc;
 
+    shim_cli->fanout = shim->fanout;
+
     shim_cli->logger_cli = logger_cli;
 
     pr_debug(10, "shim client created");
@@ -153,14 +267,179 @@ static inline k_t i_rfence(inode_t *inode) {
     return (k_t) { inode->fences + inode->lfence_len, inode->rfence_len };
 }
 
+#ifdef INODE_KEY_PREFIX
+/*
+ * Per-slot key prefix and length let a fingerprint hit be rejected without reading the log, and
+ * for short keys they replace the key comparison. This relies on equal keys (per the key class)
+ * having equal bytes, which holds as long as the key hash is over the key bytes.
+ */
+static inline uint64_t k_prefix(k_t key) {
+    uint64_t prefix = 0;
+    memcpy(&prefix, key.key, min(key.len, KPREFIX_LEN));
+    return prefix;
+}
+
+static inline uint8_t k_len_tag(k_t key) {
+    return min(key.len, UINT8_MAX);
+}
+#endif
+
+/* set the in-inode key metadata of slot @pos */
+static inline void i_set_key(shim_cli_t *shim_cli, inode_t *inode, int pos, k_t key) {
+    inode->fgprt[pos] = k_fgprt(shim_cli->kc, key);
+#ifdef INODE_KEY_PREFIX
+    inode->kprefix[pos] = k_prefix(key);
+    inode->klen[pos] = k_len_tag(key);
+#endif
+}
+
+/* copy slot @pos of @src to slot @i of @dst, log included */
+static inline void i_copy_slot(inode_t *dst, int i, inode_t *src, int pos) {
+    dst->logs[i] = src->logs[pos];
+    dst->fgprt[i] = src->fgprt[pos];
+#ifdef INODE_KEY_PREFIX
+    dst->kprefix[i] = src->kprefix[pos];
+    dst->klen[i] = src->klen[pos];
+#endif
+}
+
+#ifdef INODE_SORTED
+/*
+ * Sorted-run inodes: @perm[0, @nr_perm) lists the valid slots in key order (the slots themselves
+ * stay where they were inserted). It is changed by lock holders within write sections of the
+ * inode seqcount, so that lock-free readers see it consistent with @validmap.
+ */
+static inline k_t i_key(shim_cli_t *shim_cli, inode_t *inode, int pos) {
+    uint64_t valp;
+    k_t key;
+
+    logger_get(shim_cli->logger_cli, inode->logs[pos], &key, &valp);
+
+    return key;
+}
+
+/* first index of @inode's permutation whose key is >= @key */
+static int i_perm_lower_bound(shim_cli_t *shim_cli, inode_t *inode, k_t key) {
+    int lo = 0, hi = inode->nr_perm, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (k_cmp(shim_cli->kc, i_key(shim_cli, inode, inode->perm[mid]), key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/* insert slot @pos at index @at of @inode's permutation */
+static inline void i_perm_insert(inode_t *inode, int at, int pos) {
+    memmove(&inode->perm[at + 1], &inode->perm[at], inode->nr_perm - at);
+    inode->perm[at] = pos;
+    inode->nr_perm++;
+}
+
+/* drop the slots no longer in @inode's validmap from its permutation */
+static inline void i_perm_compact(inode_t *inode) {
+    int i, nr = 0;
+
+    for (i = 0; i < inode->nr_perm; i++) {
+        if (inode->validmap & (1ull << inode->perm[i])) {
+            inode->perm[nr++] = inode->perm[i];
+        }
+    }
+    inode->nr_perm = nr;
+}
+#endif
+
+/* count an access to @inode, sampled to keep the counter line mostly clean */
+static inline void i_touch(shim_cli_t *shim_cli, inode_t *inode) {
+    if (unlikely(!(++shim_cli->nr_accesses % INODE_HIT_SAMPLE))) {
+        /* racy, an approximation is enough */
+        WRITE_ONCE(inode->hits, inode->hits + 1);
+    }
+}
+
 static inline bool key_within_rfence(shim_cli_t *shim_cli, inode_t *inode, k_t key) {
     return !inode->next || k_cmp(shim_cli->kc, key, i_rfence(inode)) < 0;
 }
 
+static inline bool key_within_lfence(shim_cli_t *shim_cli, inode_t *inode, k_t key) {
+    return inode == shim_cli->shim->sentinel || k_cmp(shim_cli->kc, key, i_lfence(inode)) >= 0;
+}
+
+/*
+ * Inode hints live across read sections, so a hinted inode may have been retired and freed
+ * since. Retiring marks the inode deleted and then bumps shim->igen, and hints are recorded
+ * with the igen read before checking that the inode is not deleted: as long as igen stays the
+ * same, no hinted inode has been retired.
+ */
+static inline void ihint_put(shim_cli_t *shim_cli, inode_t *inode) {
+    uint64_t gen = READ_ONCE(shim_cli->shim->igen);
+    int i;
+
+    smp_rmb();
+    if (unlikely(READ_ONCE(inode->deleted))) {
+        return;
+    }
+
+    if (unlikely(gen != shim_cli->ihint_gen)) {
+        memset(shim_cli->ihints, 0, sizeof(shim_cli->ihints));
+        shim_cli->ihint_gen = gen;
+    }
+
+    for (i = 0; i < SHIM_NR_IHINTS; i++) {
+        if (shim_cli->ihints[i] == inode) {
+            return;
+        }
+    }
+
+    shim_cli->ihints[shim_cli->ihint_next] = inode;
+    shim_cli->ihint_next = (shim_cli->ihint_next + 1) % SHIM_NR_IHINTS;
+}
+
+/* a hinted inode covering @key, NULL if none */
+static inline inode_t *ihint_get(shim_cli_t *shim_cli, k_t key) {
+    inode_t *inode;
+    unsigned seq;
+    bool hit;
+    int i;
+
+    if (unlikely(READ_ONCE(shim_cli->shim->igen) != shim_cli->ihint_gen)) {
+        return NULL;
+    }
+
+    for (i = 0; i < SHIM_NR_IHINTS; i++) {
+        inode = shim_cli->ihints[i];
+        if (!inode) {
+            continue;
+        }
+
+        do {
+            seq = read_seqcount_begin(&inode->seq);
+            hit = !inode->deleted &&
+                  key_within_lfence(shim_cli, inode, key) && key_within_rfence(shim_cli, inode, key);
+        } while (unlikely(read_seqcount_retry(&inode->seq, seq)));
+
+        if (hit) {
+            return inode;
+        }
+    }
+
+    return NULL;
+}
+
 static inline inode_t *iget_unlocked(shim_cli_t *shim_cli, k_t key) {
     index_t *index = shim_cli->index;
     inode_t *inode;
 
+    inode = ihint_get(shim_cli, key);
+    if (likely(inode)) {
+        return inode;
+    }
+
     inode = index_find_first_ge(index, key);
 
     return inode;
@@ -190,6 +469,8 @@ reget:
         inode = next;
     }
 
+    ihint_put(shim_cli, inode);
+
     return inode;
 }
 
@@ -210,22 +491,54 @@ static int sort_cmp(const void *a, const void *b, void *priv) {
  * Move @inode's keys within range [cut, fence) to another node N.
  * @inode's original responsible key range [l, fence) will be split to [l, cut) and [cut, fence).
  * Both @inode and its successor N will be locked.
+ *
+ * Without @cut, the split is at the median, unless @ins (the key whose insertion overflows
+ * @inode, if any) is beyond all keys and the last insert was the max key as well: inserts are
+ * then monotonic, and @inode is left full while N starts empty from @ins (append split).
  */
-static inline void i_split(shim_cli_t *shim_cli, inode_t *inode, k_t cut) {
+static inline void i_split(shim_cli_t *shim_cli, inode_t *inode, k_t cut, k_t ins) {
+#ifdef INODE_SORTED
+    uint64_t lvmp, rvmp, lmask = 0;
+    int pos, mid;
+#else
     struct log_info logs[INODE_FANOUT], *log;
     uint64_t valp, lvmp, rvmp, lmask = 0;
     int pos, cnt = 0;
+#endif
     inode_t *new;
     k_t fence;
 
+#ifdef INODE_SORTED
+    /* keys are already in order, split the permutation */
+    if (cut.key) {
+        mid = i_perm_lower_bound(shim_cli, inode, cut);
+        fence = cut;
+    } else if (ins.key && inode->perm[inode->nr_perm - 1] == inode->last_ins &&
+               k_cmp(shim_cli->kc, ins, i_key(shim_cli, inode, inode->last_ins)) > 0) {
+        mid = inode->nr_perm;
+        fence = ins;
+    } else {
+        mid = inode->nr_perm / 2;
+        fence = i_key(shim_cli, inode, inode->perm[mid]);
+    }
+    for (pos = 0; pos < mid; pos++) {
+        __set_bit(inode->perm[pos], &lmask);
+    }
+#else
     /* collect log infos */
     for_each_set_bit(pos, &inode->validmap, INODE_FANOUT) {
-        logger_get(shim_cli->logger_cli, inode->logs[pos], &logs[pos].key, &valp);
+        logger_get(shim_cli->logger_cli, inode->logs[pos], &logs[cnt].key, &valp);
         logs[cnt++].pos = pos;
     }
 
     /* sort log infos */
-    qsort_r(logs, INODE_FANOUT, sizeof(*logs), sort_cmp, shim_cli);
+    qsort_r(logs, cnt, sizeof(*logs), sort_cmp, shim_cli);
+
+    if (!cut.key && ins.key && logs[cnt - 1].pos == inode->last_ins &&
+        k_cmp(shim_cli->kc, ins, logs[cnt - 1].key) > 0) {
+        /* append split */
+        cut = ins;
+    }
 
     /* set validmaps accordingly */
     if (cut.key) {
@@ -245,11 +558,12 @@ static inline void i_split(shim_cli_t *shim_cli, inode_t *inode, k_t cut) {
         }
         fence = logs[pos].key;
     }
+#endif
     lvmp = lmask;
     rvmp = inode->validmap & ~lmask;
 
     /* alloc and init new node */
-    new = calloc(1, sizeof(*new) + inode->rfence_len + 1);
+    new = inode_alloc(fence.len + inode->rfence_len);
     if (unlikely(!new)) {
         pr_err("failed to allocate inode memory");
         return;
@@ -257,19 +571,33 @@ static inline void i_split(shim_cli_t *shim_cli, inode_t *inode, k_t cut) {
     new->validmap = rvmp;
     new->dgroup = inode->dgroup;
     new->deleted = 0;
+    new->hits = inode->hits / 2;
+    new->last_ins = INODE_FANOUT;
     new->next = inode->next;
     new->lfence_len = fence.len;
     new->rfence_len = inode->rfence_len;
     memcpy(i_lfence(new).key, fence.key, fence.len);
     memcpy(i_rfence(new).key, i_rfence(inode).key, inode->rfence_len);
-    memcpy(new->fgprt, inode->fgprt, sizeof(new->fgprt));
-    memcpy(new->logs, inode->logs, sizeof(new->logs));
+#ifdef INODE_SORTED
+    new->nr_perm = inode->nr_perm - mid;
+    memcpy(new->perm, inode->perm + mid, new->nr_perm);
+#endif
     seqcount_init(&new->seq);
     spin_lock(&new->lock);
 
-    /* update @inode atomically */
+    /* update @inode atomically, logs are copied within so that lock-free updates can't get lost */
     write_seqcount_begin(&inode->seq);
+    memcpy(new->fgprt, inode->fgprt, sizeof(new->fgprt));
+    memcpy(new->logs, inode->logs, sizeof(new->logs));
+#ifdef INODE_KEY_PREFIX
+    memcpy(new->kprefix, inode->kprefix, sizeof(new->kprefix));
+    memcpy(new->klen, inode->klen, sizeof(new->klen));
+#endif
     inode->validmap = lvmp;
+#ifdef INODE_SORTED
+    inode->nr_perm = mid;
+#endif
+    inode->hits /= 2;
     inode->next = new;
     inode->rfence_len = fence.len;
     memcpy(i_rfence(inode).key, fence.key, fence.len);
@@ -279,29 +607,45 @@ static inline void i_split(shim_cli_t *shim_cli, inode_t *inode, k_t cut) {
     index_upsert(shim_cli->index, fence, new);
 }
 
-static inline int search_log(shim_cli_t *shim_cli, inode_t *inode, uint32_t validmap,
+static inline int search_log(shim_cli_t *shim_cli, inode_t *inode, uint64_t validmap,
                              k_t key, uint64_t *valp, int *pos) {
     uint8_t fgprt = k_fgprt(shim_cli->kc, key);
     int i, ret = -ERANGE;
+    unsigned long cands;
     k_t log_key;
     op_t op;
+#ifdef INODE_KEY_PREFIX
+    uint64_t prefix = k_prefix(key);
+    uint8_t klen = k_len_tag(key);
+#endif
 
     *pos = INODE_FANOUT;
 
-    for_each_set_bit(i, &validmap, INODE_FANOUT) {
-        if (inode->fgprt[i] != fgprt) {
+    /* probe all fingerprints at once, only valid slots (all below the fanout) count */
+    cands = fgprt_probe(inode->fgprt, shim_cli->fanout, fgprt) & validmap;
+
+    for_each_set_bit(i, &cands, INODE_FANOUT) {
+#ifdef INODE_KEY_PREFIX
+        if (inode->kprefix[i] != prefix || inode->klen[i] != klen) {
+            /* hash collision, rejected without touching the log */
             continue;
         }
+#endif
 
         op = logger_get(shim_cli->logger_cli, inode->logs[i], &log_key, valp);
 
+#ifdef INODE_KEY_PREFIX
+        if (key.len > KPREFIX_LEN && k_cmp(shim_cli->kc, key, log_key) != 0) {
+#else
         if (k_cmp(shim_cli->kc, key, log_key) != 0) {
+#endif
             /* not this key, hash collision */
             continue;
         }
 
         if (unlikely(op == OP_DEL)) {
             ret = -ENOENT;
+            *pos = i;
             goto out;
         }
 
@@ -314,17 +658,19 @@ out:
     return ret;
 }
 
-static inline int search_dset(shim_cli_t *shim_cli, inode_t *inode, k_t key, uint64_t *valp) {
-    return dset_lookup(shim_cli->dcli, inode->dgroup, key, valp);
-}
-
-int shim_upsert(shim_cli_t *shim_cli, k_t key, oplog_t log) {
+/* upsert with *@inodep locked, *@inodep is set to the (locked) inode of @key on return */
+static int upsert_locked(shim_cli_t *shim_cli, inode_t **inodep, k_t key, oplog_t log) {
+    inode_t *inode = *inodep, *next;
+    int fanout = shim_cli->fanout;
     unsigned long validmap;
-    inode_t *inode, *next;
+    bool fresh = false;
     uint64_t valp;
     int pos, ret;
+#ifdef INODE_SORTED
+    int at = 0;
+#endif
 
-    inode = iget_locked(shim_cli, key);
+    i_touch(shim_cli, inode);
 
     validmap = inode->validmap;
 
@@ -332,12 +678,15 @@ int shim_upsert(shim_cli_t *shim_cli, k_t key, oplog_t log) {
     if (unlikely(!IS_ERR(ret))) {
         /* Key exists, update */
         ret = -EEXIST;
+    } else if (ret == -ENOENT && pos < INODE_FANOUT) {
+        /* Key deleted, reuse its slot */
+        ret = 0;
     } else if (ret == -ENOENT || ret == -ERANGE) {
-        pos = find_first_zero_bit(&validmap, INODE_FANOUT);
+        pos = find_first_zero_bit(&validmap, fanout);
 
-        if (unlikely(pos == INODE_FANOUT)) {
+        if (unlikely(pos >= fanout)) {
             /* inode full, need to split */
-            i_split(shim_cli, inode, (k_t) { });
+            i_split(shim_cli, inode, (k_t) { }, key);
 
             /* crab to correct inode */
             next = inode->next;
@@ -350,11 +699,17 @@ int shim_upsert(shim_cli_t *shim_cli, k_t key, oplog_t log) {
 
             /* retry find valid position */
             validmap = inode->validmap;
-            pos = find_first_zero_bit(&validmap, INODE_FANOUT);
-            bonsai_assert(pos < INODE_FANOUT);
+            pos = find_first_zero_bit(&validmap, fanout);
+            bonsai_assert(pos < fanout);
         }
 
         __set_bit(pos, &validmap);
+        fresh = true;
+
+#ifdef INODE_SORTED
+        /* find the place in key order before entering the write section */
+        at = i_perm_lower_bound(shim_cli, inode, key);
+#endif
 
         ret = 0;
     } else {
@@ -362,27 +717,162 @@ int shim_upsert(shim_cli_t *shim_cli, k_t key, oplog_t log) {
     }
 
     inode->logs[pos] = log;
-    inode->fgprt[pos] = k_fgprt(shim_cli->kc, key);
+    i_set_key(shim_cli, inode, pos, key);
+    if (fresh) {
+        inode->last_ins = pos;
+    }
     barrier();
 
+#ifdef INODE_SORTED
+    if (fresh) {
+        write_seqcount_begin(&inode->seq);
+        i_perm_insert(inode, at, pos);
+        inode->validmap = validmap;
+        write_seqcount_end(&inode->seq);
+        goto out;
+    }
+#endif
+
     inode->validmap = validmap;
 
+out:
+    *inodep = inode;
+    return ret;
+}
+
+/*
+ * Lock-free update of an existing key: the new log replaces the key's slot by CAS. Inode
+ * changes made under the lock that move or drop slots (split, merge, GC) are all within write
+ * sections of the inode seqcount, so an update that overlaps one of them is detected and redone
+ * under the lock. Return -EAGAIN if the update has to be done under the lock.
+ */
+static int upsert_optimistic(shim_cli_t *shim_cli, k_t key, oplog_t log) {
+    inode_t *inode, *next;
+    unsigned long validmap;
+    unsigned int seq;
+    uint64_t valp;
+    int pos, ret;
+    oplog_t old;
+
+    inode = iget_unlocked(shim_cli, key);
+
+retry:
+    seq = read_seqcount_begin(&inode->seq);
+
+    if (unlikely(READ_ONCE(inode->deleted))) {
+        return -EAGAIN;
+    }
+
+    if (unlikely(!key_within_rfence(shim_cli, inode, key))) {
+        next = inode->next;
+        if (unlikely(read_seqcount_retry(&inode->seq, seq) || !next)) {
+            goto retry;
+        }
+        inode = next;
+        goto retry;
+    }
+
+    validmap = READ_ONCE(inode->validmap);
+
+    i_touch(shim_cli, inode);
+
+    ret = search_log(shim_cli, inode, validmap, key, &valp, &pos);
+    if (ret == -ERANGE || pos == INODE_FANOUT) {
+        /* insert, needs the lock */
+        return -EAGAIN;
+    }
+    old = READ_ONCE(inode->logs[pos]);
+
+    if (unlikely(read_seqcount_retry(&inode->seq, seq))) {
+        goto retry;
+    }
+
+    if (unlikely(!cmpxchg2(&inode->logs[pos], old, log))) {
+        /* raced with another update of this key */
+        goto retry;
+    }
+
+    if (unlikely(read_seqcount_retry(&inode->seq, seq))) {
+        /* the slot may have been moved or dropped meanwhile */
+        return -EAGAIN;
+    }
+
+    ihint_put(shim_cli, inode);
+
+    return ret ? 0 : -EEXIST;
+}
+
+int shim_upsert(shim_cli_t *shim_cli, k_t key, oplog_t log) {
+    inode_t *inode;
+    int ret;
+
+    ret = upsert_optimistic(shim_cli, key, log);
+    if (ret != -EAGAIN) {
+        return ret;
+    }
+
+    inode = iget_locked(shim_cli, key);
+
+    ret = upsert_locked(shim_cli, &inode, key, log);
+
     spin_unlock(&inode->lock);
 
+    return ret;
+}
+
+/*
+ * Upsert @n keys sorted in key order (later ones of equal keys win): consecutive keys that
+ * fall into the same inode are applied under one lock acquisition.
+ */
+int shim_upsert_batch(shim_cli_t *shim_cli, const k_t *keys, const oplog_t *logs, int n) {
+    inode_t *inode = NULL;
+    int i, ret;
+
+    for (i = 0; i < n; i++) {
+        if (inode && !key_within_rfence(shim_cli, inode, keys[i])) {
+            spin_unlock(&inode->lock);
+            inode = NULL;
+        }
+        if (!inode) {
+            inode = iget_locked(shim_cli, keys[i]);
+        }
+
+        ret = upsert_locked(shim_cli, &inode, keys[i], logs[i]);
+        if (unlikely(ret && ret != -EEXIST)) {
+            pr_err("failed to upsert: %s", strerror(-ret));
+            goto out;
+        }
+    }
+
+    ret = 0;
+
 out:
+    if (inode) {
+        spin_unlock(&inode->lock);
+    }
     return ret;
 }
 
-int shim_lookup(shim_cli_t *shim_cli, k_t key, uint64_t *valp) {
+/*
+ * lookup in DRAM/local tiers, return -ERANGE and @dgroup if dset should be searched
+ *
+ * If @hint is given, the search starts from *@hint (the inode of a preceding key) instead of the
+ * index, and *@hint is set to the inode of @key.
+ */
+static int lookup_local(shim_cli_t *shim_cli, k_t key, uint64_t *valp, dgroup_t *dgroup, inode_t **hint) {
     inode_t *inode, *next;
     char rfence_buf[256];
-    uint32_t validmap;
+    uint64_t validmap;
     size_t rfence_len;
     unsigned int seq;
-    int pos, ret;
+    int pos, ret, hops = 0;
     k_t rfence;
 
-    inode = iget_unlocked(shim_cli, key);
+    if (hint && *hint && !READ_ONCE((*hint)->deleted)) {
+        inode = *hint;
+    } else {
+        inode = iget_unlocked(shim_cli, key);
+    }
 
 retry:
     seq = read_seqcount_begin(&inode->seq);
@@ -400,43 +890,281 @@ retry:
     rfence = (k_t) { rfence_buf, rfence_len };
 
     if (unlikely(k_cmp(shim_cli->kc, key, rfence) >= 0)) {
-        inode = next;
+        /* the hint only saves an index lookup if @key is close, otherwise go through the index */
+        inode = hint && hops++ == 1 ? iget_unlocked(shim_cli, key) : next;
         goto retry;
     }
 
     ret = search_log(shim_cli, inode, validmap, key, valp, &pos);
 
+    dgroup_copy(dgroup, inode->dgroup);
+
+    i_touch(shim_cli, inode);
+
     if (unlikely(read_seqcount_retry(&inode->seq, seq))) {
         goto retry;
     }
 
+    if (hint) {
+        *hint = inode;
+    }
+
+    ihint_put(shim_cli, inode);
+
+    return ret;
+}
+
+int shim_lookup(shim_cli_t *shim_cli, k_t key, uint64_t *valp) {
+    dgroup_t dgroup;
+    int ret;
+
+    ret = lookup_local(shim_cli, key, valp, &dgroup, NULL);
+
     /* tiered lookup */
     if (ret == -ERANGE) {
-        ret = search_dset(shim_cli, inode, key, valp);
+        ret = dset_lookup(shim_cli->dcli, dgroup, key, valp);
+    }
+
+    return ret;
+}
+
+int shim_lookup_start(shim_cli_t *shim_cli, k_t key, uint64_t *valp, dlookup_t *dl) {
+    dgroup_t dgroup;
+    int ret;
+
+    ret = lookup_local(shim_cli, key, valp, &dgroup, NULL);
+
+    /* tiered lookup, may go asynchronous */
+    if (ret == -ERANGE) {
+        ret = dset_lookup_start(shim_cli->dcli, dgroup, key, valp, dl);
     }
 
     return ret;
 }
 
-int shim_scan(shim_cli_t *shim_cli, k_t key, int len) {
-    dgroup_t last_dgroup;
-    bool first = true;
+int shim_lookup_resume(shim_cli_t *shim_cli, dlookup_t *dl, uint64_t *valp) {
+    return dset_lookup_resume(shim_cli->dcli, dl, valp);
+}
+
+/* look up @n (at most MAX_MULTI_LOOKUP) keys in key order, see dset_multi_lookup */
+int shim_multi_lookup(shim_cli_t *shim_cli, const k_t *keys, int n, uint64_t *vals, int *rets, dlookup_t *dls) {
+    dgroup_t dgroups[MAX_MULTI_LOOKUP];
+    inode_t *inode = NULL;
+    bool remote = false;
+    int i, ret = 0;
+
+    bonsai_assert(n <= MAX_MULTI_LOOKUP);
+
+    /* a single pass over the inodes, as keys are sorted */
+    for (i = 0; i < n; i++) {
+        rets[i] = lookup_local(shim_cli, keys[i], &vals[i], &dgroups[i], &inode);
+        remote |= rets[i] == -ERANGE;
+    }
+
+    /* tiered lookup */
+    if (remote) {
+        ret = dset_multi_lookup(shim_cli->dcli, dgroups, keys, n, vals, rets, dls);
+    }
+
+    return ret;
+}
+
+struct scan_ent {
+    k_t key;
+    uint64_t valp;
+    bool deleted;
+    /* order of collection, newer versions of a key are collected earlier */
+    int ord;
+};
+
+struct scan_ctx {
+    shim_cli_t *shim_cli;
+    struct scan_ent *ents;
+    int nr, cap;
+};
+
+/* a consistent copy of the inode fields needed by scan */
+struct inode_snap {
+    unsigned long validmap;
+    oplog_t logs[INODE_FANOUT];
+#ifdef INODE_SORTED
+    int nr_perm;
+    uint8_t perm[INODE_FANOUT];
+#endif
+    inode_t *next;
+    dgroup_t dgroup;
+    size_t rfence_len;
+    char rfence[256];
+};
+
+static inline void inode_snapshot(inode_t *inode, struct inode_snap *snap) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&inode->seq);
+
+        snap->validmap = inode->validmap;
+        memcpy(snap->logs, inode->logs, sizeof(snap->logs));
+#ifdef INODE_SORTED
+        snap->nr_perm = inode->nr_perm;
+        memcpy(snap->perm, inode->perm, sizeof(snap->perm));
+#endif
+        snap->next = inode->next;
+        dgroup_copy(&snap->dgroup, inode->dgroup);
+        snap->rfence_len = inode->rfence_len;
+        memcpy(snap->rfence, i_rfence(inode).key, snap->rfence_len);
+    } while (unlikely(read_seqcount_retry(&inode->seq, seq)));
+}
+
+static int scan_add(k_t key, uint64_t valp, bool deleted, void *priv) {
+    struct scan_ctx *ctx = priv;
+    struct scan_ent *ents;
+    int cap;
+
+    if (unlikely(ctx->nr == ctx->cap)) {
+        cap = max(2 * ctx->cap, 64);
+        ents = realloc(ctx->ents, cap * sizeof(*ents));
+        if (unlikely(!ents)) {
+            pr_err("failed to allocate memory for scan entries");
+            return -ENOMEM;
+        }
+        ctx->ents = ents;
+        ctx->cap = cap;
+    }
+
+    ctx->ents[ctx->nr] = (struct scan_ent) { key, valp, deleted, ctx->nr };
+    ctx->nr++;
+
+    return 0;
+}
+
+static int scan_cmp(const void *a, const void *b, void *priv) {
+    const struct scan_ent *p = a, *q = b;
+    shim_cli_t *shim_cli = priv;
+    int cmp = k_cmp(shim_cli->kc, p->key, q->key);
+    return cmp ? : p->ord - q->ord;
+}
+
+/*
+ * Range scan from @key, feeding up to @len live key/value pairs to @scanner in key order.
+ *
+ * The range is processed by segments of consecutive inodes sharing a dgroup. Pairs of a segment
+ * are collected from the inode logs, the bnode and the dnode (newest first), sorted, and the
+ * newest version of each key is taken. The dnode of the next segment is read in background
+ * while the current segment is processed.
+ */
+int shim_scan(shim_cli_t *shim_cli, k_t key, int len, shim_scanner scanner, void *priv) {
+    struct scan_ctx ctx = { .shim_cli = shim_cli };
+    char fence_bufs[2][256];
+    struct inode_snap snap;
+    int nr = 0, ret = 0, i, b = 0;
+    k_t lo = key, hi, log_key;
+    dgroup_t dgroup;
+    struct scan_ent *ent;
     inode_t *inode;
-    int nr = 0;
+    uint64_t valp;
+    bool last;
+    op_t op;
+#ifdef INODE_SORTED
+    bool above_lo = false;
+    int j;
+#endif
 
-    for (inode = iget_unlocked(shim_cli, key); inode; inode = inode->next) {
-        if (!first && dgroup_is_eq(last_dgroup, inode->dgroup)) {
-            continue;
+    dset_scan_begin(shim_cli->dcli);
+
+    inode = iget_unlocked(shim_cli, key);
+    inode_snapshot(inode, &snap);
+    while (snap.next && k_cmp(shim_cli->kc, key, (k_t) { snap.rfence, snap.rfence_len }) >= 0) {
+        inode = snap.next;
+        inode_snapshot(inode, &snap);
+    }
+
+    dset_scan_prefetch(shim_cli->dcli, snap.dgroup);
+
+    while (nr < len) {
+        dgroup_copy(&dgroup, snap.dgroup);
+        ctx.nr = 0;
+
+        /* collect in-log pairs of the segment */
+        for (;;) {
+#ifdef INODE_SORTED
+            /* in key order, so only a prefix of the first inode can be below @lo */
+            for (j = 0; j < snap.nr_perm; j++) {
+                op = logger_get(shim_cli->logger_cli, snap.logs[snap.perm[j]], &log_key, &valp);
+                if (!above_lo && k_cmp(shim_cli->kc, log_key, lo) < 0) {
+                    continue;
+                }
+                above_lo = true;
+                ret = scan_add(log_key, valp, op == OP_DEL, &ctx);
+                if (unlikely(ret)) {
+                    goto out;
+                }
+            }
+#else
+            for_each_set_bit(i, &snap.validmap, INODE_FANOUT) {
+                op = logger_get(shim_cli->logger_cli, snap.logs[i], &log_key, &valp);
+                if (k_cmp(shim_cli->kc, log_key, lo) < 0) {
+                    continue;
+                }
+                ret = scan_add(log_key, valp, op == OP_DEL, &ctx);
+                if (unlikely(ret)) {
+                    goto out;
+                }
+            }
+#endif
+
+            last = !snap.next;
+            if (last) {
+                break;
+            }
+
+            memcpy(fence_bufs[b], snap.rfence, snap.rfence_len);
+            hi = (k_t) { fence_bufs[b], snap.rfence_len };
+
+            inode = snap.next;
+            inode_snapshot(inode, &snap);
+            if (!dgroup_is_eq(snap.dgroup, dgroup)) {
+                break;
+            }
         }
 
-        nr += dset_scan(shim_cli->dcli, inode->dgroup);
-        if (unlikely(nr >= len)) {
+        /* start reading the next dnode before searching the current one */
+        if (!last) {
+            dset_scan_prefetch(shim_cli->dcli, snap.dgroup);
+        }
+
+        ret = dset_scan(shim_cli->dcli, dgroup, lo, last ? NULL : &hi, scan_add, &ctx);
+        if (unlikely(ret)) {
+            goto out;
+        }
+
+        /* newest version of each key wins */
+        qsort_r(ctx.ents, ctx.nr, sizeof(*ctx.ents), scan_cmp, shim_cli);
+        for (i = 0; i < ctx.nr && nr < len; i++) {
+            ent = &ctx.ents[i];
+            if (i && !k_cmp(shim_cli->kc, ent->key, ctx.ents[i - 1].key)) {
+                continue;
+            }
+            if (ent->deleted) {
+                continue;
+            }
+            nr++;
+            if (scanner(ent->key, ent->valp, priv)) {
+                goto out;
+            }
+        }
+
+        if (last) {
             break;
         }
 
-        last_dgroup = inode->dgroup;
-        first = false;
+        lo = hi;
+        b ^= 1;
     }
+
+out:
+    free(ctx.ents);
+    return ret ? : nr;
 }
 
 int shim_update_dgroup(shim_cli_t *shim_cli, k_t s, k_t t, dgroup_t dgroup) {
@@ -473,7 +1201,7 @@ int shim_update_dgroup(shim_cli_t *shim_cli, k_t s, k_t t, dgroup_t dgroup) {
 
         /* split if is > lfence */
         if (k_cmp(shim_cli->kc, is, lfence) > 0) {
-            i_split(shim_cli, inode, is);
+            i_split(shim_cli, inode, is, (k_t) { });
             next = inode->next;
             spin_unlock(&inode->lock);
             inode = next;
@@ -481,11 +1209,13 @@ int shim_update_dgroup(shim_cli_t *shim_cli, k_t s, k_t t, dgroup_t dgroup) {
 
         /* split if it < rfence */
         if (k_cmp(shim_cli->kc, it, rfence) < 0) {
-            i_split(shim_cli, inode, it);
+            i_split(shim_cli, inode, it, (k_t) { });
             spin_unlock(&inode->next->lock);
         }
 
+        write_seqcount_begin(&inode->seq);
         dgroup_copy(&inode->dgroup, dgroup);
+        write_seqcount_end(&inode->seq);
 
 next:
         next = inode->next;
@@ -531,17 +1261,51 @@ retry:
     return ret;
 }
 
-void shim_scan_logs(shim_cli_t *shim_cli, shim_log_scanner scanner, void *priv) {
+/* whether the left fence of @inode is below @key, the sentinel is below everything */
+static inline bool i_lfence_below(shim_cli_t *shim_cli, inode_t *inode, k_t key) {
+    return inode == shim_cli->shim->sentinel || k_cmp(shim_cli->kc, i_lfence(inode), key) < 0;
+}
+
+/* first inode whose left fence is within [*@lo, +inf), @lo NULL for the sentinel */
+static inode_t *range_first(shim_cli_t *shim_cli, const k_t *lo) {
+    inode_t *inode;
+
+    if (!lo) {
+        return shim_cli->shim->sentinel;
+    }
+
+    inode = iget_unlocked(shim_cli, *lo);
+    while (inode && i_lfence_below(shim_cli, inode, *lo)) {
+        inode = READ_ONCE(inode->next);
+    }
+
+    return inode;
+}
+
+/* whether @inode is beyond the range ending at *@hi (exclusive, NULL for +inf) */
+static inline bool range_passed(shim_cli_t *shim_cli, inode_t *inode, const k_t *hi) {
+    return !inode || (hi && !i_lfence_below(shim_cli, inode, *hi));
+}
+
+/*
+ * Feed the logs of the inodes whose left fence is within [*@lo, *@hi) to @scanner, along with
+ * their dgroups. @scanner may change dgroups (by splitting bnodes), logs of an inode changed
+ * meanwhile get their dgroup looked up again.
+ */
+void shim_scan_logs_range(shim_cli_t *shim_cli, const k_t *lo, const k_t *hi,
+                          shim_log_scanner scanner, void *priv) {
     inode_t *inode, *isnap;
+    dgroup_t dgroup;
+    bool stale;
     uint64_t valp;
     unsigned seq;
     k_t key;
     int pos;
 
-    isnap = malloc(sizeof(*isnap) + 2 * shim_cli->kc->max_len);
+    isnap = inode_alloc(2 * shim_cli->kc->max_len);
     bonsai_assert(isnap);
 
-    for (inode = shim_cli->shim->sentinel; inode; inode = isnap->next) {
+    for (inode = range_first(shim_cli, lo); !range_passed(shim_cli, inode, hi); inode = isnap->next) {
         /* snapshot the inode */
         do {
             seq = read_seqcount_begin(&inode->seq);
@@ -549,46 +1313,123 @@ void shim_scan_logs(shim_cli_t *shim_cli, shim_log_scanner scanner, void *priv)
         } while (unlikely(read_seqcount_retry(&inode->seq, seq)));
 
         /* scan logs */
+        stale = false;
         for_each_set_bit(pos, &isnap->validmap, INODE_FANOUT) {
             logger_get(shim_cli->logger_cli, isnap->logs[pos], &key, &valp);
-            scanner(isnap->logs[pos], isnap->dgroup, priv);
+
+            stale = stale || read_seqcount_retry(&inode->seq, seq);
+            if (unlikely(stale)) {
+                shim_lookup_dgroup(shim_cli, key, &dgroup);
+            } else {
+                dgroup_copy(&dgroup, isnap->dgroup);
+            }
+
+            scanner(isnap->logs[pos], dgroup, priv);
         }
     }
 
     free(isnap);
 }
 
+void shim_scan_logs(shim_cli_t *shim_cli, shim_log_scanner scanner, void *priv) {
+    shim_scan_logs_range(shim_cli, NULL, NULL, scanner, priv);
+}
+
+/* the left fence of the first inode of the dgroup segment after the one holding @key */
+int shim_next_dgroup_fence(shim_cli_t *shim_cli, k_t key, char *buf, k_t *fence) {
+    inode_t *inode, *next;
+    dgroup_t dgroup;
+    int ret = 0;
+
+    inode = iget_locked(shim_cli, key);
+    dgroup_copy(&dgroup, inode->dgroup);
+
+    for (;;) {
+        next = inode->next;
+        if (!next) {
+            ret = -ENOENT;
+            break;
+        }
+        spin_lock(&next->lock);
+        spin_unlock(&inode->lock);
+        inode = next;
+
+        if (!dgroup_is_eq(inode->dgroup, dgroup)) {
+            memcpy(buf, i_lfence(inode).key, inode->lfence_len);
+            *fence = (k_t) { buf, inode->lfence_len };
+            break;
+        }
+    }
+
+    spin_unlock(&inode->lock);
+
+    return ret;
+}
+
 static void inode_gc(shim_cli_t *shim_cli, inode_t *inode) {
     int pos;
 
     /* clear stale logs */
+    write_seqcount_begin(&inode->seq);
     for_each_set_bit(pos, &inode->validmap, INODE_FANOUT) {
         if (logger_is_stale(shim_cli->logger_cli, inode->logs[pos])) {
             __clear_bit(pos, &inode->validmap);
         }
     }
+#ifdef INODE_SORTED
+    i_perm_compact(inode);
+#endif
+    write_seqcount_end(&inode->seq);
+}
+
+static void reclaim_inode(void *ctx, uint64_t a, uint64_t b) {
+    free(ctx);
 }
 
 /* merge inode into prev */
 static void inode_merge(shim_cli_t *shim_cli, inode_t *prev, inode_t *inode) {
-    uint64_t inode_bmp, prev_bmp;
+    uint64_t prev_bmp;
     int pos, i;
+#ifdef INODE_SORTED
+    int k;
+#else
+    uint64_t inode_bmp;
+#endif
+
+    /* lock-free updates of @inode fail from now on */
+    write_seqcount_begin(&inode->seq);
 
+#ifndef INODE_SORTED
     inode_bmp = inode->validmap;
+#endif
     prev_bmp = prev->validmap;
 
     /* copy data to prev */
+#ifdef INODE_SORTED
+    /* keys of @inode are all greater than those of @prev, append them in order */
+    for (k = 0; k < inode->nr_perm; k++) {
+        pos = inode->perm[k];
+        i = find_first_zero_bit(&prev_bmp, INODE_FANOUT);
+        bonsai_assert(i < INODE_FANOUT);
+        __set_bit(i, &prev_bmp);
+        i_copy_slot(prev, i, inode, pos);
+        prev->perm[prev->nr_perm + k] = i;
+    }
+#else
     for_each_set_bit(pos, &inode_bmp, INODE_FANOUT) {
         i = find_first_zero_bit(&prev_bmp, INODE_FANOUT);
         bonsai_assert(i < INODE_FANOUT);
         __set_bit(i, &prev_bmp);
-        prev->logs[i] = inode->logs[pos];
-        prev->fgprt[i] = inode->fgprt[pos];
+        i_copy_slot(prev, i, inode, pos);
     }
+#endif
 
     /* update prev atomically */
     write_seqcount_begin(&prev->seq);
     prev->validmap = prev_bmp;
+#ifdef INODE_SORTED
+    prev->nr_perm += inode->nr_perm;
+#endif
     prev->next = inode->next;
     prev->rfence_len = inode->rfence_len;
     memcpy(i_rfence(prev).key, i_rfence(inode).key, inode->rfence_len);
@@ -596,18 +1437,39 @@ static void inode_merge(shim_cli_t *shim_cli, inode_t *prev, inode_t *inode) {
 
     /* remove inode from index */
     inode->deleted = 1;
+    write_seqcount_end(&inode->seq);
     index_remove(shim_cli->index, i_lfence(inode));
 
-    /* delay free inode */
-    /* TODO: finish me */
+    /* drop all inode hints, after @inode is marked deleted */
+    xadd(&shim_cli->shim->igen, 1);
+
+    /* lock-free readers and lookup hints may still hold it */
+    reclaim_defer(reclaim_inode, inode, 0, 0);
 }
 
-void shim_gc(shim_cli_t *shim_cli) {
-    inode_t *inode, *prev = NULL;
+static inline bool inode_is_hot(shim_cli_t *shim_cli, inode_t *inode) {
+    uint32_t hot_hits = shim_cli->shim->hot_hits;
+    return hot_hits && inode->hits >= hot_hits;
+}
+
+/*
+ * GC the inodes whose left fence is within [*@lo, *@hi), passing the left fence of each one left
+ * to @sampler. Returns the nr of inodes left in the range.
+ *
+ * Besides dropping stale logs, adapt inodes to the access skew seen since the last round: hot
+ * inodes are split at the median to shorten their probes and spread their lock traffic, and
+ * adjacent inodes are merged when they fit in one and neither is hot. Access counters decay
+ * by half each round. The first inode of the range is never merged into its predecessor, so
+ * that disjoint ranges can be GCed concurrently.
+ */
+int shim_gc_range(shim_cli_t *shim_cli, const k_t *lo, const k_t *hi,
+                  shim_fence_sampler sampler, void *priv) {
+    inode_t *inode, *prev = NULL, *next;
+    int nr = 0;
 
-    inode = shim_cli->shim->sentinel;
+    inode = range_first(shim_cli, lo);
 
-    while (inode) {
+    while (!range_passed(shim_cli, inode, hi)) {
         spin_lock(&inode->lock);
 
         /* gc current inode */
@@ -615,11 +1477,31 @@ void shim_gc(shim_cli_t *shim_cli) {
 
         /* if can be merged with prev inode */
         if (prev &&
-            hweight64(prev->validmap) + hweight64(inode->validmap) <= INODE_FANOUT &&
-            dgroup_is_eq(prev->dgroup, inode->dgroup)) {
+            hweight64(prev->validmap) + hweight64(inode->validmap) <= shim_cli->fanout &&
+            dgroup_is_eq(prev->dgroup, inode->dgroup) &&
+            !inode_is_hot(shim_cli, prev) && !inode_is_hot(shim_cli, inode)) {
             inode_merge(shim_cli, prev, inode);
+
+            /* @inode is gone, @prev stays as the predecessor of its successor */
+            next = inode->next;
+            spin_unlock(&inode->lock);
+            inode = next;
+            continue;
         }
 
+        /* split hot inode, its upper half is visited next */
+        if (inode_is_hot(shim_cli, inode) && hweight64(inode->validmap) >= INODE_MIN_HOT_SPLIT) {
+            i_split(shim_cli, inode, (k_t) { }, (k_t) { });
+            spin_unlock(&inode->next->lock);
+        }
+
+        inode->hits /= 2;
+
+        if (sampler && inode != shim_cli->shim->sentinel) {
+            sampler(i_lfence(inode), priv);
+        }
+        nr++;
+
         /* unlock prev inode, go to next node */
         if (prev) {
             spin_unlock(&prev->lock);
@@ -631,6 +1513,16 @@ void shim_gc(shim_cli_t *shim_cli) {
     if (prev) {
         spin_unlock(&prev->lock);
     }
+
+    return nr;
+}
+
+void shim_gc(shim_cli_t *shim_cli) {
+    shim_gc_range(shim_cli, NULL, NULL, NULL, NULL);
+}
+
+void shim_thread_init(shim_cli_t *shim_cli) {
+    index_thread_init(shim_cli->index);
 }
 
 static cJSON *inode_dump(shim_cli_t *shim_cli, inode_t *inode) {
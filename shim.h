@@ -15,13 +15,17 @@
 #include "dset.h"
 #include "k.h"
 
+#define MAX_MULTI_LOOKUP    32
+
 typedef int shim_log_scanner(uint64_t log, dgroup_t dgroup, void *priv);
+typedef int shim_scanner(k_t key, uint64_t valp, void *priv);
+typedef void shim_fence_sampler(k_t fence, void *priv);
 
 typedef struct shim shim_t;
 typedef struct shim_cli shim_cli_t;
 typedef struct inode inode_t;
 
-shim_t *shim_create(index_t *index, kc_t *kc);
+shim_t *shim_create(index_t *index, kc_t *kc, int fanout, int hot_hits);
 void shim_destroy(shim_t *shim);
 
 shim_cli_t *shim_create_cli(shim_t *shim, logger_cli_t *logger_cli);
@@ -29,14 +33,25 @@ void shim_set_dcli(shim_cli_t *shim_cli, dcli_t *dcli);
 void shim_destroy_cli(shim_cli_t *shim_cli);
 
 int shim_upsert(shim_cli_t *shim_cli, k_t key, oplog_t log);
+int shim_upsert_batch(shim_cli_t *shim_cli, const k_t *keys, const oplog_t *logs, int n);
 int shim_lookup(shim_cli_t *shim_cli, k_t key, uint64_t *valp);
-int shim_scan(shim_cli_t *shim_cli, k_t key, int len);
+int shim_lookup_start(shim_cli_t *shim_cli, k_t key, uint64_t *valp, dlookup_t *dl);
+int shim_lookup_resume(shim_cli_t *shim_cli, dlookup_t *dl, uint64_t *valp);
+int shim_multi_lookup(shim_cli_t *shim_cli, const k_t *keys, int n, uint64_t *vals, int *rets, dlookup_t *dls);
+int shim_scan(shim_cli_t *shim_cli, k_t key, int len, shim_scanner scanner, void *priv);
 void shim_scan_logs(shim_cli_t *shim_cli, shim_log_scanner scanner, void *priv);
+void shim_scan_logs_range(shim_cli_t *shim_cli, const k_t *lo, const k_t *hi,
+                          shim_log_scanner scanner, void *priv);
 
 int shim_update_dgroup(shim_cli_t *shim_cli, k_t s, k_t t, dgroup_t dgroup);
 int shim_lookup_dgroup(shim_cli_t *shim_cli, k_t key, dgroup_t *dgroup);
 
 void shim_gc(shim_cli_t *shim_cli);
+int shim_gc_range(shim_cli_t *shim_cli, const k_t *lo, const k_t *hi,
+                  shim_fence_sampler sampler, void *priv);
+int shim_next_dgroup_fence(shim_cli_t *shim_cli, k_t key, char *buf, k_t *fence);
+
+void shim_thread_init(shim_cli_t *shim_cli);
 
 cJSON *shim_dump(shim_cli_t *shim_cli);
 
@@ -0,0 +1,94 @@
+/*
+ * BonsaiKV+: Scaling persistent in-memory key-value store for modern tiered, heterogeneous memory systems
+ *
+ * Pieces shared by the benchmark drivers: the integer key class, a fast per-thread RNG, common
+ * kv_conf settings, and an in-process memory node for loopback ("shm:") hosts.
+ *
+ * Hohai University
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <endian.h>
+
+#include "../kv.h"
+#include "../rpm.h"
+#include "../utils.h"
+#include "../hash.h"
+
+/* settings of the log and data layers the benchmarks share */
+#define BENCH_KV_CONF_COMMON            \
+    .rpma_interval_us = 10,             \
+    .logger_lcb_size = 4096,            \
+    .dset_bnode_size = 2048,            \
+    .dset_dnode_size = 8192,            \
+    .dset_max_gc_prefetch = 4
+
+static uint64_t int_min_key = 0, int_max_key = UINT64_MAX;
+
+/* integer keys are stored big-endian, so that byte-wise (index) and numeric (kc) orders agree */
+static int int_key_cmp(k_t a, k_t b) {
+    uint64_t x = be64toh(*(uint64_t *) a.key), y = be64toh(*(uint64_t *) b.key);
+    if (x == y) {
+        return 0;
+    }
+    return x < y ? -1 : 1;
+}
+
+static uint64_t int_key_hash(k_t key) {
+    return hash_64(*(uint64_t *) key.key, 64);
+}
+
+static int int_key_dump(k_t key, char *buf, int buflen) {
+    snprintf(buf, buflen, "%lu", be64toh(*(uint64_t *) key.key));
+    return 0;
+}
+
+static kc_t int_kc = {
+    .min = { (char *) &int_min_key, sizeof(uint64_t) },
+    .max = { (char *) &int_max_key, sizeof(uint64_t) },
+    .max_len = sizeof(uint64_t),
+    .cmp = int_key_cmp,
+    .hash = int_key_hash,
+    .dump = int_key_dump
+};
+
+/* xorshift64* */
+static inline uint64_t rand_next(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dul;
+}
+
+/* uniform in [0, 1) */
+static inline double rand_double(uint64_t *state) {
+    return (rand_next(state) >> 11) * (1.0 / (1ul << 53));
+}
+
+/* start a single-domain memory node on PM device @dev in this process, serving @host */
+static inline kv_rm_t *bench_start_mn(const char *host, const char *dev) {
+    static const char *dev_paths[1];
+    static int permutes[] = { 0 };
+    static rpma_dom_conf_t dom_conf = { .dev_paths = dev_paths };
+    static rpma_conf_t rpma_conf = {
+        .nr_doms = 1,
+        .nr_dev_per_dom = 1,
+        .strip_size = 256,
+        .nr_permutes = 1,
+        .permutes = permutes,
+        .segment_size = 32,
+        .dom_confs = &dom_conf
+    };
+    static kv_rm_conf_t conf = {
+        .rpma_conf = &rpma_conf
+    };
+
+    dom_conf.host = host;
+    dev_paths[0] = dev;
+
+    return kv_rm_create(&conf);
+}
+
+#endif //BENCH_H
@@ -0,0 +1,250 @@
+/*
+ * BonsaiKV+: Scaling persistent in-memory key-value store for modern tiered, heterogeneous memory systems
+ *
+ * Index backend microbenchmark
+ *
+ * Fills each index backend with the left fences of a given nr of inodes (dense 8-byte integer
+ * keys, @stride apart, inserted in random order), then runs lock-free point lookups of random
+ * keys (each one resolves to the inode covering it) with multiple threads. Reports upsert and
+ * lookup throughput, and DRAM per inode (resident set growth while filling).
+ *
+ * Hohai University
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <endian.h>
+
+#include <cjson/cJSON.h>
+
+#include "../index.h"
+#include "../reclaim.h"
+#include "../atomic.h"
+#include "bench.h"
+
+struct worker {
+    pthread_t thread;
+    index_t *index;
+    uint64_t rand_state;
+
+    uint64_t nr_ops;
+    bool failed;
+};
+
+static const index_ops_t *all_backends[] = { &index_mt_ops, &index_art_ops };
+
+static const char *backend;
+static int nr_threads = 4;
+static uint64_t nr_inodes = 1000000;
+static uint64_t stride = 16;
+static int duration_s = 5;
+
+static pthread_barrier_t barrier;
+static volatile bool stop;
+
+static size_t rss_bytes(void) {
+    long pages = 0, rss = 0;
+    FILE *f;
+
+    f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &rss) != 2) {
+            rss = 0;
+        }
+        fclose(f);
+    }
+
+    return rss * sysconf(_SC_PAGESIZE);
+}
+
+static void *worker_fn(void *arg) {
+    struct worker *w = arg;
+    uint64_t key, be;
+    void *val;
+
+    reclaim_thread_init();
+    index_thread_init(w->index);
+
+    pthread_barrier_wait(&barrier);
+
+    while (!READ_ONCE(stop)) {
+        key = rand_next(&w->rand_state) % (nr_inodes * stride);
+        be = htobe64(key);
+
+        reclaim_read_lock();
+        val = index_find_first_ge(w->index, (k_t) { (char *) &be, sizeof(be) });
+        reclaim_read_unlock();
+
+        /* values are inode numbers + 1 */
+        if (unlikely(IS_ERR(val) || (uintptr_t) val != key / stride + 1)) {
+            w->failed = true;
+        }
+
+        w->nr_ops++;
+    }
+
+    return NULL;
+}
+
+static cJSON *run_backend(const index_ops_t *ops) {
+    uint64_t *order, i, j, be, nr_ops = 0, start;
+    double upsert_s, mem_per_inode;
+    struct worker *workers;
+    bool failed = false;
+    index_t *index;
+    cJSON *result;
+    size_t rss;
+    int t, ret;
+
+    index = index_create(ops->name, &int_kc);
+    if (unlikely(IS_ERR(index))) {
+        return NULL;
+    }
+
+    /* random insertion order */
+    order = malloc(nr_inodes * sizeof(*order));
+    bonsai_assert(order);
+    start = get_rand_seed() | 1;
+    for (i = 0; i < nr_inodes; i++) {
+        order[i] = i;
+    }
+    for (i = nr_inodes - 1; i > 0; i--) {
+        j = rand_next(&start) % (i + 1);
+        be = order[i];
+        order[i] = order[j];
+        order[j] = be;
+    }
+
+    rss = rss_bytes();
+    start = get_ns();
+    for (i = 0; i < nr_inodes; i++) {
+        be = htobe64(order[i] * stride);
+        index_upsert(index, (k_t) { (char *) &be, sizeof(be) }, (void *) (uintptr_t) (order[i] + 1));
+    }
+    upsert_s = (get_ns() - start) / 1e9;
+    mem_per_inode = (double) (rss_bytes() - rss) / nr_inodes;
+
+    free(order);
+
+    workers = calloc(nr_threads, sizeof(*workers));
+    bonsai_assert(workers);
+
+    stop = false;
+    pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+
+    for (t = 0; t < nr_threads; t++) {
+        workers[t].index = index;
+        workers[t].rand_state = get_rand_seed() | 1;
+        ret = pthread_create(&workers[t].thread, NULL, worker_fn, &workers[t]);
+        bonsai_assert(!ret);
+    }
+
+    pthread_barrier_wait(&barrier);
+    sleep(duration_s);
+    WRITE_ONCE(stop, true);
+
+    for (t = 0; t < nr_threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        nr_ops += workers[t].nr_ops;
+        failed |= workers[t].failed;
+    }
+
+    pthread_barrier_destroy(&barrier);
+    free(workers);
+
+    if (unlikely(failed)) {
+        pr_err("%s: lookups returned wrong inodes", ops->name);
+    }
+
+    result = cJSON_CreateObject();
+    cJSON_AddStringToObject(result, "backend", ops->name);
+    cJSON_AddNumberToObject(result, "inodes", nr_inodes);
+    cJSON_AddNumberToObject(result, "threads", nr_threads);
+    cJSON_AddNumberToObject(result, "upsert_mops", nr_inodes / 1e6 / upsert_s);
+    cJSON_AddNumberToObject(result, "lookup_mops", nr_ops / 1e6 / duration_s);
+    cJSON_AddNumberToObject(result, "bytes_per_inode", mem_per_inode);
+    cJSON_AddBoolToObject(result, "correct", !failed);
+
+    /* nothing is retired by lookups, destroy right away */
+    index_destroy(index);
+
+    return result;
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s [options]\n"
+           "  -b, --backend NAME     index backend (masstree or art, default all)\n"
+           "  -t, --threads N        lookup threads (default 4)\n"
+           "  -n, --inodes N         nr of inodes (default 1000000)\n"
+           "  -s, --stride N         keys per inode (default 16)\n"
+           "  -d, --duration S       lookup run time in seconds (default 5)\n"
+           "  -h, --help             show this message\n", prog);
+}
+
+static int parse_args(int argc, char *argv[]) {
+    static struct option opts[] = {
+        { "backend", required_argument, NULL, 'b' },
+        { "threads", required_argument, NULL, 't' },
+        { "inodes", required_argument, NULL, 'n' },
+        { "stride", required_argument, NULL, 's' },
+        { "duration", required_argument, NULL, 'd' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "b:t:n:s:d:h", opts, NULL)) != -1) {
+        switch (c) {
+            case 'b': backend = optarg; break;
+            case 't': nr_threads = atoi(optarg); break;
+            case 'n': nr_inodes = strtoul(optarg, NULL, 0); break;
+            case 's': stride = strtoul(optarg, NULL, 0); break;
+            case 'd': duration_s = atoi(optarg); break;
+            case 'h': usage(argv[0]); exit(0);
+            default: usage(argv[0]); return -EINVAL;
+        }
+    }
+
+    if (unlikely(nr_threads <= 0 || !nr_inodes || !stride || duration_s <= 0)) {
+        usage(argv[0]);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    cJSON *results, *result;
+    char *out;
+    int i, ret;
+
+    ret = parse_args(argc, argv);
+    if (unlikely(ret)) {
+        return 1;
+    }
+
+    reclaim_thread_init();
+
+    results = cJSON_CreateArray();
+
+    for (i = 0; i < ARRAY_LEN(all_backends); i++) {
+        if (backend && strcmp(backend, all_backends[i]->name)) {
+            continue;
+        }
+
+        result = run_backend(all_backends[i]);
+        if (unlikely(!result)) {
+            pr_err("failed to run backend %s", all_backends[i]->name);
+            return 1;
+        }
+        cJSON_AddItemToArray(results, result);
+    }
+
+    out = cJSON_Print(results);
+    printf("%s\n", out);
+    free(out);
+    cJSON_Delete(results);
+
+    return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * BonsaiKV+: Scaling persistent in-memory key-value store for modern tiered, heterogeneous memory systems
+ *
+ * Inode layout microbenchmark
+ *
+ * Runs a mixed kv_get/kv_put workload on a small hot key set (so that all the traffic stays in
+ * the inode layer) with multiple threads, and reports throughput together with L1D/LLC misses
+ * per operation. Build with and without -DINODE_SPLIT_LAYOUT=ON to compare inode layouts.
+ *
+ * Hohai University
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <endian.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+
+#include "../atomic.h"
+#include "bench.h"
+
+#define LOG_REGION_SIZE     (1024 * 1024 * 1024ul)
+
+#ifdef INODE_SPLIT_LAYOUT
+#define LAYOUT              "split"
+#else
+#define LAYOUT              "packed"
+#endif
+
+enum {
+    CNT_L1D_MISS = 0,
+    CNT_LLC_MISS,
+    NR_CNTS
+};
+
+struct worker {
+    int id;
+    pthread_t thread;
+    kv_cli_t *cli;
+    uint64_t rand_state;
+
+    uint64_t nr_ops;
+    uint64_t cnts[NR_CNTS];
+    bool has_cnts;
+};
+
+static int nr_threads = 4;
+static uint64_t nr_keys = 4096;
+static double read_ratio = 0.5;
+static int duration_s = 5;
+
+static struct worker *workers;
+static pthread_barrier_t barrier;
+static volatile bool stop;
+static kv_t *kv;
+
+/* GC is off, so that only the inode layer is measured */
+static kv_conf_t kv_conf = {
+    .kc = &int_kc,
+
+    .rpma_host = "shm:inode_bench",
+
+    .logger_nr_shards = 1,
+    .logger_shard_devs = (const char *[]) { "anon:16G" },
+
+    .dset_bdev = "anon:1G",
+
+    BENCH_KV_CONF_COMMON,
+
+    .auto_gc_logs = false,
+    .auto_gc_pm = false
+};
+
+static int perf_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    /* this thread, any CPU */
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void *worker_fn(void *arg) {
+    int fds[NR_CNTS], i, ret;
+    kv_cli_conf_t cli_conf = { 0 };
+    struct worker *w = arg;
+    uint64_t key, valp;
+    k_t k;
+
+    cli_conf.id = w->id;
+    cli_conf.logger_region_size = LOG_REGION_SIZE;
+    cli_conf.get_depth = 1;
+    w->cli = kv_cli_create(kv, &cli_conf);
+    if (unlikely(IS_ERR(w->cli))) {
+        pr_err("failed to create kv_cli for worker %d", w->id);
+        abort();
+    }
+
+    /* load our share of the hot keys */
+    for (key = w->id; key < nr_keys; key += nr_threads) {
+        valp = htobe64(key);
+        kv_put(w->cli, (k_t) { (char *) &valp, sizeof(valp) }, key);
+    }
+
+    fds[CNT_L1D_MISS] = perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    fds[CNT_LLC_MISS] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    w->has_cnts = fds[CNT_L1D_MISS] >= 0 && fds[CNT_LLC_MISS] >= 0;
+
+    pthread_barrier_wait(&barrier);
+
+    for (i = 0; i < NR_CNTS && w->has_cnts; i++) {
+        ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    while (!READ_ONCE(stop)) {
+        key = htobe64(rand_next(&w->rand_state) % nr_keys);
+        k = (k_t) { (char *) &key, sizeof(key) };
+
+        if (rand_double(&w->rand_state) < read_ratio) {
+            ret = kv_get(w->cli, k, &valp);
+        } else {
+            ret = kv_put(w->cli, k, rand_next(&w->rand_state));
+        }
+        (void) ret;
+
+        w->nr_ops++;
+    }
+
+    for (i = 0; i < NR_CNTS; i++) {
+        if (w->has_cnts) {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fds[i], &w->cnts[i], sizeof(w->cnts[i])) != sizeof(w->cnts[i])) {
+                w->has_cnts = false;
+            }
+        }
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+
+    pthread_barrier_wait(&barrier);
+
+    kv_cli_destroy(w->cli);
+
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s [options]\n"
+           "  -t, --threads N        client threads (default 4)\n"
+           "  -k, --keys N           size of the hot key set (default 4096)\n"
+           "  -r, --read-ratio R     fraction of kv_get, the rest is kv_put (default 0.5)\n"
+           "  -d, --duration S       run time in seconds (default 5)\n"
+           "  -h, --help             show this message\n", prog);
+}
+
+static int parse_args(int argc, char *argv[]) {
+    static struct option opts[] = {
+        { "threads", required_argument, NULL, 't' },
+        { "keys", required_argument, NULL, 'k' },
+        { "read-ratio", required_argument, NULL, 'r' },
+        { "duration", required_argument, NULL, 'd' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "t:k:r:d:h", opts, NULL)) != -1) {
+        switch (c) {
+            case 't': nr_threads = atoi(optarg); break;
+            case 'k': nr_keys = strtoul(optarg, NULL, 0); break;
+            case 'r': read_ratio = atof(optarg); break;
+            case 'd': duration_s = atoi(optarg); break;
+            case 'h': usage(argv[0]); exit(0);
+            default: usage(argv[0]); return -EINVAL;
+        }
+    }
+
+    if (unlikely(nr_threads <= 0 || !nr_keys || read_ratio < 0 || read_ratio > 1 || duration_s <= 0)) {
+        usage(argv[0]);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t nr_ops = 0, cnts[NR_CNTS] = { };
+    bool has_cnts = true;
+    cJSON *result;
+    char *out;
+    int i, ret;
+
+    ret = parse_args(argc, argv);
+    if (unlikely(ret)) {
+        return 1;
+    }
+
+    if (unlikely(IS_ERR(bench_start_mn(kv_conf.rpma_host, "anon:1G")))) {
+        pr_err("failed to create in-process memory node");
+        return 1;
+    }
+
+    kv = kv_create(&kv_conf);
+    if (unlikely(IS_ERR(kv))) {
+        pr_err("failed to create kv");
+        return 1;
+    }
+
+    workers = calloc(nr_threads, sizeof(*workers));
+    bonsai_assert(workers);
+
+    pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+
+    for (i = 0; i < nr_threads; i++) {
+        workers[i].id = i;
+        workers[i].rand_state = get_rand_seed() | 1;
+        ret = pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]);
+        bonsai_assert(!ret);
+    }
+
+    pthread_barrier_wait(&barrier);
+    sleep(duration_s);
+    WRITE_ONCE(stop, true);
+    pthread_barrier_wait(&barrier);
+
+    for (i = 0; i < nr_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        nr_ops += workers[i].nr_ops;
+        cnts[CNT_L1D_MISS] += workers[i].cnts[CNT_L1D_MISS];
+        cnts[CNT_LLC_MISS] += workers[i].cnts[CNT_LLC_MISS];
+        has_cnts &= workers[i].has_cnts;
+    }
+
+    result = cJSON_CreateObject();
+    cJSON_AddStringToObject(result, "layout", LAYOUT);
+    cJSON_AddNumberToObject(result, "threads", nr_threads);
+    cJSON_AddNumberToObject(result, "keys", nr_keys);
+    cJSON_AddNumberToObject(result, "read_ratio", read_ratio);
+    cJSON_AddNumberToObject(result, "mops", nr_ops / 1e6 / duration_s);
+    if (has_cnts) {
+        cJSON_AddNumberToObject(result, "l1d_misses_per_op", (double) cnts[CNT_L1D_MISS] / nr_ops);
+        cJSON_AddNumberToObject(result, "llc_misses_per_op", (double) cnts[CNT_LLC_MISS] / nr_ops);
+    } else {
+        /* perf events not available (e.g. perf_event_paranoid) */
+        cJSON_AddNullToObject(result, "l1d_misses_per_op");
+        cJSON_AddNullToObject(result, "llc_misses_per_op");
+    }
+
+    out = cJSON_Print(result);
+    printf("%s\n", out);
+    free(out);
+    cJSON_Delete(result);
+
+    pthread_barrier_destroy(&barrier);
+    free(workers);
+
+    kv_destroy(kv);
+
+    return 0;
+}
@@ -53,6 +53,7 @@ static kv_conf_t kv_conf = {
     .dset_dnode_size = 8192,
     .dset_bdev = "data_pm",
     .dset_max_gc_prefetch = 4,
+    .dset_dnode_cache_size = 65536,
 
     .auto_gc_logs = true,
     .auto_gc_pm = false,
@@ -1,11 +1,854 @@
 /*
  * BonsaiKV+: Scaling persistent in-memory key-value store for modern tiered, heterogeneous memory systems
  *
+ * YCSB benchmark driver
+ *
+ * Runs a Load phase followed by any sequence of the standard YCSB core workloads (A-F) with
+ * multiple client threads, each of which owns a dedicated kv_cli. For every phase, throughput
+ * and per-operation latency percentiles are reported as JSON, in the shape used by the tables
+ * in "evaluation/Evaluation Scheme.md".
+ *
  * Hohai University
  */
 
-#include "../utils.h"
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <endian.h>
+#include <math.h>
+#include <time.h>
+
+#include "../atomic.h"
+#include "bench.h"
+
+#define STR_KEY_LEN         24
+#define KEY_BUF_LEN         32
+
+#define LOG_REGION_SIZE     (1024 * 1024 * 1024ul)
+
+#define MAX_GET_BATCH       32
+
+/* inserts of the run phases that may be in flight, see ack_insert */
+#define INSERT_ACK_WINDOW   (1 << 16)
+
+/* log-linear latency histogram: 2^HIST_SUB_BITS linear sub-buckets per power of two */
+#define HIST_SUB_BITS       5
+#define HIST_SUB_CNT        (1 << HIST_SUB_BITS)
+#define HIST_NR_BUCKETS     ((64 - HIST_SUB_BITS + 1) * HIST_SUB_CNT)
+
+typedef enum {
+    DIST_UNIFORM = 0,
+    DIST_ZIPFIAN,
+    DIST_LATEST,
+    NR_DISTS
+} dist_t;
+
+typedef enum {
+    YCSB_READ = 0,
+    YCSB_UPDATE,
+    YCSB_INSERT,
+    YCSB_SCAN,
+    YCSB_RMW,
+    NR_YCSB_OPS
+} ycsb_op_t;
+
+static const char *dist_str[] = {
+    [DIST_UNIFORM] = "uniform",
+    [DIST_ZIPFIAN] = "zipfian",
+    [DIST_LATEST] = "latest"
+};
+
+static const char *ycsb_op_str[] = {
+    [YCSB_READ] = "read",
+    [YCSB_UPDATE] = "update",
+    [YCSB_INSERT] = "insert",
+    [YCSB_SCAN] = "scan",
+    [YCSB_RMW] = "rmw"
+};
+
+struct workload {
+    const char *name;
+    /* operation mix in percent, indexed by ycsb_op_t */
+    int mix[NR_YCSB_OPS];
+    dist_t dist;
+};
+
+static struct workload load_workload = { "load", { [YCSB_INSERT] = 100 }, DIST_UNIFORM };
+
+static struct workload workloads[] = {
+    { "a", { [YCSB_READ] = 50, [YCSB_UPDATE] = 50 }, DIST_ZIPFIAN },
+    { "b", { [YCSB_READ] = 95, [YCSB_UPDATE] = 5 }, DIST_ZIPFIAN },
+    { "c", { [YCSB_READ] = 100 }, DIST_ZIPFIAN },
+    { "d", { [YCSB_READ] = 95, [YCSB_INSERT] = 5 }, DIST_LATEST },
+    { "e", { [YCSB_SCAN] = 95, [YCSB_INSERT] = 5 }, DIST_ZIPFIAN },
+    { "f", { [YCSB_READ] = 50, [YCSB_RMW] = 50 }, DIST_ZIPFIAN },
+};
+
+struct hist {
+    uint64_t cnt, sum;
+    uint64_t buckets[HIST_NR_BUCKETS];
+};
+
+struct phase_stat {
+    struct hist hists[NR_YCSB_OPS];
+    uint64_t nr_failed;
+};
+
+struct zipf {
+    uint64_t n;
+    double theta, alpha, zetan, eta, half_pow_theta;
+};
+
+struct worker {
+    pthread_t thread;
+    int id;
+
+    kv_cli_t *cli;
+
+    uint64_t rand_state;
+    char key_buf[KEY_BUF_LEN];
+
+    /* pending reads, issued together through kv_get_batch */
+    int nr_gets;
+    char get_key_bufs[MAX_GET_BATCH][KEY_BUF_LEN];
+    k_t get_keys[MAX_GET_BATCH];
+
+    struct phase_stat *stats;
+};
+
+/* benchmark configuration */
+static int nr_threads = 1;
+static uint64_t nr_records = 1000000;
+static uint64_t nr_ops = 1000000;
+static int max_scan_len = 100;
+static double zipf_theta = 0.99;
+static bool str_keys = false;
+static bool ordered_inserts = false;
+static int forced_dist = -1;
+static const char *output_path = NULL;
+static const char *mn_dev = "anon:4G";
+static int get_depth = 1;
+static log_durability_t durability = LOG_BUFFERED;
+static int group_commit_us;
+
+static struct workload **phases;
+static int nr_phases;
+
+static kv_t *kv;
+static struct worker *workers;
+static pthread_barrier_t phase_barrier;
+static struct zipf zipf;
+
+/*
+ * Key numbers handed out so far (Load + inserts issued by run phases), and the ones of them
+ * that reads may pick: only inserts acknowledged without a gap before them, as in YCSB's
+ * AcknowledgedCounterGenerator
+ */
+static uint64_t nr_inserts, nr_keys;
+static bool insert_acked[INSERT_ACK_WINDOW];
+static pthread_mutex_t insert_ack_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int str_key_cmp(k_t a, k_t b) {
+    return memncmp(a.key, a.len, b.key, b.len);
+}
+
+static uint64_t str_key_hash(k_t key) {
+    uint64_t h = 0xcbf29ce484222325ul;
+    int i;
+
+    for (i = 0; i < key.len; i++) {
+        h ^= (uint8_t) key.key[i];
+        h *= 0x100000001b3ul;
+    }
+
+    return h;
+}
+
+static int str_key_dump(k_t key, char *buf, int buflen) {
+    snprintf(buf, buflen, "%.*s", key.len, key.key);
+    return 0;
+}
+
+static char str_min_key[] = "", str_max_key[STR_KEY_LEN + 1];
+
+static kc_t str_kc = {
+    .min = { str_min_key, 0 },
+    .max = { str_max_key, STR_KEY_LEN },
+    .max_len = STR_KEY_LEN,
+    .cmp = str_key_cmp,
+    .hash = str_key_hash,
+    .dump = str_key_dump
+};
+
+static kv_conf_t kv_conf = {
+    .rpma_host = "192.168.1.3:8888",
+    .rpma_dev_ip = "192.168.1.1",
+
+    .logger_nr_shards = 6,
+    .logger_shard_devs = (const char *[]) {
+        "log_pm0", "log_pm1", "log_pm2",
+        "log_pm3", "log_pm4", "log_pm5"
+    },
+
+    .dset_bdev = "data_pm",
+    .dset_dnode_cache_size = 65536,
+
+    BENCH_KV_CONF_COMMON,
+
+    .auto_gc_logs = true,
+    .auto_gc_pm = true,
+    .min_gc_size = 16 * 1024,
+    .pm_high_watermark = 8 * 1024 * 1024 * 1024ul,
+    .pm_gc_size = 256 * 1024 * 1024ul,
+    .gc_nr_workers = 4
+};
+
+static inline uint64_t fnv_hash64(uint64_t val) {
+    uint64_t h = 0xcbf29ce484222325ul;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        h ^= val & 0xff;
+        h *= 0x100000001b3ul;
+        val >>= 8;
+    }
+
+    return h;
+}
+
+static double zeta(uint64_t n, double theta) {
+    double sum = 0;
+    uint64_t i;
+
+    for (i = 1; i <= n; i++) {
+        sum += 1 / pow((double) i, theta);
+    }
+
+    return sum;
+}
+
+/* Gray et al., "Quickly generating billion-record synthetic databases", SIGMOD'94 */
+static void zipf_init(struct zipf *z, uint64_t n, double theta) {
+    double zeta2 = zeta(2, theta);
+
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1 / (1 - theta);
+    z->zetan = zeta(n, theta);
+    z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / z->zetan);
+    z->half_pow_theta = 1 + pow(0.5, theta);
+}
+
+static inline uint64_t zipf_next(struct zipf *z, struct worker *w) {
+    double u = rand_double(&w->rand_state), uz = u * z->zetan;
+    uint64_t v;
+
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < z->half_pow_theta) {
+        return 1;
+    }
+    v = z->n * pow(z->eta * u - z->eta + 1, z->alpha);
+    return v < z->n ? v : z->n - 1;
+}
+
+/* the insert of @keynum is done, whether it succeeded or not */
+static void ack_insert(uint64_t keynum) {
+    bonsai_assert(keynum - READ_ONCE(nr_keys) < INSERT_ACK_WINDOW);
+    WRITE_ONCE(insert_acked[keynum % INSERT_ACK_WINDOW], true);
+
+    /* whoever holds the lock advances past our ack, or the next ack does */
+    if (pthread_mutex_trylock(&insert_ack_lock)) {
+        return;
+    }
+    while (READ_ONCE(insert_acked[nr_keys % INSERT_ACK_WINDOW])) {
+        WRITE_ONCE(insert_acked[nr_keys % INSERT_ACK_WINDOW], false);
+        WRITE_ONCE(nr_keys, nr_keys + 1);
+    }
+    pthread_mutex_unlock(&insert_ack_lock);
+}
+
+static inline uint64_t next_keynum(struct worker *w, dist_t dist) {
+    uint64_t n = READ_ONCE(nr_keys), v;
+
+    switch (dist) {
+        case DIST_UNIFORM:
+            return rand_next(&w->rand_state) % n;
+
+        case DIST_ZIPFIAN:
+            /* scrambled, so that popular items are spread across the key space */
+            return fnv_hash64(zipf_next(&zipf, w)) % n;
+
+        case DIST_LATEST:
+            v = zipf_next(&zipf, w);
+            return v < n ? n - 1 - v : 0;
+
+        default:
+            bonsai_assert(0);
+    }
+
+    return 0;
+}
+
+static inline k_t make_key_at(char *buf, uint64_t keynum) {
+    uint64_t v = ordered_inserts ? keynum : fnv_hash64(keynum);
+
+    if (str_keys) {
+        snprintf(buf, KEY_BUF_LEN, "user%020lu", v);
+        return (k_t) { buf, STR_KEY_LEN };
+    }
+
+    *(uint64_t *) buf = htobe64(v);
+    return (k_t) { buf, sizeof(uint64_t) };
+}
+
+static inline k_t make_key(struct worker *w, uint64_t keynum) {
+    return make_key_at(w->key_buf, keynum);
+}
+
+static inline int hist_bucket(uint64_t v) {
+    int msb;
+
+    if (v < HIST_SUB_CNT) {
+        return (int) v;
+    }
+
+    msb = 63 - __builtin_clzl(v);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_CNT + (int) ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB_CNT - 1));
+}
+
+static inline uint64_t hist_bucket_val(int bucket) {
+    int shift;
+
+    if (bucket < HIST_SUB_CNT) {
+        return bucket;
+    }
+
+    shift = bucket / HIST_SUB_CNT - 1;
+    return (uint64_t) (HIST_SUB_CNT + bucket % HIST_SUB_CNT) << shift;
+}
+
+static inline void hist_add(struct hist *hist, uint64_t v) {
+    hist->buckets[hist_bucket(v)]++;
+    hist->cnt++;
+    hist->sum += v;
+}
+
+static void hist_merge(struct hist *dst, const struct hist *src) {
+    int i;
+
+    for (i = 0; i < HIST_NR_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->cnt += src->cnt;
+    dst->sum += src->sum;
+}
+
+static uint64_t hist_percentile(const struct hist *hist, double p) {
+    uint64_t target, acc = 0;
+    int i;
+
+    if (!hist->cnt) {
+        return 0;
+    }
+
+    target = (uint64_t) ceil(hist->cnt * p);
+    for (i = 0; i < HIST_NR_BUCKETS; i++) {
+        acc += hist->buckets[i];
+        if (acc >= target) {
+            return hist_bucket_val(i);
+        }
+    }
+
+    return hist_bucket_val(HIST_NR_BUCKETS - 1);
+}
+
+static inline ycsb_op_t choose_op(struct worker *w, struct workload *wl) {
+    int r = (int) (rand_next(&w->rand_state) % 100), op;
+
+    for (op = 0; op < NR_YCSB_OPS - 1; op++) {
+        if (r < wl->mix[op]) {
+            break;
+        }
+        r -= wl->mix[op];
+    }
+
+    return op;
+}
+
+static int scan_record(k_t key, uint64_t valp, void *priv) {
+    uint64_t *sum = priv;
+    *sum += valp;
+    return 0;
+}
+
+static inline int do_op(struct worker *w, struct workload *wl, ycsb_op_t op, uint64_t keynum) {
+    dist_t dist = forced_dist >= 0 ? forced_dist : wl->dist;
+    uint64_t valp = 0;
+    int ret;
+    k_t key;
+
+    switch (op) {
+        case YCSB_READ:
+            key = make_key(w, next_keynum(w, dist));
+            ret = kv_get(w->cli, key, &valp);
+            break;
+
+        case YCSB_UPDATE:
+            key = make_key(w, next_keynum(w, dist));
+            ret = kv_put(w->cli, key, rand_next(&w->rand_state));
+            break;
+
+        case YCSB_INSERT:
+            key = make_key(w, keynum);
+            ret = kv_put(w->cli, key, keynum);
+            break;
+
+        case YCSB_SCAN:
+            key = make_key(w, next_keynum(w, dist));
+            ret = kv_scan(w->cli, key, 1 + (int) (rand_next(&w->rand_state) % max_scan_len), scan_record, &valp);
+            ret = ret < 0 ? ret : 0;
+            break;
+
+        case YCSB_RMW:
+            key = make_key(w, next_keynum(w, dist));
+            ret = kv_get(w->cli, key, &valp);
+            if (likely(!ret)) {
+                ret = kv_put(w->cli, key, valp + 1);
+            }
+            break;
+
+        default:
+            bonsai_assert(0);
+    }
+
+    return ret;
+}
+
+/* issue pending reads as one pipelined batch, each read is charged the batch latency */
+static void flush_gets(struct worker *w, struct phase_stat *stat) {
+    uint64_t vals[MAX_GET_BATCH];
+    int rets[MAX_GET_BATCH];
+    struct bench_timer timer;
+    long lat;
+    int i;
+
+    if (!w->nr_gets) {
+        return;
+    }
+
+    bench_timer_start(&timer);
+    kv_get_batch(w->cli, w->get_keys, w->nr_gets, vals, rets);
+    lat = bench_timer_end(&timer);
+
+    for (i = 0; i < w->nr_gets; i++) {
+        hist_add(&stat->hists[YCSB_READ], lat);
+        if (unlikely(rets[i])) {
+            stat->nr_failed++;
+        }
+    }
+
+    w->nr_gets = 0;
+}
+
+static void run_phase(struct worker *w, struct workload *wl, struct phase_stat *stat) {
+    dist_t dist = forced_dist >= 0 ? forced_dist : wl->dist;
+    struct bench_timer timer;
+    uint64_t i, n, start, keynum = 0;
+    bool load = wl == &load_workload;
+    ycsb_op_t op;
+    int ret;
+
+    if (load) {
+        /* each worker loads a contiguous slice of [0, nr_records) */
+        n = nr_records / nr_threads;
+        start = n * w->id;
+        if (w->id == nr_threads - 1) {
+            n = nr_records - start;
+        }
+    } else {
+        n = nr_ops / nr_threads;
+        start = 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        op = load ? YCSB_INSERT : choose_op(w, wl);
+        if (op == YCSB_INSERT) {
+            keynum = load ? start + i : xadd2(&nr_inserts, 1);
+        }
+
+        if (get_depth > 1 && op == YCSB_READ) {
+            w->get_keys[w->nr_gets] = make_key_at(w->get_key_bufs[w->nr_gets], next_keynum(w, dist));
+            if (++w->nr_gets == get_depth) {
+                flush_gets(w, stat);
+            }
+            continue;
+        }
+
+        /* keep reads ordered before later writes of this worker */
+        flush_gets(w, stat);
+
+        bench_timer_start(&timer);
+        ret = do_op(w, wl, op, keynum);
+        hist_add(&stat->hists[op], bench_timer_end(&timer));
+
+        if (op == YCSB_INSERT && !load) {
+            ack_insert(keynum);
+        }
+
+        if (unlikely(ret)) {
+            stat->nr_failed++;
+        }
+    }
+
+    flush_gets(w, stat);
+}
+
+static void *worker_fn(void *arg) {
+    kv_cli_conf_t cli_conf = { 0 };
+    struct worker *w = arg;
+    char name[16];
+    int i;
+
+    snprintf(name, sizeof(name), "ycsb-%d", w->id);
+    pthread_setname_np(pthread_self(), name);
+
+    cli_conf.id = w->id;
+    cli_conf.logger_region_size = LOG_REGION_SIZE;
+    cli_conf.get_depth = get_depth;
+    cli_conf.durability = durability;
+    cli_conf.group_commit_us = group_commit_us;
+    w->cli = kv_cli_create(kv, &cli_conf);
+    if (unlikely(IS_ERR(w->cli))) {
+        pr_err("failed to create kv_cli for worker %d", w->id);
+        abort();
+    }
+
+    for (i = 0; i < nr_phases; i++) {
+        pthread_barrier_wait(&phase_barrier);
+        run_phase(w, phases[i], &w->stats[i]);
+        pthread_barrier_wait(&phase_barrier);
+    }
+
+    kv_cli_destroy(w->cli);
+
+    return NULL;
+}
+
+static cJSON *hist_dump(const struct hist *hist) {
+    cJSON *out;
+
+    out = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(out, "ops", hist->cnt);
+    cJSON_AddNumberToObject(out, "avg", hist->cnt ? (double) hist->sum / hist->cnt : 0);
+    cJSON_AddNumberToObject(out, "p50", hist_percentile(hist, 0.5));
+    cJSON_AddNumberToObject(out, "p99", hist_percentile(hist, 0.99));
+    cJSON_AddNumberToObject(out, "p999", hist_percentile(hist, 0.999));
+
+    return out;
+}
+
+static cJSON *phase_dump(int phase, double elapsed_s) {
+    static struct hist total, per_op[NR_YCSB_OPS];
+    struct workload *wl = phases[phase];
+    cJSON *out, *ops;
+    uint64_t failed = 0;
+    int i, op;
+
+    memset(&total, 0, sizeof(total));
+    memset(per_op, 0, sizeof(per_op));
+
+    for (i = 0; i < nr_threads; i++) {
+        for (op = 0; op < NR_YCSB_OPS; op++) {
+            hist_merge(&per_op[op], &workers[i].stats[phase].hists[op]);
+            hist_merge(&total, &workers[i].stats[phase].hists[op]);
+        }
+        failed += workers[i].stats[phase].nr_failed;
+    }
+
+    out = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(out, "workload", wl->name);
+    cJSON_AddStringToObject(out, "dist", dist_str[forced_dist >= 0 ? forced_dist : wl->dist]);
+    cJSON_AddNumberToObject(out, "threads", nr_threads);
+    cJSON_AddNumberToObject(out, "ops", total.cnt);
+    cJSON_AddNumberToObject(out, "failed", failed);
+    cJSON_AddNumberToObject(out, "elapsed_s", elapsed_s);
+    cJSON_AddNumberToObject(out, "mops", total.cnt / elapsed_s / 1e6);
+    cJSON_AddItemToObject(out, "latency_ns", hist_dump(&total));
+
+    ops = cJSON_CreateObject();
+    for (op = 0; op < NR_YCSB_OPS; op++) {
+        if (per_op[op].cnt) {
+            cJSON_AddItemToObject(ops, ycsb_op_str[op], hist_dump(&per_op[op]));
+        }
+    }
+    cJSON_AddItemToObject(out, "ops_latency_ns", ops);
+
+    pr_info("[%s] %d threads: %.2f Mop/s, p50=%luns p99=%luns p999=%luns, %lu failed",
+            wl->name, nr_threads, total.cnt / elapsed_s / 1e6,
+            hist_percentile(&total, 0.5), hist_percentile(&total, 0.99), hist_percentile(&total, 0.999), failed);
+
+    return out;
+}
+
+static inline double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct workload *find_workload(const char *name) {
+    int i;
+
+    for (i = 0; i < ARRAY_LEN(workloads); i++) {
+        if (!strcasecmp(workloads[i].name, name)) {
+            return &workloads[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int parse_phases(const char *s) {
+    char *list, *tok, *save;
+    struct workload *wl;
+    int ret = 0;
+
+    list = strdup(s);
+    phases = calloc(strlen(s) + 2, sizeof(*phases));
+    if (unlikely(!list || !phases)) {
+        return -ENOMEM;
+    }
+
+    /* Load always goes first */
+    phases[nr_phases++] = &load_workload;
+
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        wl = find_workload(tok);
+        if (unlikely(!wl)) {
+            ret = -EINVAL;
+            pr_err("unknown workload: %s", tok);
+            break;
+        }
+        phases[nr_phases++] = wl;
+    }
+
+    free(list);
+
+    return ret;
+}
+
+/* buffered, sync, or group:US */
+static int parse_durability(const char *s) {
+    if (!strcasecmp(s, "buffered")) {
+        durability = LOG_BUFFERED;
+    } else if (!strcasecmp(s, "sync")) {
+        durability = LOG_SYNC;
+    } else if (!strncasecmp(s, "group:", 6) && (group_commit_us = atoi(s + 6)) > 0) {
+        durability = LOG_GROUP_COMMIT;
+    } else {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int parse_dist(const char *s) {
+    int i;
+
+    for (i = 0; i < NR_DISTS; i++) {
+        if (!strcasecmp(dist_str[i], s)) {
+            return i;
+        }
+    }
+
+    return -EINVAL;
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s [options]\n"
+           "  -t, --threads N        number of client threads (default 1)\n"
+           "  -n, --records N        number of records loaded (default 1000000)\n"
+           "  -p, --ops N            number of operations per run phase (default 1000000)\n"
+           "  -w, --workloads LIST   comma-separated run phases among a,b,c,d,e,f (default a)\n"
+           "  -k, --keys int|str     key class (default int)\n"
+           "  -d, --dist DIST        override request distribution: uniform, zipfian, latest\n"
+           "  -z, --theta T          zipfian constant (default 0.99)\n"
+           "  -s, --scan-len N       max scan length (default 100)\n"
+           "  -O, --ordered          insert keys in order instead of hashed order\n"
+           "  -H, --host IP:PORT     memory node, or shm:NAME[,rtt=NS][,bw=MBPS] to run it in-process\n"
+           "  -I, --dev-ip IP        local RNIC IP\n"
+           "  -M, --mn-dev DEV       PM device of the in-process memory node (default anon:4G)\n"
+           "  -g, --get-depth N      pipeline up to N consecutive reads per client (default 1)\n"
+           "  -D, --durability MODE  when writes are persisted: buffered, sync, group:US (default buffered)\n"
+           "  -o, --output FILE      write JSON result to FILE (default stdout)\n", prog);
+}
+
+static int parse_args(int argc, char *argv[]) {
+    static const struct option opts[] = {
+        { "threads", required_argument, NULL, 't' },
+        { "records", required_argument, NULL, 'n' },
+        { "ops", required_argument, NULL, 'p' },
+        { "workloads", required_argument, NULL, 'w' },
+        { "keys", required_argument, NULL, 'k' },
+        { "dist", required_argument, NULL, 'd' },
+        { "theta", required_argument, NULL, 'z' },
+        { "scan-len", required_argument, NULL, 's' },
+        { "ordered", no_argument, NULL, 'O' },
+        { "host", required_argument, NULL, 'H' },
+        { "dev-ip", required_argument, NULL, 'I' },
+        { "mn-dev", required_argument, NULL, 'M' },
+        { "get-depth", required_argument, NULL, 'g' },
+        { "durability", required_argument, NULL, 'D' },
+        { "output", required_argument, NULL, 'o' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *wls = "a";
+    int c, ret;
+
+    while ((c = getopt_long(argc, argv, "t:n:p:w:k:d:z:s:OH:I:M:g:D:o:h", opts, NULL)) != -1) {
+        switch (c) {
+            case 't': nr_threads = atoi(optarg); break;
+            case 'n': nr_records = strtoull(optarg, NULL, 0); break;
+            case 'p': nr_ops = strtoull(optarg, NULL, 0); break;
+            case 'w': wls = optarg; break;
+            case 'k': str_keys = !strcasecmp(optarg, "str"); break;
+            case 'd': forced_dist = parse_dist(optarg); break;
+            case 'z': zipf_theta = atof(optarg); break;
+            case 's': max_scan_len = atoi(optarg); break;
+            case 'O': ordered_inserts = true; break;
+            case 'H': kv_conf.rpma_host = optarg; break;
+            case 'I': kv_conf.rpma_dev_ip = optarg; break;
+            case 'M': mn_dev = optarg; break;
+            case 'g': get_depth = atoi(optarg); break;
+            case 'D':
+                ret = parse_durability(optarg);
+                if (unlikely(ret)) {
+                    pr_err("invalid durability: %s", optarg);
+                    return ret;
+                }
+                break;
+            case 'o': output_path = optarg; break;
+            default:
+                usage(argv[0]);
+                return -EINVAL;
+        }
+    }
+
+    if (unlikely(nr_threads <= 0 || !nr_records || max_scan_len <= 0 ||
+                 get_depth <= 0 || get_depth > MAX_GET_BATCH)) {
+        pr_err("invalid arguments");
+        return -EINVAL;
+    }
+
+    if (unlikely(forced_dist == -EINVAL)) {
+        pr_err("invalid distribution");
+        return -EINVAL;
+    }
+
+    return parse_phases(wls);
+}
+
+static void dump_result(cJSON *result) {
+    FILE *fh = stdout;
+    char *s;
+
+    if (output_path) {
+        fh = fopen(output_path, "w");
+        if (unlikely(!fh)) {
+            pr_err("failed to open file %s: %s", output_path, strerror(errno));
+            abort();
+        }
+    }
+
+    s = cJSON_Print(result);
+    fprintf(fh, "%s\n", s);
+    free(s);
+
+    if (output_path) {
+        fclose(fh);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    cJSON *result, *phase_results;
+    double start;
+    int i, ret;
+
+    ret = parse_args(argc, argv);
+    if (unlikely(ret)) {
+        return 1;
+    }
+
+    reg_basic_sig_handler();
+    bench_timer_init_freq();
+
+    memset(str_max_key, 0xff, STR_KEY_LEN);
+    kv_conf.kc = str_keys ? &str_kc : &int_kc;
+
+    if (!strncmp(kv_conf.rpma_host, "shm:", 4)) {
+        /* in-process memory node */
+        if (unlikely(IS_ERR(bench_start_mn(kv_conf.rpma_host, mn_dev)))) {
+            pr_err("failed to create in-process memory node");
+            return 1;
+        }
+    }
+
+    kv = kv_create(&kv_conf);
+    if (unlikely(IS_ERR(kv))) {
+        pr_err("failed to create kv");
+        return 1;
+    }
+
+    /* the run phases draw keys from the loaded ones (plus later inserts) */
+    zipf_init(&zipf, nr_records, zipf_theta);
+    nr_inserts = nr_keys = nr_records;
+
+    workers = calloc(nr_threads, sizeof(*workers));
+    bonsai_assert(workers);
+
+    pthread_barrier_init(&phase_barrier, NULL, nr_threads + 1);
+
+    for (i = 0; i < nr_threads; i++) {
+        workers[i].id = i;
+        workers[i].rand_state = get_rand_seed() | 1;
+        workers[i].stats = calloc(nr_phases, sizeof(*workers[i].stats));
+        bonsai_assert(workers[i].stats);
+        ret = pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]);
+        bonsai_assert(!ret);
+    }
+
+    result = cJSON_CreateObject();
+    cJSON_AddStringToObject(result, "keys", str_keys ? "str" : "int");
+    cJSON_AddNumberToObject(result, "records", nr_records);
+    cJSON_AddNumberToObject(result, "threads", nr_threads);
+    phase_results = cJSON_CreateArray();
+    cJSON_AddItemToObject(result, "phases", phase_results);
+
+    for (i = 0; i < nr_phases; i++) {
+        pthread_barrier_wait(&phase_barrier);
+        start = now_s();
+        pthread_barrier_wait(&phase_barrier);
+        cJSON_AddItemToArray(phase_results, phase_dump(i, now_s() - start));
+    }
+
+    for (i = 0; i < nr_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        free(workers[i].stats);
+    }
+
+    dump_result(result);
+    cJSON_Delete(result);
+
+    pthread_barrier_destroy(&phase_barrier);
+    free(workers);
+    free(phases);
+
+    kv_destroy(kv);
 
-int main() {
     return 0;
 }
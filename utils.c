@@ -103,3 +103,68 @@ void bench_timer_init_freq() {
     get_tsc_khz();
     pr_info("bench timer: TSC_KHZ=%d", tsc_khz);
 }
+
+/* reflected CRC32C polynomial */
+#define CRC32C_POLY     0x82f63b78
+
+static uint32_t crc32c_table[256];
+
+static uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+
+    for (; len; len--, p++) {
+        crc = crc32c_table[(crc ^ *p) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+static uint32_t crc32c_sse42(uint32_t crc, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+    uint64_t c = crc, v;
+
+    for (; len >= sizeof(v); len -= sizeof(v), p += sizeof(v)) {
+        memcpy(&v, p, sizeof(v));
+        asm("crc32q %1, %0" : "+r"(c) : "rm"(v));
+    }
+    for (; len; len--, p++) {
+        asm("crc32b %1, %k0" : "+r"(c) : "qm"(*p));
+    }
+    return c;
+}
+
+#endif
+
+static uint32_t crc32c_resolve(uint32_t crc, const void *buf, size_t len) {
+    crc32c_t *impl = crc32c_sw;
+    uint32_t c;
+    int i, j;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        impl = crc32c_sse42;
+    }
+#endif
+
+    if (impl == crc32c_sw) {
+        for (i = 0; i < 256; i++) {
+            for (c = i, j = 0; j < 8; j++) {
+                c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+            }
+            crc32c_table[i] = c;
+        }
+        /* the table is ready before anyone calls the software one */
+        smp_wmb();
+    }
+
+    pr_debug(5, "crc32c uses %s", impl == crc32c_sw ? "a lookup table" : "sse4.2");
+
+    /* racing resolvers pick the same implementation */
+    WRITE_ONCE(crc32c_impl, impl);
+
+    return impl(crc, buf, len);
+}
+
+crc32c_t *crc32c_impl = crc32c_resolve;
@@ -21,6 +21,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <time.h>
 
 extern int debug_level;
 
@@ -291,4 +292,23 @@ static long bench_timer_end(struct bench_timer *timer) {
 	return (end_tsc - timer->start_tsc) * 1000000 / tsc_khz;
 }
 
+/* monotonic clock, unit: ns */
+static inline uint64_t get_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+typedef uint32_t crc32c_t(uint32_t crc, const void *buf, size_t len);
+
+extern crc32c_t *crc32c_impl;
+
+/*
+ * CRC32C (Castagnoli) of @buf continuing from @crc, with the SSE4.2 crc32 instruction if the
+ * running CPU has it (picked at the first call), a table-driven one otherwise
+ */
+static inline uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+	return crc32c_impl(crc, buf, len);
+}
+
 #endif //BONSAIKV_UTILS_H